@@ -2088,6 +2088,7 @@ static struct commit *fake_working_tree_commit(struct diff_options *opt,
 	commit->parents = xcalloc(1, sizeof(*commit->parents));
 	commit->parents->item = lookup_commit_reference(head_sha1);
 	commit->object.parsed = 1;
+	commit->generation = GENERATION_NUMBER_INFINITY;
 	commit->date = now;
 	commit->object.type = OBJ_COMMIT;
 
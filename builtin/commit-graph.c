@@ -0,0 +1,114 @@
+#include "builtin.h"
+#include "cache.h"
+#include "changed-paths.h"
+#include "commit.h"
+#include "commit-graph.h"
+#include "refs.h"
+#include "sha1-array.h"
+#include "parse-options.h"
+
+static const char * const commit_graph_usage[] = {
+	"git commit-graph write [--stdin-commits] [--changed-paths]",
+	"git commit-graph verify",
+	NULL
+};
+
+static int add_ref_tip(const char *refname, const unsigned char *sha1,
+		       int flags, void *cb_data)
+{
+	struct sha1_array *tips = cb_data;
+	struct commit *commit = lookup_commit_reference_gently(sha1, 1);
+
+	if (commit)
+		sha1_array_append(tips, commit->object.sha1);
+	return 0;
+}
+
+static int graph_write(int argc, const char **argv, const char *prefix)
+{
+	struct sha1_array tips = SHA1_ARRAY_INIT;
+	int stdin_commits = 0, changed_paths = 0, ret;
+	struct option options[] = {
+		OPT_BOOLEAN(0, "stdin-commits", &stdin_commits,
+			    "start walk at commits listed by stdin"),
+		OPT_BOOLEAN(0, "changed-paths", &changed_paths,
+			    "also write the paths each commit changed"),
+		OPT_END()
+	};
+
+	argc = parse_options(argc, argv, prefix, options,
+			     commit_graph_usage, 0);
+	if (argc)
+		usage_with_options(commit_graph_usage, options);
+
+	if (is_repository_shallow())
+		die("cannot write a commit-graph in a shallow repository");
+
+	if (stdin_commits) {
+		struct strbuf buf = STRBUF_INIT;
+
+		while (strbuf_getline(&buf, stdin, '\n') != EOF) {
+			unsigned char sha1[20];
+			struct commit *commit;
+
+			if (get_sha1_hex(buf.buf, sha1))
+				die("invalid commit name '%s'", buf.buf);
+			commit = lookup_commit_reference(sha1);
+			if (!commit)
+				die("invalid commit name '%s'", buf.buf);
+			sha1_array_append(&tips, commit->object.sha1);
+		}
+		strbuf_release(&buf);
+	} else {
+		head_ref(add_ref_tip, &tips);
+		for_each_ref(add_ref_tip, &tips);
+	}
+
+	ret = write_commit_graph(&tips);
+	if (!ret && changed_paths)
+		ret = write_changed_paths(&tips);
+	sha1_array_clear(&tips);
+	return ret;
+}
+
+static int graph_verify(int argc, const char **argv, const char *prefix)
+{
+	struct option options[] = {
+		OPT_END()
+	};
+
+	argc = parse_options(argc, argv, prefix, options,
+			     commit_graph_usage, 0);
+	if (argc)
+		usage_with_options(commit_graph_usage, options);
+
+	return verify_commit_graph() + verify_changed_paths();
+}
+
+int cmd_commit_graph(int argc, const char **argv, const char *prefix)
+{
+	int result;
+	struct option options[] = {
+		OPT_END()
+	};
+
+	git_config(git_default_config, NULL);
+	argc = parse_options(argc, argv, prefix, options, commit_graph_usage,
+			     PARSE_OPT_STOP_AT_NON_OPTION);
+
+	/* the file records the real parents, not the replaced ones */
+	read_replace_refs = 0;
+
+	if (argc < 1)
+		usage_with_options(commit_graph_usage, options);
+	else if (!strcmp(argv[0], "write"))
+		result = graph_write(argc, argv, prefix);
+	else if (!strcmp(argv[0], "verify"))
+		result = graph_verify(argc, argv, prefix);
+	else {
+		result = error("Unknown subcommand: %s", argv[0]);
+		usage_with_options(commit_graph_usage, options);
+	}
+
+	return result ? 1 : 0;
+}
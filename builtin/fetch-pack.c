@@ -18,6 +18,7 @@ static int prefer_ofs_delta = 1;
 static int no_done;
 static int fetch_fsck_objects = -1;
 static int transfer_fsck_objects = -1;
+static int negotiate_skipping;
 static struct fetch_pack_args args = {
 	/* .uploadpack = */ "git-upload-pack",
 };
@@ -42,11 +43,28 @@ static int marked;
 static struct commit_list *rev_list;
 static int non_common_revs, multi_ack, use_sideband;
 
+/*
+ * With fetch.negotiationAlgorithm=skipping, every commit in rev_list
+ * carries one of these in its "util" field.  "ttl" is the number of
+ * commits still to be skipped before the next "have" on this line of
+ * history, and "original_ttl" the length of the current stride.
+ */
+struct skip_entry {
+	unsigned short original_ttl;
+	unsigned short ttl;
+};
+
 static void rev_list_push(struct commit *commit, int mark)
 {
 	if (!(commit->object.flags & mark)) {
 		commit->object.flags |= mark;
 
+		if (negotiate_skipping) {
+			if (!commit->util)
+				commit->util = xmalloc(sizeof(struct skip_entry));
+			memset(commit->util, 0, sizeof(struct skip_entry));
+		}
+
 		if (!(commit->object.parsed))
 			if (parse_commit(commit))
 				return;
@@ -161,6 +179,91 @@ static const unsigned char *get_rev(void)
 	return commit->object.sha1;
 }
 
+/*
+ * Queue "parent" of a commit that was just popped, and let it inherit
+ * how many more commits to skip.  A stride that ended with a "have"
+ * is followed by a longer one, so each line of history is sampled at
+ * exponentially growing distances until the other side ACKs.
+ * Returns 0 if the parent was already popped.
+ */
+static int skip_push_parent(struct commit *commit, struct commit *parent,
+			    unsigned int mark)
+{
+	struct skip_entry *entry = commit->util, *parent_entry;
+	unsigned int original_ttl, ttl;
+	int fresh = 0;
+
+	if (!(parent->object.flags & SEEN)) {
+		rev_list_push(parent, mark);
+		fresh = 1;
+	} else if (parent->object.flags & POPPED)
+		return 0; /* clock skew; pretend it is not there */
+
+	if (entry->ttl) {
+		original_ttl = entry->original_ttl;
+		ttl = entry->ttl - 1;
+	} else {
+		original_ttl = entry->original_ttl * 3 / 2 + 1;
+		if (original_ttl > 0xffff)
+			original_ttl = 0xffff;
+		ttl = original_ttl;
+	}
+	parent_entry = parent->util;
+	if (fresh || parent_entry->ttl < ttl) {
+		parent_entry->original_ttl = original_ttl;
+		parent_entry->ttl = ttl;
+	}
+	return 1;
+}
+
+/*
+ * Like get_rev(), but skip commits whose ttl has not run out yet.  A
+ * commit is sent anyway if it ends its line of history, so that the
+ * root of every line is offered before we give up.
+ */
+static const unsigned char *get_rev_skipping(void)
+{
+	struct commit *to_send = NULL;
+
+	while (!to_send) {
+		struct commit *commit;
+		struct commit_list *parents;
+		unsigned int mark;
+		int parent_pushed = 0;
+
+		if (rev_list == NULL || non_common_revs == 0)
+			return NULL;
+
+		commit = pop_commit(&rev_list);
+		if (!commit->object.parsed)
+			parse_commit(commit);
+
+		commit->object.flags |= POPPED;
+		if (!(commit->object.flags & COMMON)) {
+			non_common_revs--;
+			if (!((struct skip_entry *)commit->util)->ttl)
+				to_send = commit;
+		}
+
+		if (commit->object.flags & (COMMON | COMMON_REF))
+			mark = COMMON | SEEN;
+		else
+			mark = SEEN;
+
+		for (parents = commit->parents; parents; parents = parents->next) {
+			parent_pushed |= skip_push_parent(commit, parents->item,
+							  mark);
+			if (mark & COMMON)
+				mark_common(parents->item, 1, 0);
+		}
+
+		if (!(commit->object.flags & COMMON) && !parent_pushed)
+			to_send = commit;
+	}
+
+	return to_send->object.sha1;
+}
+
 enum ack_type {
 	NAK = 0,
 	ACK,
@@ -389,7 +492,7 @@ static int find_common(int fd[2], unsigned char *result_sha1,
 
 	flushes = 0;
 	retval = -1;
-	while ((sha1 = get_rev())) {
+	while ((sha1 = negotiate_skipping ? get_rev_skipping() : get_rev())) {
 		packet_buf_write(&req_buf, "have %s\n", sha1_to_hex(sha1));
 		if (args.verbose)
 			fprintf(stderr, "have %s\n", sha1_to_hex(sha1));
@@ -876,6 +979,18 @@ static int fetch_pack_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (!strcmp(var, "fetch.negotiationalgorithm")) {
+		if (!value)
+			return config_error_nonbool(var);
+		if (!strcmp(value, "skipping"))
+			negotiate_skipping = 1;
+		else if (!strcmp(value, "default"))
+			negotiate_skipping = 0;
+		else
+			return error("Malformed value for %s: %s", var, value);
+		return 0;
+	}
+
 	return git_default_config(var, value, cb);
 }
 
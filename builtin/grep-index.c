@@ -0,0 +1,106 @@
+#include "builtin.h"
+#include "cache.h"
+#include "commit.h"
+#include "diff.h"
+#include "revision.h"
+#include "grep-index.h"
+#include "refs.h"
+#include "parse-options.h"
+
+static const char * const grep_index_usage[] = {
+	"git grep-index write [--stdin-commits]",
+	"git grep-index verify",
+	NULL
+};
+
+static int add_ref_tip(const char *refname, const unsigned char *sha1,
+		       int flags, void *cb_data)
+{
+	struct rev_info *revs = cb_data;
+	struct commit *commit = lookup_commit_reference_gently(sha1, 1);
+
+	if (commit)
+		add_pending_object(revs, &commit->object, refname);
+	return 0;
+}
+
+static int index_write(int argc, const char **argv, const char *prefix)
+{
+	struct rev_info revs;
+	int stdin_commits = 0;
+	struct option options[] = {
+		OPT_BOOLEAN(0, "stdin-commits", &stdin_commits,
+			    "index the trees of commits listed by stdin"),
+		OPT_END()
+	};
+
+	argc = parse_options(argc, argv, prefix, options,
+			     grep_index_usage, 0);
+	if (argc)
+		usage_with_options(grep_index_usage, options);
+
+	init_revisions(&revs, prefix);
+	revs.tree_objects = 1;
+	revs.blob_objects = 1;
+
+	if (stdin_commits) {
+		struct strbuf buf = STRBUF_INIT;
+
+		while (strbuf_getline(&buf, stdin, '\n') != EOF) {
+			unsigned char sha1[20];
+			struct commit *commit;
+
+			if (get_sha1_hex(buf.buf, sha1))
+				die("invalid commit name '%s'", buf.buf);
+			commit = lookup_commit_reference(sha1);
+			if (!commit)
+				die("invalid commit name '%s'", buf.buf);
+			add_pending_object(&revs, &commit->object, buf.buf);
+		}
+		strbuf_release(&buf);
+	} else {
+		head_ref(add_ref_tip, &revs);
+		for_each_ref(add_ref_tip, &revs);
+	}
+
+	return write_grep_index(&revs);
+}
+
+static int index_verify(int argc, const char **argv, const char *prefix)
+{
+	struct option options[] = {
+		OPT_END()
+	};
+
+	argc = parse_options(argc, argv, prefix, options,
+			     grep_index_usage, 0);
+	if (argc)
+		usage_with_options(grep_index_usage, options);
+
+	return verify_grep_index();
+}
+
+int cmd_grep_index(int argc, const char **argv, const char *prefix)
+{
+	int result;
+	struct option options[] = {
+		OPT_END()
+	};
+
+	git_config(git_default_config, NULL);
+	argc = parse_options(argc, argv, prefix, options, grep_index_usage,
+			     PARSE_OPT_STOP_AT_NON_OPTION);
+
+	if (argc < 1)
+		usage_with_options(grep_index_usage, options);
+	else if (!strcmp(argv[0], "write"))
+		result = index_write(argc, argv, prefix);
+	else if (!strcmp(argv[0], "verify"))
+		result = index_verify(argc, argv, prefix);
+	else {
+		result = error("Unknown subcommand: %s", argv[0]);
+		usage_with_options(grep_index_usage, options);
+	}
+
+	return result ? 1 : 0;
+}
@@ -15,6 +15,7 @@
 #include "run-command.h"
 #include "userdiff.h"
 #include "grep.h"
+#include "grep-index.h"
 #include "quote.h"
 #include "dir.h"
 
@@ -25,9 +26,14 @@ static char const * const grep_usage[] = {
 
 static int use_threads = 1;
 
+/* Blobs that the grep-index file rules out are not read at all */
+static struct grep_index_filter *index_filter;
+
+/* Number of worker threads; 0 picks one per CPU. */
+static int num_threads;
+
 #ifndef NO_PTHREADS
-#define THREADS 8
-static pthread_t threads[THREADS];
+static pthread_t *threads;
 
 static void *load_sha1(const unsigned char *sha1, unsigned long *size,
 		       const char *name);
@@ -35,11 +41,7 @@ static void *load_file(const char *filename, size_t *sz);
 
 enum work_type {WORK_SHA1, WORK_FILE};
 
-/* We use one producer thread and THREADS consumer
- * threads. The producer adds struct work_items to 'todo' and the
- * consumers pick work items from the same array.
- */
-struct work_item {
+struct work_entry {
 	enum work_type type;
 	char *name;
 
@@ -48,6 +50,25 @@ struct work_item {
 	 * terminated filename.
 	 */
 	void *identifier;
+};
+
+/*
+ * Small files are handed out in batches, so that the threads do not
+ * spend more time taking turns at the locks than grepping them.  A
+ * batch is closed after WORK_BATCH files or WORK_BATCH_SIZE bytes,
+ * or at a file whose size is not known.
+ */
+#define WORK_BATCH 32
+#define WORK_BATCH_SIZE (64 * 1024)
+
+/* We use one producer thread and num_threads consumer
+ * threads. The producer adds struct work_items to 'todo' and the
+ * consumers pick work items from the same array.
+ */
+struct work_item {
+	struct work_entry entry[WORK_BATCH];
+	int nr;
+	unsigned long size;
 	char done;
 	struct strbuf out;
 };
@@ -57,12 +78,15 @@ struct work_item {
  * written the result for these to stdout yet.
  *
  * The work_items in [todo_start, todo_end) are waiting to be picked
- * up by a consumer thread.
+ * up by a consumer thread, and todo[todo_end] collects the files of
+ * the next one.
  *
- * The ranges are modulo TODO_SIZE.
+ * The ranges are modulo todo_size.
  */
-#define TODO_SIZE 128
-static struct work_item todo[TODO_SIZE];
+#define TODO_PER_THREAD 16
+#define TODO_MIN 128
+static struct work_item *todo;
+static int todo_size;
 static int todo_start;
 static int todo_end;
 static int todo_done;
@@ -70,6 +94,9 @@ static int todo_done;
 /* Has all work items been added? */
 static int all_work_added;
 
+/* Is a consumer writing out results? */
+static int writing;
+
 /* This lock protects all the variables above. */
 static pthread_mutex_t grep_mutex;
 
@@ -85,21 +112,6 @@ static inline void grep_unlock(void)
 		pthread_mutex_unlock(&grep_mutex);
 }
 
-/* Used to serialize calls to read_sha1_file. */
-static pthread_mutex_t read_sha1_mutex;
-
-static inline void read_sha1_lock(void)
-{
-	if (use_threads)
-		pthread_mutex_lock(&read_sha1_mutex);
-}
-
-static inline void read_sha1_unlock(void)
-{
-	if (use_threads)
-		pthread_mutex_unlock(&read_sha1_mutex);
-}
-
 /* Signalled when a new work_item is added to todo. */
 static pthread_cond_t cond_add;
 
@@ -113,22 +125,39 @@ static pthread_cond_t cond_result;
 
 static int skip_first_line;
 
-static void add_work(enum work_type type, char *name, void *id)
+/* Hand todo[todo_end] to the consumers; called with grep_mutex held. */
+static void publish_work(void)
 {
-	grep_lock();
-
-	while ((todo_end+1) % ARRAY_SIZE(todo) == todo_done) {
+	while ((todo_end+1) % todo_size == todo_done) {
 		pthread_cond_wait(&cond_write, &grep_mutex);
 	}
 
-	todo[todo_end].type = type;
-	todo[todo_end].name = name;
-	todo[todo_end].identifier = id;
-	todo[todo_end].done = 0;
-	strbuf_reset(&todo[todo_end].out);
-	todo_end = (todo_end + 1) % ARRAY_SIZE(todo);
-
+	todo_end = (todo_end + 1) % todo_size;
 	pthread_cond_signal(&cond_add);
+}
+
+static void add_work(enum work_type type, char *name, void *id,
+		     unsigned long size)
+{
+	struct work_item *w;
+	struct work_entry *e;
+
+	grep_lock();
+
+	w = &todo[todo_end];
+	if (!w->nr) {
+		w->size = 0;
+		w->done = 0;
+		strbuf_reset(&w->out);
+	}
+	e = &w->entry[w->nr++];
+	e->type = type;
+	e->name = name;
+	e->identifier = id;
+	w->size += size;
+
+	if (!size || w->nr == WORK_BATCH || w->size >= WORK_BATCH_SIZE)
+		publish_work();
 	grep_unlock();
 }
 
@@ -145,60 +174,87 @@ static struct work_item *get_work(void)
 		ret = NULL;
 	} else {
 		ret = &todo[todo_start];
-		todo_start = (todo_start + 1) % ARRAY_SIZE(todo);
+		todo_start = (todo_start + 1) % todo_size;
 	}
 	grep_unlock();
 	return ret;
 }
 
 static void grep_sha1_async(struct grep_opt *opt, char *name,
-			    const unsigned char *sha1)
+			    const unsigned char *sha1, unsigned long size)
 {
 	unsigned char *s;
 	s = xmalloc(20);
 	memcpy(s, sha1, 20);
-	add_work(WORK_SHA1, name, s);
+	add_work(WORK_SHA1, name, s, size);
 }
 
 static void grep_file_async(struct grep_opt *opt, char *name,
-			    const char *filename)
+			    const char *filename, unsigned long size)
 {
-	add_work(WORK_FILE, name, xstrdup(filename));
+	add_work(WORK_FILE, name, xstrdup(filename), size);
 }
 
-static void work_done(struct work_item *w)
+static void write_result(struct strbuf *out)
 {
-	int old_done;
+	const char *p = out->buf;
+	size_t len = out->len;
+
+	if (!len)
+		return;
 
+	/* Skip the leading hunk mark of the first file. */
+	if (skip_first_line) {
+		while (len) {
+			len--;
+			if (*p++ == '\n')
+				break;
+		}
+		skip_first_line = 0;
+	}
+
+	write_or_die(1, p, len);
+}
+
+static void work_done(struct work_item *w)
+{
 	grep_lock();
 	w->done = 1;
-	old_done = todo_done;
-	for(; todo[todo_done].done && todo_done != todo_start;
-	    todo_done = (todo_done+1) % ARRAY_SIZE(todo)) {
-		w = &todo[todo_done];
-		if (w->out.len) {
-			const char *p = w->out.buf;
-			size_t len = w->out.len;
-
-			/* Skip the leading hunk mark of the first file. */
-			if (skip_first_line) {
-				while (len) {
-					len--;
-					if (*p++ == '\n')
-						break;
-				}
-				skip_first_line = 0;
-			}
 
-			write_or_die(1, p, len);
-		}
-		free(w->name);
-		free(w->identifier);
+	/*
+	 * One consumer at a time writes out the results that are
+	 * next in line, without holding the lock; the others leave
+	 * theirs to it instead of waiting for stdout, and the
+	 * producer can reuse each slot as soon as its result is
+	 * taken out.
+	 */
+	if (writing) {
+		grep_unlock();
+		return;
 	}
+	writing = 1;
+	while (todo_done != todo_start && todo[todo_done].done) {
+		struct strbuf out;
+		int i;
 
-	if (old_done != todo_done)
+		w = &todo[todo_done];
+		out = w->out;
+		strbuf_init(&w->out, 0);
+		for (i = 0; i < w->nr; i++) {
+			free(w->entry[i].name);
+			free(w->entry[i].identifier);
+		}
+		w->nr = 0;
+		todo_done = (todo_done + 1) % todo_size;
 		pthread_cond_signal(&cond_write);
 
+		grep_unlock();
+		write_result(&out);
+		strbuf_release(&out);
+		grep_lock();
+	}
+	writing = 0;
+
 	if (all_work_added && todo_done == todo_end)
 		pthread_cond_signal(&cond_result);
 
@@ -212,27 +268,36 @@ static void *run(void *arg)
 
 	while (1) {
 		struct work_item *w = get_work();
+		int i;
+
 		if (!w)
 			break;
 
 		opt->output_priv = w;
-		if (w->type == WORK_SHA1) {
-			unsigned long sz;
-			void* data = load_sha1(w->identifier, &sz, w->name);
-
-			if (data) {
-				hit |= grep_buffer(opt, w->name, data, sz);
-				free(data);
-			}
-		} else if (w->type == WORK_FILE) {
-			size_t sz;
-			void* data = load_file(w->identifier, &sz);
-			if (data) {
-				hit |= grep_buffer(opt, w->name, data, sz);
-				free(data);
+		for (i = 0; i < w->nr; i++) {
+			struct work_entry *e = &w->entry[i];
+
+			if (e->type == WORK_SHA1) {
+				unsigned long sz;
+				void* data = load_sha1(e->identifier, &sz,
+						       e->name);
+
+				if (data) {
+					hit |= grep_buffer(opt, e->name,
+							   data, sz);
+					free(data);
+				}
+			} else if (e->type == WORK_FILE) {
+				size_t sz;
+				void* data = load_file(e->identifier, &sz);
+				if (data) {
+					hit |= grep_buffer(opt, e->name,
+							   data, sz);
+					free(data);
+				}
+			} else {
+				assert(0);
 			}
-		} else {
-			assert(0);
 		}
 
 		work_done(w);
@@ -254,17 +319,22 @@ static void start_threads(struct grep_opt *opt)
 	int i;
 
 	pthread_mutex_init(&grep_mutex, NULL);
-	pthread_mutex_init(&read_sha1_mutex, NULL);
+	enable_obj_read_lock();
 	pthread_mutex_init(&grep_attr_mutex, NULL);
 	pthread_cond_init(&cond_add, NULL);
 	pthread_cond_init(&cond_write, NULL);
 	pthread_cond_init(&cond_result, NULL);
 
-	for (i = 0; i < ARRAY_SIZE(todo); i++) {
+	todo_size = num_threads * TODO_PER_THREAD;
+	if (todo_size < TODO_MIN)
+		todo_size = TODO_MIN;
+	todo = xcalloc(todo_size, sizeof(*todo));
+	for (i = 0; i < todo_size; i++) {
 		strbuf_init(&todo[i].out, 0);
 	}
 
-	for (i = 0; i < ARRAY_SIZE(threads); i++) {
+	threads = xcalloc(num_threads, sizeof(*threads));
+	for (i = 0; i < num_threads; i++) {
 		int err;
 		struct grep_opt *o = grep_opt_dup(opt);
 		o->output = strbuf_out;
@@ -283,10 +353,12 @@ static int wait_all(void)
 	int i;
 
 	grep_lock();
+	if (todo[todo_end].nr)
+		publish_work(); /* the last batch */
 	all_work_added = 1;
 
 	/* Wait until all work is done. */
-	while (todo_done != todo_end)
+	while (todo_done != todo_end || writing)
 		pthread_cond_wait(&cond_result, &grep_mutex);
 
 	/* Wake up all the consumer threads so they can see that there
@@ -295,14 +367,19 @@ static int wait_all(void)
 	pthread_cond_broadcast(&cond_add);
 	grep_unlock();
 
-	for (i = 0; i < ARRAY_SIZE(threads); i++) {
+	for (i = 0; i < num_threads; i++) {
 		void *h;
 		pthread_join(threads[i], &h);
 		hit |= (int) (intptr_t) h;
 	}
+	free(threads);
+
+	for (i = 0; i < todo_size; i++)
+		strbuf_release(&todo[i].out);
+	free(todo);
 
 	pthread_mutex_destroy(&grep_mutex);
-	pthread_mutex_destroy(&read_sha1_mutex);
+	disable_obj_read_lock();
 	pthread_mutex_destroy(&grep_attr_mutex);
 	pthread_cond_destroy(&cond_add);
 	pthread_cond_destroy(&cond_write);
@@ -311,9 +388,6 @@ static int wait_all(void)
 	return hit;
 }
 #else /* !NO_PTHREADS */
-#define read_sha1_lock()
-#define read_sha1_unlock()
-
 static int wait_all(void)
 {
 	return 0;
@@ -344,6 +418,14 @@ static int grep_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (!strcmp(var, "grep.threads")) {
+		num_threads = git_config_int(var, value);
+		if (num_threads < 0)
+			die(_("invalid number of threads specified (%d) for %s"),
+			    num_threads, var);
+		return 0;
+	}
+
 	if (!strcmp(var, "color.grep"))
 		opt->color = git_config_colorbool(var, value);
 	else if (!strcmp(var, "color.grep.context"))
@@ -370,21 +452,11 @@ static int grep_config(const char *var, const char *value, void *cb)
 	return 0;
 }
 
-static void *lock_and_read_sha1_file(const unsigned char *sha1, enum object_type *type, unsigned long *size)
-{
-	void *data;
-
-	read_sha1_lock();
-	data = read_sha1_file(sha1, type, size);
-	read_sha1_unlock();
-	return data;
-}
-
 static void *load_sha1(const unsigned char *sha1, unsigned long *size,
 		       const char *name)
 {
 	enum object_type type;
-	void *data = lock_and_read_sha1_file(sha1, &type, size);
+	void *data = read_sha1_file(sha1, &type, size);
 
 	if (!data)
 		error(_("'%s': unable to read %s"), name, sha1_to_hex(sha1));
@@ -392,12 +464,19 @@ static void *load_sha1(const unsigned char *sha1, unsigned long *size,
 	return data;
 }
 
+/*
+ * "size" is how large the blob is, if the caller knows it, or 0.
+ */
 static int grep_sha1(struct grep_opt *opt, const unsigned char *sha1,
-		     const char *filename, int tree_name_len)
+		     const char *filename, int tree_name_len,
+		     unsigned long size)
 {
 	struct strbuf pathbuf = STRBUF_INIT;
 	char *name;
 
+	if (!grep_index_may_match(index_filter, sha1))
+		return 0;
+
 	if (opt->relative && opt->prefix_length) {
 		quote_path_relative(filename + tree_name_len, -1, &pathbuf,
 				    opt->prefix);
@@ -410,7 +489,7 @@ static int grep_sha1(struct grep_opt *opt, const unsigned char *sha1,
 
 #ifndef NO_PTHREADS
 	if (use_threads) {
-		grep_sha1_async(opt, name, sha1);
+		grep_sha1_async(opt, name, sha1, size);
 		return 0;
 	} else
 #endif
@@ -459,7 +538,8 @@ static void *load_file(const char *filename, size_t *sz)
 	return data;
 }
 
-static int grep_file(struct grep_opt *opt, const char *filename)
+static int grep_file(struct grep_opt *opt, const char *filename,
+		     unsigned long size)
 {
 	struct strbuf buf = STRBUF_INIT;
 	char *name;
@@ -472,7 +552,7 @@ static int grep_file(struct grep_opt *opt, const char *filename)
 
 #ifndef NO_PTHREADS
 	if (use_threads) {
-		grep_file_async(opt, name, filename);
+		grep_file_async(opt, name, filename, size);
 		return 0;
 	} else
 #endif
@@ -538,10 +618,11 @@ static int grep_cache(struct grep_opt *opt, const struct pathspec *pathspec, int
 		if (cached || (ce->ce_flags & CE_VALID) || ce_skip_worktree(ce)) {
 			if (ce_stage(ce))
 				continue;
-			hit |= grep_sha1(opt, ce->sha1, ce->name, 0);
+			hit |= grep_sha1(opt, ce->sha1, ce->name, 0,
+					 ce->ce_size);
 		}
 		else
-			hit |= grep_file(opt, ce->name);
+			hit |= grep_file(opt, ce->name, ce->ce_size);
 		if (ce_stage(ce)) {
 			do {
 				nr++;
@@ -577,7 +658,7 @@ static int grep_tree(struct grep_opt *opt, const struct pathspec *pathspec,
 		strbuf_add(base, entry.path, te_len);
 
 		if (S_ISREG(entry.mode)) {
-			hit |= grep_sha1(opt, entry.sha1, base->buf, tn_len);
+			hit |= grep_sha1(opt, entry.sha1, base->buf, tn_len, 0);
 		}
 		else if (S_ISDIR(entry.mode)) {
 			enum object_type type;
@@ -585,7 +666,7 @@ static int grep_tree(struct grep_opt *opt, const struct pathspec *pathspec,
 			void *data;
 			unsigned long size;
 
-			data = lock_and_read_sha1_file(entry.sha1, &type, &size);
+			data = read_sha1_file(entry.sha1, &type, &size);
 			if (!data)
 				die(_("unable to read tree (%s)"),
 				    sha1_to_hex(entry.sha1));
@@ -607,7 +688,7 @@ static int grep_object(struct grep_opt *opt, const struct pathspec *pathspec,
 		       struct object *obj, const char *name)
 {
 	if (obj->type == OBJ_BLOB)
-		return grep_sha1(opt, obj->sha1, name, 0);
+		return grep_sha1(opt, obj->sha1, name, 0, 0);
 	if (obj->type == OBJ_COMMIT || obj->type == OBJ_TREE) {
 		struct tree_desc tree;
 		void *data;
@@ -615,10 +696,8 @@ static int grep_object(struct grep_opt *opt, const struct pathspec *pathspec,
 		struct strbuf base;
 		int hit, len;
 
-		read_sha1_lock();
 		data = read_object_with_reference(obj->sha1, tree_type,
 						  &size, NULL);
-		read_sha1_unlock();
 
 		if (!data)
 			die(_("unable to read tree (%s)"), sha1_to_hex(obj->sha1));
@@ -673,7 +752,7 @@ static int grep_directory(struct grep_opt *opt, const struct pathspec *pathspec,
 		int namelen = strlen(name);
 		if (!match_pathspec_depth(pathspec, name, namelen, 0, NULL))
 			continue;
-		hit |= grep_file(opt, dir.entries[i]->name);
+		hit |= grep_file(opt, dir.entries[i]->name, 0);
 		if (hit && opt->status_only)
 			break;
 	}
@@ -818,6 +897,8 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 		{ OPTION_INTEGER, 0, "max-depth", &opt.max_depth, "depth",
 			"descend at most <depth> levels", PARSE_OPT_NONEG,
 			NULL, 1 },
+		OPT_INTEGER(0, "threads", &num_threads,
+			"use <n> worker threads (0 for one per CPU)"),
 		OPT_GROUP(""),
 		OPT_SET_INT('E', "extended-regexp", &pattern_type,
 			    "use extended POSIX regular expressions",
@@ -1023,8 +1104,12 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 		break;
 	}
 
+	if (num_threads < 0)
+		die(_("invalid number of threads specified (%d)"), num_threads);
 #ifndef NO_PTHREADS
-	if (list.nr || cached || online_cpus() == 1)
+	if (!num_threads)
+		num_threads = online_cpus();
+	if (num_threads == 1)
 		use_threads = 0;
 #else
 	use_threads = 0;
@@ -1080,6 +1165,9 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 	if (!use_index && (untracked || cached))
 		die(_("--cached or --untracked cannot be used with --no-index."));
 
+	if (use_index && !untracked && (cached || list.nr))
+		index_filter = grep_index_filter(&opt);
+
 	if (!use_index || untracked) {
 		int use_exclude = (opt_exclude < 0) ? use_index : !!opt_exclude;
 		if (list.nr)
@@ -1102,6 +1190,7 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 		hit |= wait_all();
 	if (hit && show_in_pager)
 		run_pager(&opt, prefix);
+	free_grep_index_filter(index_filter);
 	free_grep_patterns(&opt);
 	return !hit;
 }
@@ -0,0 +1,38 @@
+#include "builtin.h"
+#include "cache.h"
+#include "midx.h"
+#include "parse-options.h"
+
+static const char * const multi_pack_index_usage[] = {
+	"git multi-pack-index write",
+	"git multi-pack-index verify",
+	"git multi-pack-index expire",
+	NULL
+};
+
+int cmd_multi_pack_index(int argc, const char **argv, const char *prefix)
+{
+	int result;
+	struct option options[] = {
+		OPT_END()
+	};
+
+	git_config(git_default_config, NULL);
+	argc = parse_options(argc, argv, prefix, options,
+			     multi_pack_index_usage, 0);
+
+	if (argc != 1)
+		usage_with_options(multi_pack_index_usage, options);
+	else if (!strcmp(argv[0], "write"))
+		result = write_multi_pack_index(0);
+	else if (!strcmp(argv[0], "expire"))
+		result = write_multi_pack_index(1);
+	else if (!strcmp(argv[0], "verify"))
+		result = verify_multi_pack_index();
+	else {
+		result = error("Unknown subcommand: %s", argv[0]);
+		usage_with_options(multi_pack_index_usage, options);
+	}
+
+	return result ? 1 : 0;
+}
@@ -17,6 +17,7 @@
 #include "progress.h"
 #include "refs.h"
 #include "thread-utils.h"
+#include "pack-bitmap.h"
 
 static const char pack_usage[] =
   "git pack-objects [ -q | --progress | --all-progress ]\n"
@@ -27,6 +28,7 @@ static const char pack_usage[] =
   "        [--threads=<n>] [--non-empty] [--revs [--unpacked | --all]]\n"
   "        [--reflog] [--stdout | base-name] [--include-tag]\n"
   "        [--keep-unreachable | --unpack-unreachable]\n"
+  "        [--write-bitmap-index]\n"
   "        [< ref-list | < object-list]";
 
 struct object_entry {
@@ -44,6 +46,7 @@ struct object_entry {
 	unsigned long z_delta_size;	/* delta data size (compressed) */
 	unsigned int hash;	/* name hint hash */
 	enum object_type type;
+	enum object_type real_type;	/* type, even when reused as a delta */
 	enum object_type in_pack_type;	/* could be delta */
 	unsigned char in_pack_header_size;
 	unsigned char preferred_base; /* we do not pack this, but is available
@@ -71,6 +74,17 @@ static int keep_unreachable, unpack_unreachable, include_tag;
 static int local;
 static int incremental;
 static int ignore_packed_keep;
+static int use_bitmap_index = 1;
+static int write_bitmaps;
+
+/*
+ * The first reuse_packfile_objects objects of reuse_packfile, which
+ * end at reuse_packfile_offset, are copied to the output verbatim
+ * instead of being added to the objects array.
+ */
+static struct packed_git *reuse_packfile;
+static uint32_t reuse_packfile_objects;
+static off_t reuse_packfile_offset;
 static int allow_ofs_delta;
 static struct pack_idx_option pack_idx_opts;
 static const char *base_name;
@@ -633,6 +647,101 @@ static struct object_entry **compute_write_order(void)
 	return wo;
 }
 
+/*
+ * Write the reachability bitmaps for the pack we just wrote, whose
+ * index is "idx_name".  The bitmap code numbers the objects in pack
+ * order, so this is the order we give it the types and name hashes in.
+ */
+static void write_pack_bitmap(const char *idx_name)
+{
+	struct packed_git *p = add_packed_git(idx_name, strlen(idx_name), 1);
+	struct strbuf bitmap_name = STRBUF_INIT;
+	enum object_type *types;
+	uint32_t *hashes;
+	uint32_t j;
+
+	if (!p || open_pack_index(p))
+		die("unable to open the pack we just wrote: %s", idx_name);
+	install_packed_git(p);
+	discard_revindex();
+
+	types = xmalloc(p->num_objects * sizeof(*types));
+	hashes = xmalloc(p->num_objects * sizeof(*hashes));
+	for (j = 0; j < p->num_objects; j++) {
+		const unsigned char *sha1 =
+			nth_packed_object_sha1(p, nth_pack_revindex(p, j)->nr);
+		struct object_entry *e = locate_object_entry(sha1);
+
+		if (!e)
+			die("BUG: object %s missing from the packing list",
+			    sha1_to_hex(sha1));
+		types[j] = e->real_type;
+		if (types[j] <= OBJ_NONE)
+			types[j] = sha1_object_info(sha1, NULL);
+		hashes[j] = e->hash;
+	}
+
+	strbuf_add(&bitmap_name, idx_name, strlen(idx_name) - strlen(".idx"));
+	strbuf_addstr(&bitmap_name, ".bitmap");
+	if (write_bitmap_index(bitmap_name.buf, p, types, hashes,
+			       progress > pack_to_stdout))
+		warning("not writing a bitmap index for %s", p->pack_name);
+
+	strbuf_release(&bitmap_name);
+	free(types);
+	free(hashes);
+}
+
+/*
+ * Copy the reused objects from the beginning of reuse_packfile; they
+ * end up at the same offsets in our output, so their OFS_DELTA
+ * references stay valid.
+ */
+static off_t write_reused_pack(struct sha1file *f)
+{
+	struct pack_window *w_curs = NULL;
+	off_t cur = sizeof(struct pack_header);
+
+	if (!is_pack_valid(reuse_packfile))
+		die("packfile %s cannot be accessed", reuse_packfile->pack_name);
+
+	while (cur < reuse_packfile_offset) {
+		unsigned long avail;
+		unsigned char *buf = use_pack(reuse_packfile, &w_curs, cur, &avail);
+
+		if (avail > reuse_packfile_offset - cur)
+			avail = reuse_packfile_offset - cur;
+		sha1write(f, buf, avail);
+		cur += avail;
+	}
+	unuse_pack(&w_curs);
+
+	written += reuse_packfile_objects;
+	reused += reuse_packfile_objects;
+	display_progress(progress_state, written);
+	return cur;
+}
+
+/*
+ * We are sending every object of reuse_packfile and nothing else: the
+ * pack on disk, header and trailer included, is exactly what we would
+ * write, so let the kernel copy it.
+ */
+static void write_whole_reused_pack(void)
+{
+	struct stat st;
+	int fd = open(reuse_packfile->pack_name, O_RDONLY);
+
+	if (fd < 0 || fstat(fd, &st) || st.st_size != reuse_packfile->pack_size)
+		die_errno("unable to reopen %s", reuse_packfile->pack_name);
+	if (copy_fd(fd, 1))
+		die("unable to write %s", reuse_packfile->pack_name);
+
+	written = reused = reuse_packfile_objects;
+	display_progress(progress_state, written);
+	stop_progress(&progress_state);
+}
+
 static void write_pack_file(void)
 {
 	uint32_t i = 0, j;
@@ -643,7 +752,13 @@ static void write_pack_file(void)
 	struct object_entry **write_order;
 
 	if (progress > pack_to_stdout)
-		progress_state = start_progress("Writing objects", nr_result);
+		progress_state = start_progress("Writing objects",
+						nr_result + reuse_packfile_objects);
+	if (reuse_packfile_objects && !nr_result &&
+	    reuse_packfile_objects == reuse_packfile->num_objects) {
+		write_whole_reused_pack();
+		return;
+	}
 	written_list = xmalloc(nr_objects * sizeof(*written_list));
 	write_order = compute_write_order();
 
@@ -656,9 +771,13 @@ static void write_pack_file(void)
 		else
 			f = create_tmp_packfile(&pack_tmp_name);
 
-		offset = write_pack_header(f, nr_remaining);
+		offset = write_pack_header(f, nr_remaining + reuse_packfile_objects);
 		if (!offset)
 			die_errno("unable to write pack header");
+		if (reuse_packfile_objects) {
+			/* only ever done with --stdout, i.e. a single pack */
+			offset = write_reused_pack(f);
+		}
 		nr_written = 0;
 		for (; i < nr_objects; i++) {
 			struct object_entry *e = write_order[i];
@@ -715,6 +834,15 @@ static void write_pack_file(void)
 					    written_list, nr_written,
 					    &pack_idx_opts, sha1);
 			free(pack_tmp_name);
+
+			if (write_bitmaps && nr_written == nr_result) {
+				stop_progress(&progress_state);
+				write_pack_bitmap(tmpname);
+			} else if (write_bitmaps) {
+				warning("not writing a bitmap index, "
+					"as the objects do not fit in one pack");
+				write_bitmaps = 0;
+			}
 			puts(sha1_to_hex(sha1));
 		}
 
@@ -728,9 +856,9 @@ static void write_pack_file(void)
 	free(written_list);
 	free(write_order);
 	stop_progress(&progress_state);
-	if (written != nr_result)
+	if (written != nr_result + reuse_packfile_objects)
 		die("wrote %"PRIu32" objects while expecting %"PRIu32,
-			written, nr_result);
+			written, nr_result + reuse_packfile_objects);
 }
 
 static int locate_object_entry_hash(const unsigned char *sha1)
@@ -822,6 +950,44 @@ static int no_try_delta(const char *path)
 	return 0;
 }
 
+static struct object_entry *create_object_entry(const unsigned char *sha1,
+						enum object_type type,
+						uint32_t hash, int exclude,
+						struct packed_git *found_pack,
+						off_t found_offset, int ix)
+{
+	struct object_entry *entry;
+
+	if (nr_objects >= nr_alloc) {
+		nr_alloc = (nr_alloc  + 1024) * 3 / 2;
+		objects = xrealloc(objects, nr_alloc * sizeof(*entry));
+	}
+
+	entry = objects + nr_objects++;
+	memset(entry, 0, sizeof(*entry));
+	hashcpy(entry->idx.sha1, sha1);
+	entry->hash = hash;
+	if (type)
+		entry->type = entry->real_type = type;
+	if (exclude)
+		entry->preferred_base = 1;
+	else
+		nr_result++;
+	if (found_pack) {
+		entry->in_pack = found_pack;
+		entry->in_pack_offset = found_offset;
+	}
+
+	if (object_ix_hashsz * 3 <= nr_objects * 4)
+		rehash_objects();
+	else
+		object_ix[-1 - ix] = nr_objects;
+
+	display_progress(progress_state, nr_objects);
+
+	return entry;
+}
+
 static int add_object_entry(const unsigned char *sha1, enum object_type type,
 			    const char *name, int exclude)
 {
@@ -858,6 +1024,8 @@ static int add_object_entry(const unsigned char *sha1, enum object_type type,
 			}
 			if (exclude)
 				break;
+			if (p == reuse_packfile && offset < reuse_packfile_offset)
+				return 0;
 			if (incremental)
 				return 0;
 			if (local && !p->pack_local)
@@ -867,39 +1035,30 @@ static int add_object_entry(const unsigned char *sha1, enum object_type type,
 		}
 	}
 
-	if (nr_objects >= nr_alloc) {
-		nr_alloc = (nr_alloc  + 1024) * 3 / 2;
-		objects = xrealloc(objects, nr_alloc * sizeof(*entry));
-	}
-
-	entry = objects + nr_objects++;
-	memset(entry, 0, sizeof(*entry));
-	hashcpy(entry->idx.sha1, sha1);
-	entry->hash = hash;
-	if (type)
-		entry->type = type;
-	if (exclude)
-		entry->preferred_base = 1;
-	else
-		nr_result++;
-	if (found_pack) {
-		entry->in_pack = found_pack;
-		entry->in_pack_offset = found_offset;
-	}
-
-	if (object_ix_hashsz * 3 <= nr_objects * 4)
-		rehash_objects();
-	else
-		object_ix[-1 - ix] = nr_objects;
-
-	display_progress(progress_state, nr_objects);
-
+	entry = create_object_entry(sha1, type, hash, exclude,
+				    found_pack, found_offset, ix);
 	if (name && no_try_delta(name))
 		entry->no_try_delta = 1;
 
 	return 1;
 }
 
+/*
+ * Objects found through the bitmap index: we already know where
+ * they are, and that we want them.
+ */
+static void add_object_entry_from_bitmap(const unsigned char *sha1,
+					 enum object_type type,
+					 uint32_t name_hash,
+					 struct packed_git *pack, off_t offset)
+{
+	int ix = nr_objects ? locate_object_entry_hash(sha1) : -1;
+
+	if (ix >= 0)
+		return;
+	create_object_entry(sha1, type, name_hash, 0, pack, offset, ix);
+}
+
 struct pbase_tree_cache {
 	unsigned char sha1[20];
 	int ref;
@@ -1396,10 +1555,6 @@ static int delta_cacheable(unsigned long src_size, unsigned long trg_size,
 
 #ifndef NO_PTHREADS
 
-static pthread_mutex_t read_mutex;
-#define read_lock()		pthread_mutex_lock(&read_mutex)
-#define read_unlock()		pthread_mutex_unlock(&read_mutex)
-
 static pthread_mutex_t cache_mutex;
 #define cache_lock()		pthread_mutex_lock(&cache_mutex)
 #define cache_unlock()		pthread_mutex_unlock(&cache_mutex)
@@ -1410,8 +1565,6 @@ static pthread_mutex_t progress_mutex;
 
 #else
 
-#define read_lock()		(void)0
-#define read_unlock()		(void)0
 #define cache_lock()		(void)0
 #define cache_unlock()		(void)0
 #define progress_lock()		(void)0
@@ -1474,9 +1627,7 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 
 	/* Load data if not already done */
 	if (!trg->data) {
-		read_lock();
 		trg->data = read_sha1_file(trg_entry->idx.sha1, &type, &sz);
-		read_unlock();
 		if (!trg->data)
 			die("object %s cannot be read",
 			    sha1_to_hex(trg_entry->idx.sha1));
@@ -1486,9 +1637,7 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 		*mem_usage += sz;
 	}
 	if (!src->data) {
-		read_lock();
 		src->data = read_sha1_file(src_entry->idx.sha1, &type, &sz);
-		read_unlock();
 		if (!src->data) {
 			if (src_entry->preferred_base) {
 				static int warned = 0;
@@ -1727,15 +1876,6 @@ static void find_deltas(struct object_entry **list, unsigned *list_size,
 
 #ifndef NO_PTHREADS
 
-static void try_to_free_from_threads(size_t size)
-{
-	read_lock();
-	release_pack_memory(size, -1);
-	read_unlock();
-}
-
-static try_to_free_t old_try_to_free_routine;
-
 /*
  * The main thread waits on the condition that (at least) one of the workers
  * has stopped working (which is indicated in the .working member of
@@ -1766,18 +1906,16 @@ static pthread_cond_t progress_cond;
  */
 static void init_threaded_search(void)
 {
-	init_recursive_mutex(&read_mutex);
+	enable_obj_read_lock();
 	pthread_mutex_init(&cache_mutex, NULL);
 	pthread_mutex_init(&progress_mutex, NULL);
 	pthread_cond_init(&progress_cond, NULL);
-	old_try_to_free_routine = set_try_to_free_routine(try_to_free_from_threads);
 }
 
 static void cleanup_threaded_search(void)
 {
-	set_try_to_free_routine(old_try_to_free_routine);
 	pthread_cond_destroy(&progress_cond);
-	pthread_mutex_destroy(&read_mutex);
+	disable_obj_read_lock();
 	pthread_mutex_destroy(&cache_mutex);
 	pthread_mutex_destroy(&progress_mutex);
 }
@@ -1948,6 +2086,16 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 #define ll_find_deltas(l, s, w, d, p)	find_deltas(l, &s, w, d, p)
 #endif
 
+static int in_reused_pack(const unsigned char *sha1)
+{
+	off_t offset;
+
+	if (!reuse_packfile)
+		return 0;
+	offset = find_pack_entry_one(sha1, reuse_packfile);
+	return offset && offset < reuse_packfile_offset;
+}
+
 static int add_ref_tag(const char *path, const unsigned char *sha1, int flag, void *cb_data)
 {
 	unsigned char peeled[20];
@@ -1955,7 +2103,8 @@ static int add_ref_tag(const char *path, const unsigned char *sha1, int flag, vo
 	if (!prefixcmp(path, "refs/tags/") && /* is a tag? */
 	    !peel_ref(path, peeled)        && /* peelable? */
 	    !is_null_sha1(peeled)          && /* annotated tag? */
-	    locate_object_entry(peeled))      /* object packed? */
+	    (locate_object_entry(peeled) ||   /* object packed? */
+	     in_reused_pack(peeled)))
 		add_object_entry(sha1, OBJ_TAG, NULL, 0);
 	return 0;
 }
@@ -2074,6 +2223,10 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 #endif
 		return 0;
 	}
+	if (!strcmp(k, "pack.usebitmaps")) {
+		use_bitmap_index = git_config_bool(k, v);
+		return 0;
+	}
 	if (!strcmp(k, "pack.indexversion")) {
 		pack_idx_opts.version = git_config_int(k, v);
 		if (pack_idx_opts.version > 2)
@@ -2294,6 +2447,24 @@ static void get_object_list(int ac, const char **av)
 			die("bad revision '%s'", line);
 	}
 
+	if (use_bitmap_index && !revs.unpacked &&
+	    !local && !incremental && !ignore_packed_keep &&
+	    !keep_unreachable && !unpack_unreachable &&
+	    !prepare_bitmap_walk(&revs)) {
+		/*
+		 * The copied objects keep their offsets, so their
+		 * OFS_DELTAs are only fine if the receiver takes them.
+		 */
+		if (pack_to_stdout && allow_ofs_delta && reuse_delta)
+			reuse_packfile_objects =
+				reuse_partial_packfile_from_bitmap(&reuse_packfile,
+								   &reuse_packfile_offset);
+		if (!reuse_packfile_objects)
+			reuse_packfile = NULL;
+		traverse_bitmap_commit_list(add_object_entry_from_bitmap);
+		return;
+	}
+
 	if (prepare_revision_walk(&revs))
 		die("revision walk setup failed");
 	mark_edges_uninteresting(revs.commits, &revs, show_edge);
@@ -2477,6 +2648,10 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 				die("bad %s", arg);
 			continue;
 		}
+		if (!strcmp("--write-bitmap-index", arg)) {
+			write_bitmaps = 1;
+			continue;
+		}
 		if (!strcmp(arg, "--keep-true-parents")) {
 			grafts_replace_parents = 0;
 			continue;
@@ -2515,6 +2690,9 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (!pack_to_stdout && thin)
 		die("--thin cannot be used to build an indexable pack.");
 
+	if (pack_to_stdout || !use_internal_rev_list)
+		write_bitmaps = 0;
+
 	if (keep_unreachable && unpack_unreachable)
 		die("--keep-unreachable and --unpack-unreachable are incompatible.");
 
@@ -2532,11 +2710,11 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		get_object_list(rp_ac, rp_av);
 	}
 	cleanup_preferred_base();
-	if (include_tag && nr_result)
+	if (include_tag && (nr_result || reuse_packfile_objects))
 		for_each_ref(add_ref_tag, NULL);
 	stop_progress(&progress_state);
 
-	if (non_empty && !nr_result)
+	if (non_empty && !nr_result && !reuse_packfile_objects)
 		return 0;
 	if (nr_result)
 		prepare_pack(window, depth);
@@ -158,7 +158,9 @@ int cmd_read_tree(int argc, const char **argv, const char *unused_prefix)
 		if (read_cache_unmerged() && (opts.prefix || opts.merge))
 			die("You need to resolve your current index first");
 		stage = opts.merge = 1;
-	}
+	} else if (index_file_is_valid(get_index_file()))
+		/* the entries are replaced, but the untracked cache is kept */
+		read_cache();
 	resolve_undo_clear();
 
 	for (i = 0; i < argc; i++) {
@@ -28,6 +28,7 @@ struct tag_filter {
 	const char **patterns;
 	int lines;
 	struct commit_list *with_commit;
+	uint32_t cutoff;
 };
 
 static int match_pattern(const char **patterns, const char *ref)
@@ -50,7 +51,8 @@ static int in_commit_list(const struct commit_list *want, struct commit *c)
 }
 
 static int contains_recurse(struct commit *candidate,
-			    const struct commit_list *want)
+			    const struct commit_list *want,
+			    uint32_t cutoff)
 {
 	struct commit_list *p;
 
@@ -67,9 +69,15 @@ static int contains_recurse(struct commit *candidate,
 	if (parse_commit(candidate) < 0)
 		return 0;
 
+	/* or too far down in history to reach any of them? */
+	if (candidate->generation < cutoff) {
+		candidate->object.flags |= UNINTERESTING;
+		return 0;
+	}
+
 	/* Otherwise recurse and mark ourselves for future traversals. */
 	for (p = candidate->parents; p; p = p->next) {
-		if (contains_recurse(p->item, want)) {
+		if (contains_recurse(p->item, want, cutoff)) {
 			candidate->object.flags |= TMP_MARK;
 			return 1;
 		}
@@ -78,9 +86,28 @@ static int contains_recurse(struct commit *candidate,
 	return 0;
 }
 
-static int contains(struct commit *candidate, const struct commit_list *want)
+/*
+ * A commit cannot contain anything with a larger generation, so the
+ * walk can stop below the lowest generation we look for.
+ */
+static uint32_t contains_cutoff(const struct commit_list *want)
+{
+	uint32_t cutoff = GENERATION_NUMBER_MAX;
+
+	for (; want; want = want->next) {
+		if (parse_commit(want->item) < 0 ||
+		    want->item->generation > GENERATION_NUMBER_MAX)
+			return 0;
+		if (want->item->generation < cutoff)
+			cutoff = want->item->generation;
+	}
+	return cutoff;
+}
+
+static int contains(struct commit *candidate, const struct commit_list *want,
+		    uint32_t cutoff)
 {
-	return contains_recurse(candidate, want);
+	return contains_recurse(candidate, want, cutoff);
 }
 
 static int show_reference(const char *refname, const unsigned char *sha1,
@@ -101,7 +128,8 @@ static int show_reference(const char *refname, const unsigned char *sha1,
 			commit = lookup_commit_reference_gently(sha1, 1);
 			if (!commit)
 				return 0;
-			if (!contains(commit, filter->with_commit))
+			if (!contains(commit, filter->with_commit,
+				      filter->cutoff))
 				return 0;
 		}
 
@@ -150,6 +178,7 @@ static int list_tags(const char **patterns, int lines,
 	filter.patterns = patterns;
 	filter.lines = lines;
 	filter.with_commit = with_commit;
+	filter.cutoff = contains_cutoff(with_commit);
 
 	for_each_tag_ref(show_reference, (void *) &filter);
 
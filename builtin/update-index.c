@@ -11,6 +11,8 @@
 #include "refs.h"
 #include "resolve-undo.h"
 #include "parse-options.h"
+#include "split-index.h"
+#include "dir.h"
 
 /*
  * Default to not allowing changes to the list of files. The
@@ -707,6 +709,9 @@ int cmd_update_index(int argc, const char **argv, const char *prefix)
 {
 	int newfd, entries, has_errors = 0, line_termination = '\n';
 	int read_from_stdin = 0;
+	int preferred_index_format = 0;
+	int split_index = -1;
+	int untracked_cache = -1;
 	int prefix_length = prefix ? strlen(prefix) : 0;
 	char set_executable_bit = 0;
 	struct refresh_params refresh_args = {0, &has_errors};
@@ -787,6 +792,12 @@ int cmd_update_index(int argc, const char **argv, const char *prefix)
 			REFRESH_IGNORE_MISSING),
 		OPT_SET_INT(0, "verbose", &verbose,
 			"report actions to standard output", 1),
+		OPT_INTEGER(0, "index-version", &preferred_index_format,
+			"write index in this format"),
+		OPT_BOOL(0, "split-index", &split_index,
+			"enable or disable split index"),
+		OPT_BOOL(0, "untracked-cache", &untracked_cache,
+			"enable or disable the untracked cache"),
 		{OPTION_CALLBACK, 0, "clear-resolve-undo", NULL, NULL,
 			"(for porcelains) forget saved unresolved conflicts",
 			PARSE_OPT_NOARG | PARSE_OPT_NONEG,
@@ -852,6 +863,35 @@ int cmd_update_index(int argc, const char **argv, const char *prefix)
 	}
 	argc = parse_options_end(&ctx);
 
+	if (preferred_index_format) {
+		if (preferred_index_format < INDEX_FORMAT_LB ||
+		    INDEX_FORMAT_UB < preferred_index_format)
+			die("index-version %d not in range: %d..%d",
+			    preferred_index_format,
+			    INDEX_FORMAT_LB, INDEX_FORMAT_UB);
+
+		if (the_index.version != preferred_index_format)
+			active_cache_changed = 1;
+		the_index.version = preferred_index_format;
+	}
+
+	if (split_index > 0) {
+		init_split_index(&the_index);
+		active_cache_changed = 1;
+	} else if (!split_index && the_index.split_index) {
+		discard_split_index(&the_index);
+		active_cache_changed = 1;
+	}
+
+	if (untracked_cache > 0 && !the_index.untracked) {
+		the_index.untracked = new_untracked_cache();
+		active_cache_changed = 1;
+	} else if (!untracked_cache && the_index.untracked) {
+		free_untracked_cache(the_index.untracked);
+		the_index.untracked = NULL;
+		active_cache_changed = 1;
+	}
+
 	if (read_from_stdin) {
 		struct strbuf buf = STRBUF_INIT, nbuf = STRBUF_INIT;
 
@@ -105,6 +105,9 @@ struct cache_header {
 	unsigned int hdr_entries;
 };
 
+#define INDEX_FORMAT_LB 2
+#define INDEX_FORMAT_UB 4
+
 /*
  * The "cache_time" is just the low 32 bits of the
  * time. It doesn't matter if it overflows - we only
@@ -200,6 +203,7 @@ struct cache_entry {
 
 #define CE_UNPACKED          (1 << 24)
 #define CE_NEW_SKIP_WORKTREE (1 << 25)
+#define CE_FSMONITOR_VALID   (1 << 26) /* unchanged, says core.fsmonitor */
 
 /*
  * Extended on-disk flags
@@ -313,13 +317,21 @@ static inline unsigned int canon_mode(unsigned int mode)
 
 struct index_state {
 	struct cache_entry **cache;
+	unsigned int version;
 	unsigned int cache_nr, cache_alloc, cache_changed;
 	struct string_list *resolve_undo;
 	struct cache_tree *cache_tree;
+	struct split_index *split_index;
+	struct untracked_cache *untracked;
+	char *fsmonitor_last_update;
+	struct ewah_bitmap *fsmonitor_dirty;
+	unsigned int fsmonitor_dirty_nr; /* entries fsmonitor_dirty is for */
 	struct cache_time timestamp;
 	unsigned name_hash_initialized : 1,
-		 initialized : 1;
+		 initialized : 1,
+		 fsmonitor_has_run_once : 1;
 	struct hash_table name_hash;
+	unsigned char sha1[20];
 };
 
 extern struct index_state the_index;
@@ -484,6 +496,7 @@ extern int init_db(const char *template_dir, unsigned int flags);
 extern int read_index(struct index_state *);
 extern int read_index_preload(struct index_state *, const char **pathspec);
 extern int read_index_from(struct index_state *, const char *path);
+extern int index_file_is_valid(const char *path);
 extern int is_index_unborn(struct index_state *);
 extern int read_index_unmerged(struct index_state *);
 extern int write_index(struct index_state *, int newfd);
@@ -602,6 +615,10 @@ extern unsigned long pack_size_limit_cfg;
 extern int read_replace_refs;
 extern int fsync_object_files;
 extern int core_preload_index;
+extern int core_commit_graph;
+extern int core_multi_pack_index;
+extern int core_grep_index;
+extern const char *core_fsmonitor;
 extern int core_apply_sparse_checkout;
 
 enum branch_track {
@@ -760,6 +777,7 @@ static inline void *read_sha1_file(const unsigned char *sha1, enum object_type *
 	return read_sha1_file_extended(sha1, type, size, READ_SHA1_FILE_REPLACE);
 }
 extern const unsigned char *do_lookup_replace_object(const unsigned char *sha1);
+extern int has_replace_objects(void);
 static inline const unsigned char *lookup_replace_object(const unsigned char *sha1)
 {
 	if (!read_replace_refs)
@@ -767,6 +785,19 @@ static inline const unsigned char *lookup_replace_object(const unsigned char *sh
 	return do_lookup_replace_object(sha1);
 }
 
+/*
+ * Between enable_obj_read_lock() and disable_obj_read_lock(),
+ * read_sha1_file() and sha1_object_info() can be called from several
+ * threads at once.  They take a (recursive) lock of their own, which
+ * they drop while inflating objects and applying deltas, so that the
+ * expensive parts run in parallel.  obj_read_lock() is for callers
+ * that look at the pack windows or the delta base cache themselves.
+ */
+extern void enable_obj_read_lock(void);
+extern void disable_obj_read_lock(void);
+extern void obj_read_lock(void);
+extern void obj_read_unlock(void);
+
 /* Read and unpack a sha1 file into memory, write memory to a sha1 file */
 extern int sha1_object_info(const unsigned char *, unsigned long *);
 extern int hash_sha1_file(const void *buf, unsigned long len, const char *type, unsigned char *sha1);
@@ -986,6 +1017,7 @@ extern struct packed_git {
 	int pack_fd;
 	unsigned pack_local:1,
 		 pack_keep:1,
+		 multi_pack_index:1,
 		 do_not_close:1;
 	unsigned char sha1[20];
 	/* something like ".git/objects/pack/xxxxx.pack" */
@@ -0,0 +1,620 @@
+#include "cache.h"
+#include "changed-paths.h"
+#include "commit.h"
+#include "csum-file.h"
+#include "diff.h"
+#include "dir.h"
+#include "revision.h"
+#include "sha1-array.h"
+#include "string-list.h"
+
+/*
+ * See Documentation/technical/changed-paths-format.txt for the layout
+ * of the file.  All integers are stored in network byte order.
+ */
+#define CPTH_HEADER_SIZE	16
+#define CPTH_FANOUT_SIZE	(4 * 256)
+
+/*
+ * Ten bits and seven hash functions per path give a false positive
+ * rate of about 1%.  Commits that touch more paths than fit in a
+ * filter of reasonable size get a filter that matches everything.
+ */
+#define CPTH_NUM_HASHES		7
+#define CPTH_BITS_PER_PATH	10
+#define CPTH_MAX_PATHS		512
+
+struct changed_paths {
+	const unsigned char *data;
+	size_t data_len;
+	uint32_t num_commits;
+	uint32_t num_hashes;
+	const uint32_t *fanout;
+	const unsigned char *sha1s;
+	const unsigned char *offsets;
+	const unsigned char *filters;
+	size_t filters_len;
+};
+
+struct changed_paths_query {
+	const struct changed_paths *file;
+	int nr;
+	uint32_t (*hashes)[2];
+};
+
+static struct changed_paths *changed_paths;
+static int changed_paths_prepared;
+
+static const char *changed_paths_path(void)
+{
+	static char *path;
+
+	if (!path)
+		path = xstrdup(mkpath("%s/info/changed-paths",
+				      get_object_directory()));
+	return path;
+}
+
+static inline uint32_t cpth_u32(const unsigned char *p)
+{
+	return ntohl(*(const uint32_t *)p);
+}
+
+static inline uint32_t rotl32(uint32_t v, int n)
+{
+	return (v << n) | (v >> (32 - n));
+}
+
+/* MurmurHash3 (x86, 32-bit), reading the input as little endian */
+static uint32_t murmur3_32(const char *data, size_t len, uint32_t seed)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	const uint32_t c1 = 0xcc9e2d51, c2 = 0x1b873593;
+	uint32_t h = seed, k;
+	size_t i;
+
+	for (i = 0; i + 4 <= len; i += 4) {
+		k = p[i] | (p[i + 1] << 8) | (p[i + 2] << 16) |
+			((uint32_t)p[i + 3] << 24);
+		k *= c1;
+		k = rotl32(k, 15);
+		k *= c2;
+		h ^= k;
+		h = rotl32(h, 13);
+		h = h * 5 + 0xe6546b64;
+	}
+
+	k = 0;
+	switch (len & 3) {
+	case 3:
+		k ^= p[i + 2] << 16;
+		/* fallthrough */
+	case 2:
+		k ^= p[i + 1] << 8;
+		/* fallthrough */
+	case 1:
+		k ^= p[i];
+		k *= c1;
+		k = rotl32(k, 15);
+		k *= c2;
+		h ^= k;
+	}
+
+	h ^= (uint32_t)len;
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+/*
+ * The bits of a path are found by double hashing: the i-th one is
+ * h[0] + i * h[1], modulo the size of the filter in bits.
+ */
+static void path_hashes(const char *path, size_t len, uint32_t *h)
+{
+	h[0] = murmur3_32(path, len, 0x293ae76f);
+	h[1] = murmur3_32(path, len, 0x7e646e2c);
+}
+
+static int filter_contains(const unsigned char *filter, size_t len,
+			   uint32_t num_hashes, const uint32_t *h)
+{
+	uint64_t bits = (uint64_t)len * 8;
+	uint32_t i;
+
+	for (i = 0; i < num_hashes; i++) {
+		uint64_t pos = (uint32_t)(h[0] + i * h[1]) % bits;
+		if (!(filter[pos >> 3] & (1 << (pos & 7))))
+			return 0;
+	}
+	return 1;
+}
+
+static void filter_add(unsigned char *filter, size_t len,
+		       uint32_t num_hashes, const uint32_t *h)
+{
+	uint64_t bits = (uint64_t)len * 8;
+	uint32_t i;
+
+	for (i = 0; i < num_hashes; i++) {
+		uint64_t pos = (uint32_t)(h[0] + i * h[1]) % bits;
+		filter[pos >> 3] |= 1 << (pos & 7);
+	}
+}
+
+static struct changed_paths *load_changed_paths(const char *path)
+{
+	struct changed_paths *cp;
+	const uint32_t *hdr;
+	void *map;
+	size_t size;
+	uint64_t tables;
+	uint32_t version, nr, num_hashes, i, prev;
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	size = xsize_t(st.st_size);
+	if (size < CPTH_HEADER_SIZE + CPTH_FANOUT_SIZE + 20) {
+		close(fd);
+		error("changed-paths file %s is too small", path);
+		return NULL;
+	}
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	hdr = map;
+	if (ntohl(hdr[0]) != CHANGED_PATHS_SIGNATURE) {
+		error("changed-paths file %s has a bad signature", path);
+		goto bad;
+	}
+	version = ntohl(hdr[1]);
+	if (version != CHANGED_PATHS_VERSION) {
+		error("changed-paths file %s is version %"PRIu32
+		      " and is not supported by this binary", path, version);
+		goto bad;
+	}
+	nr = ntohl(hdr[2]);
+	num_hashes = ntohl(hdr[3]);
+	if (!num_hashes || 32 < num_hashes) {
+		error("changed-paths file %s has a bad number of hashes", path);
+		goto bad;
+	}
+	tables = CPTH_HEADER_SIZE + CPTH_FANOUT_SIZE + (uint64_t)nr * 24;
+	if ((uint64_t)size < tables + 20 ||
+	    (nr && (uint64_t)size != tables + 20 +
+			cpth_u32((unsigned char *)map + tables - 4))) {
+		error("wrong changed-paths file size in %s", path);
+		goto bad;
+	}
+	for (i = prev = 0; i < 256; i++) {
+		uint32_t n = ntohl(hdr[4 + i]);
+		if (n < prev) {
+			error("non-monotonic changed-paths %s", path);
+			goto bad;
+		}
+		prev = n;
+	}
+	if (prev != nr) {
+		error("changed-paths fan-out does not match in %s", path);
+		goto bad;
+	}
+
+	cp = xcalloc(1, sizeof(*cp));
+	cp->data = map;
+	cp->data_len = size;
+	cp->num_commits = nr;
+	cp->num_hashes = num_hashes;
+	cp->fanout = hdr + 4;
+	cp->sha1s = cp->data + CPTH_HEADER_SIZE + CPTH_FANOUT_SIZE;
+	cp->offsets = cp->sha1s + (size_t)nr * 20;
+	cp->filters = cp->data + tables;
+	cp->filters_len = size - tables - 20;
+	return cp;
+
+bad:
+	munmap(map, size);
+	return NULL;
+}
+
+static int checksum_ok(const struct changed_paths *cp)
+{
+	unsigned char sha1[20];
+	git_SHA_CTX ctx;
+
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, cp->data, cp->data_len - 20);
+	git_SHA1_Final(sha1, &ctx);
+	return !hashcmp(sha1, cp->data + cp->data_len - 20);
+}
+
+static void close_changed_paths(struct changed_paths *cp)
+{
+	if (!cp)
+		return;
+	munmap((void *)cp->data, cp->data_len);
+	free(cp);
+}
+
+static void prepare_changed_paths(void)
+{
+	if (changed_paths_prepared)
+		return;
+	changed_paths_prepared = 1;
+	if (!core_commit_graph)
+		return;
+	changed_paths = load_changed_paths(changed_paths_path());
+}
+
+static int find_commit(const struct changed_paths *cp,
+		       const unsigned char *sha1, uint32_t *pos)
+{
+	uint32_t lo, hi;
+
+	hi = ntohl(cp->fanout[*sha1]);
+	lo = *sha1 ? ntohl(cp->fanout[*sha1 - 1]) : 0;
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(sha1, cp->sha1s + 20 * mi);
+		if (!cmp) {
+			*pos = mi;
+			return 1;
+		}
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return 0;
+}
+
+/* Find the filter of the commit at "pos"; returns -1 if it is corrupt */
+static int commit_filter(const struct changed_paths *cp, uint32_t pos,
+			 const unsigned char **filter, size_t *len)
+{
+	uint32_t start = pos ? cpth_u32(cp->offsets + 4 * (pos - 1)) : 0;
+	uint32_t end = cpth_u32(cp->offsets + 4 * pos);
+
+	if (end < start || cp->filters_len < end)
+		return -1;
+	*filter = cp->filters + start;
+	*len = end - start;
+	return 0;
+}
+
+struct changed_paths_query *changed_paths_query(const struct pathspec *pathspec)
+{
+	struct changed_paths_query *query;
+	int i;
+
+	prepare_changed_paths();
+	if (!changed_paths || !pathspec->nr)
+		return NULL;
+	/* the filters describe the real parents, not the replaced ones */
+	if (has_commit_grafts() || has_replace_objects())
+		return NULL;
+
+	query = xmalloc(sizeof(*query));
+	query->file = changed_paths;
+	query->nr = pathspec->nr;
+	query->hashes = xmalloc(pathspec->nr * sizeof(*query->hashes));
+	for (i = 0; i < pathspec->nr; i++) {
+		const struct pathspec_item *item = &pathspec->items[i];
+		int len = item->len;
+
+		while (len && item->match[len - 1] == '/')
+			len--;
+		if (item->use_wildcard || !len) {
+			free_changed_paths_query(query);
+			return NULL;
+		}
+		path_hashes(item->match, len, query->hashes[i]);
+	}
+	return query;
+}
+
+int changed_paths_may_touch(const struct changed_paths_query *query,
+			    const struct commit *commit)
+{
+	const struct changed_paths *cp = query->file;
+	const unsigned char *filter;
+	size_t len;
+	uint32_t pos;
+	int i;
+
+	if (!find_commit(cp, commit->object.sha1, &pos) ||
+	    commit_filter(cp, pos, &filter, &len))
+		return 1;
+	/* an empty filter means that nothing changed at all */
+	for (i = 0; len && i < query->nr; i++)
+		if (filter_contains(filter, len, cp->num_hashes,
+				    query->hashes[i]))
+			return 1;
+	return 0;
+}
+
+void free_changed_paths_query(struct changed_paths_query *query)
+{
+	if (!query)
+		return;
+	free(query->hashes);
+	free(query);
+}
+
+static void changed_path(struct diff_options *options, const char *fullpath)
+{
+	struct string_list *paths = options->format_callback_data;
+
+	string_list_append(paths, fullpath);
+	/* no need to look further once the filter is going to be full */
+	if (CPTH_MAX_PATHS < paths->nr) {
+		DIFF_OPT_SET(options, QUICK);
+		DIFF_OPT_SET(options, HAS_CHANGES);
+	}
+}
+
+static void changed_path_add_remove(struct diff_options *options,
+				    int addremove, unsigned mode,
+				    const unsigned char *sha1,
+				    const char *fullpath,
+				    unsigned dirty_submodule)
+{
+	changed_path(options, fullpath);
+}
+
+static void changed_path_change(struct diff_options *options,
+				unsigned old_mode, unsigned new_mode,
+				const unsigned char *old_sha1,
+				const unsigned char *new_sha1,
+				const char *fullpath,
+				unsigned old_dirty_submodule,
+				unsigned new_dirty_submodule)
+{
+	changed_path(options, fullpath);
+}
+
+/*
+ * Append the filter of the paths that "commit" changed compared to its
+ * first parent to "out".  A pathspec matches a path or any leading
+ * directory of it, so the directories go into the filter, too.
+ */
+static int add_commit_filter(struct commit *commit, struct strbuf *out)
+{
+	struct diff_options opt;
+	struct string_list paths = STRING_LIST_INIT_DUP;
+	unsigned char *filter;
+	size_t len;
+	int i, nr, ret;
+
+	if (parse_commit(commit))
+		return error("Could not parse commit %s",
+			     sha1_to_hex(commit->object.sha1));
+
+	memset(&opt, 0, sizeof(opt));
+	DIFF_OPT_SET(&opt, RECURSIVE);
+	opt.add_remove = changed_path_add_remove;
+	opt.change = changed_path_change;
+	opt.format_callback_data = &paths;
+	if (commit->parents) {
+		struct commit *parent = commit->parents->item;
+		if (parse_commit(parent))
+			return error("Could not parse commit %s",
+				     sha1_to_hex(parent->object.sha1));
+		ret = diff_tree_sha1(parent->tree->object.sha1,
+				     commit->tree->object.sha1, "", &opt);
+	} else
+		ret = diff_root_tree_sha1(commit->tree->object.sha1, "", &opt);
+	if (ret < 0) {
+		string_list_clear(&paths, 0);
+		return error("Could not diff commit %s",
+			     sha1_to_hex(commit->object.sha1));
+	}
+
+	if (CPTH_MAX_PATHS < paths.nr) {
+		strbuf_addch(out, 0xff);
+		string_list_clear(&paths, 0);
+		return 0;
+	}
+
+	nr = paths.nr;
+	for (i = 0; i < nr; i++) {
+		const char *path = paths.items[i].string;
+		const char *slash;
+
+		for (slash = strchr(path, '/'); slash;
+		     slash = strchr(slash + 1, '/')) {
+			char *dir = xmemdupz(path, slash - path);
+			string_list_append(&paths, dir);
+			free(dir);
+		}
+	}
+	sort_string_list(&paths);
+	for (i = nr = 0; i < paths.nr; i++)
+		if (!i || strcmp(paths.items[i - 1].string,
+				 paths.items[i].string))
+			nr++;
+
+	len = ((size_t)nr * CPTH_BITS_PER_PATH + 7) / 8;
+	filter = xcalloc(1, len ? len : 1);
+	for (i = 0; i < paths.nr; i++) {
+		uint32_t h[2];
+
+		if (i && !strcmp(paths.items[i - 1].string,
+				 paths.items[i].string))
+			continue;
+		path_hashes(paths.items[i].string,
+			    strlen(paths.items[i].string), h);
+		filter_add(filter, len, CPTH_NUM_HASHES, h);
+	}
+	strbuf_add(out, filter, len);
+	free(filter);
+	string_list_clear(&paths, 0);
+	return 0;
+}
+
+static int commit_sha1_cmp(const void *a_, const void *b_)
+{
+	struct commit *const *a = a_, *const *b = b_;
+	return hashcmp((*a)->object.sha1, (*b)->object.sha1);
+}
+
+static void write_u32(struct sha1file *f, uint32_t v)
+{
+	v = htonl(v);
+	sha1write(f, &v, 4);
+}
+
+int write_changed_paths(struct sha1_array *tips)
+{
+	static struct lock_file lock;
+	struct rev_info revs;
+	struct commit **list = NULL;
+	struct commit *commit;
+	struct changed_paths *old;
+	struct strbuf filters = STRBUF_INIT;
+	uint32_t *ends, fanout[256];
+	int nr = 0, alloc = 0, i, fd, ret = 0;
+	struct sha1file *f;
+
+	if (has_commit_grafts())
+		return error("cannot write changed paths while grafts exist");
+
+	init_revisions(&revs, NULL);
+	for (i = 0; i < tips->nr; i++) {
+		commit = lookup_commit(tips->sha1[i]);
+		if (!commit)
+			return error("%s is not a commit",
+				     sha1_to_hex(tips->sha1[i]));
+		add_pending_object(&revs, &commit->object, "");
+	}
+	if (prepare_revision_walk(&revs))
+		return error("revision walk setup failed");
+	while ((commit = get_revision(&revs)) != NULL) {
+		ALLOC_GROW(list, nr + 1, alloc);
+		list[nr++] = commit;
+	}
+	qsort(list, nr, sizeof(*list), commit_sha1_cmp);
+
+	/* filters do not change, so reuse those of the existing file */
+	old = load_changed_paths(changed_paths_path());
+	if (old && (old->num_hashes != CPTH_NUM_HASHES || !checksum_ok(old))) {
+		close_changed_paths(old);
+		old = NULL;
+	}
+	ends = xmalloc(nr * sizeof(*ends));
+	for (i = 0; i < nr; i++) {
+		const unsigned char *filter;
+		size_t len;
+		uint32_t pos;
+
+		if (old && find_commit(old, list[i]->object.sha1, &pos) &&
+		    !commit_filter(old, pos, &filter, &len))
+			strbuf_add(&filters, filter, len);
+		else if (add_commit_filter(list[i], &filters)) {
+			ret = -1;
+			goto done;
+		}
+		if (0xffffffff < filters.len)
+			die("changed-paths file would be too large");
+		ends[i] = filters.len;
+	}
+
+	memset(fanout, 0, sizeof(fanout));
+	for (i = 0; i < nr; i++)
+		fanout[list[i]->object.sha1[0]]++;
+	for (i = 1; i < 256; i++)
+		fanout[i] += fanout[i - 1];
+
+	if (safe_create_leading_directories_const(changed_paths_path())) {
+		ret = error("unable to create leading directories of %s",
+			    changed_paths_path());
+		goto done;
+	}
+	fd = hold_lock_file_for_update(&lock, changed_paths_path(),
+				       LOCK_DIE_ON_ERROR);
+	f = sha1fd(fd, lock.filename);
+
+	write_u32(f, CHANGED_PATHS_SIGNATURE);
+	write_u32(f, CHANGED_PATHS_VERSION);
+	write_u32(f, nr);
+	write_u32(f, CPTH_NUM_HASHES);
+	for (i = 0; i < 256; i++)
+		write_u32(f, fanout[i]);
+	for (i = 0; i < nr; i++)
+		sha1write(f, list[i]->object.sha1, 20);
+	for (i = 0; i < nr; i++)
+		write_u32(f, ends[i]);
+	sha1write(f, filters.buf, filters.len);
+
+	sha1close(f, NULL, CSUM_FSYNC);
+	lock.fd = -1; /* closed by sha1close() */
+	if (commit_lock_file(&lock) < 0)
+		die_errno("unable to write changed-paths file %s",
+			  changed_paths_path());
+
+done:
+	close_changed_paths(old);
+	strbuf_release(&filters);
+	free(ends);
+	free(list);
+	return ret;
+}
+
+int verify_changed_paths(void)
+{
+	const struct changed_paths *cp;
+	struct strbuf expect = STRBUF_INIT;
+	uint32_t i;
+	int errors = 0;
+
+	prepare_changed_paths();
+	cp = changed_paths;
+	if (!cp)
+		return file_exists(changed_paths_path());
+
+	if (!checksum_ok(cp)) {
+		error("changed-paths checksum mismatch");
+		errors++;
+	}
+
+	for (i = 0; i < cp->num_commits; i++) {
+		const unsigned char *cur = cp->sha1s + 20 * i;
+		const unsigned char *filter;
+		struct commit *commit;
+		size_t len;
+
+		if (i && hashcmp(cur - 20, cur) >= 0) {
+			error("changed-paths is not sorted at %s",
+			      sha1_to_hex(cur));
+			errors++;
+		}
+		if (commit_filter(cp, i, &filter, &len)) {
+			error("changed-paths has a bad offset for %s",
+			      sha1_to_hex(cur));
+			errors++;
+			continue;
+		}
+		commit = lookup_commit(cur);
+		strbuf_reset(&expect);
+		if (!commit || add_commit_filter(commit, &expect)) {
+			errors++;
+			continue;
+		}
+		if (cp->num_hashes != CPTH_NUM_HASHES ||
+		    len != expect.len || memcmp(filter, expect.buf, len)) {
+			error("changed-paths has a wrong filter for %s",
+			      sha1_to_hex(cur));
+			errors++;
+		}
+	}
+	strbuf_release(&expect);
+	return errors;
+}
@@ -0,0 +1,44 @@
+#ifndef CHANGED_PATHS_H
+#define CHANGED_PATHS_H
+
+#define CHANGED_PATHS_SIGNATURE 0x43505448 /* "CPTH" */
+#define CHANGED_PATHS_VERSION 1
+
+struct commit;
+struct pathspec;
+struct sha1_array;
+struct changed_paths_query;
+
+/*
+ * Prepare to ask the changed-paths file whether commits touch the
+ * paths in "pathspec".  Returns NULL if there is no usable file, or
+ * if the pathspec cannot be answered from it, e.g. because it has
+ * wildcards or matches the whole tree.
+ */
+extern struct changed_paths_query *changed_paths_query(const struct pathspec *pathspec);
+
+/*
+ * Can "commit" have changed a path that the query was prepared for,
+ * compared to its first parent (or to the empty tree for a root
+ * commit)?  Returns 0 only if it certainly did not, and 1 if it may
+ * have or the file does not know about the commit.
+ */
+extern int changed_paths_may_touch(const struct changed_paths_query *query,
+				   const struct commit *commit);
+
+extern void free_changed_paths_query(struct changed_paths_query *query);
+
+/*
+ * Write a changed-paths file covering the given commits and all of
+ * their ancestors to $GIT_OBJECT_DIRECTORY/info/changed-paths.
+ * Commits that the existing file covers are not diffed again.
+ */
+extern int write_changed_paths(struct sha1_array *tips);
+
+/*
+ * Check the checksum of the changed-paths file and recompute the
+ * filter of every commit in it.  Returns the number of problems found.
+ */
+extern int verify_changed_paths(void);
+
+#endif /* CHANGED_PATHS_H */
@@ -0,0 +1,637 @@
+#include "cache.h"
+#include "commit.h"
+#include "commit-graph.h"
+#include "csum-file.h"
+#include "dir.h"
+#include "sha1-array.h"
+#include "sha1-lookup.h"
+
+/*
+ * See Documentation/technical/commit-graph-format.txt for the layout
+ * of the file.  All integers are stored in network byte order.
+ */
+#define GRAPH_HEADER_SIZE	16
+#define GRAPH_FANOUT_SIZE	(4 * 256)
+#define GRAPH_DATA_WIDTH	36
+
+#define GRAPH_PARENT_NONE	0x70000000
+#define GRAPH_EXTRA_EDGES	0x80000000
+#define GRAPH_LAST_EDGE		0x80000000
+#define GRAPH_EDGE_MASK		0x7fffffff
+
+/*
+ * The 64-bit date field holds the generation number in its upper 30
+ * bits and the date in the low 34 bits.
+ */
+#define GRAPH_DATE_HIGH_MASK	0x3
+#define GRAPH_GENERATION_SHIFT	2
+
+#define GRAPH_SEEN		(1u<<22)
+
+struct commit_graph {
+	const unsigned char *data;
+	size_t data_len;
+	uint32_t num_commits;
+	uint32_t num_extra_edges;
+	const uint32_t *fanout;
+	const unsigned char *sha1s;
+	const unsigned char *commit_data;
+	const uint32_t *extra_edges;
+};
+
+static struct commit_graph *commit_graph;
+static int commit_graph_prepared;
+
+static const char *commit_graph_path(void)
+{
+	static char *path;
+
+	if (!path)
+		path = xstrdup(mkpath("%s/info/commit-graph",
+				      get_object_directory()));
+	return path;
+}
+
+static inline uint32_t graph_u32(const unsigned char *p)
+{
+	return ntohl(*(const uint32_t *)p);
+}
+
+static struct commit_graph *load_commit_graph(const char *path)
+{
+	struct commit_graph *g;
+	const uint32_t *hdr;
+	void *map;
+	size_t size;
+	uint32_t version, nr, nr_edges, i, prev;
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	size = xsize_t(st.st_size);
+	if (size < GRAPH_HEADER_SIZE + GRAPH_FANOUT_SIZE + 20) {
+		close(fd);
+		error("commit-graph file %s is too small", path);
+		return NULL;
+	}
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	hdr = map;
+	if (ntohl(hdr[0]) != COMMIT_GRAPH_SIGNATURE) {
+		error("commit-graph file %s has a bad signature", path);
+		goto bad;
+	}
+	version = ntohl(hdr[1]);
+	if (version != COMMIT_GRAPH_VERSION) {
+		error("commit-graph file %s is version %"PRIu32
+		      " and is not supported by this binary", path, version);
+		goto bad;
+	}
+	nr = ntohl(hdr[2]);
+	nr_edges = ntohl(hdr[3]);
+	if ((uint64_t)size != GRAPH_HEADER_SIZE + GRAPH_FANOUT_SIZE +
+			      (uint64_t)nr * (20 + GRAPH_DATA_WIDTH) +
+			      (uint64_t)nr_edges * 4 + 20) {
+		error("wrong commit-graph file size in %s", path);
+		goto bad;
+	}
+	for (i = prev = 0; i < 256; i++) {
+		uint32_t n = ntohl(hdr[4 + i]);
+		if (n < prev) {
+			error("non-monotonic commit-graph %s", path);
+			goto bad;
+		}
+		prev = n;
+	}
+	if (prev != nr) {
+		error("commit-graph fan-out does not match in %s", path);
+		goto bad;
+	}
+
+	g = xcalloc(1, sizeof(*g));
+	g->data = map;
+	g->data_len = size;
+	g->num_commits = nr;
+	g->num_extra_edges = nr_edges;
+	g->fanout = hdr + 4;
+	g->sha1s = g->data + GRAPH_HEADER_SIZE + GRAPH_FANOUT_SIZE;
+	g->commit_data = g->sha1s + (size_t)nr * 20;
+	g->extra_edges = (const uint32_t *)(g->commit_data +
+					    (size_t)nr * GRAPH_DATA_WIDTH);
+	return g;
+
+bad:
+	munmap(map, size);
+	return NULL;
+}
+
+static void prepare_commit_graph(void)
+{
+	if (commit_graph_prepared)
+		return;
+	commit_graph_prepared = 1;
+	if (!core_commit_graph)
+		return;
+	commit_graph = load_commit_graph(commit_graph_path());
+}
+
+static int find_commit_in_graph(const struct commit_graph *g,
+				const unsigned char *sha1, uint32_t *pos)
+{
+	uint32_t lo, hi;
+
+	hi = ntohl(g->fanout[*sha1]);
+	lo = *sha1 ? ntohl(g->fanout[*sha1 - 1]) : 0;
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(sha1, g->sha1s + 20 * mi);
+		if (!cmp) {
+			*pos = mi;
+			return 1;
+		}
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return 0;
+}
+
+/*
+ * Store the graph positions of the parents of the commit at "pos" in
+ * "*parents" (grown as needed) and return how many there are.
+ */
+static int graph_parent_positions(const struct commit_graph *g, uint32_t pos,
+				  uint32_t **parents, int *alloc)
+{
+	const unsigned char *data = g->commit_data + GRAPH_DATA_WIDTH * pos;
+	uint32_t edge;
+	int nr = 0;
+
+	edge = graph_u32(data + 20);
+	if (edge == GRAPH_PARENT_NONE)
+		return 0;
+	ALLOC_GROW(*parents, nr + 1, *alloc);
+	(*parents)[nr++] = edge;
+
+	edge = graph_u32(data + 24);
+	if (edge == GRAPH_PARENT_NONE)
+		return nr;
+	if (!(edge & GRAPH_EXTRA_EDGES)) {
+		ALLOC_GROW(*parents, nr + 1, *alloc);
+		(*parents)[nr++] = edge;
+		return nr;
+	}
+
+	edge &= GRAPH_EDGE_MASK;
+	for (;;) {
+		uint32_t parent;
+		if (edge >= g->num_extra_edges)
+			die("commit-graph has an invalid extra edge for %s",
+			    sha1_to_hex(g->sha1s + 20 * pos));
+		parent = ntohl(g->extra_edges[edge++]);
+		ALLOC_GROW(*parents, nr + 1, *alloc);
+		(*parents)[nr++] = parent & GRAPH_EDGE_MASK;
+		if (parent & GRAPH_LAST_EDGE)
+			return nr;
+	}
+}
+
+static unsigned long graph_commit_date(const struct commit_graph *g,
+				       uint32_t pos)
+{
+	const unsigned char *data = g->commit_data + GRAPH_DATA_WIDTH * pos;
+	uint64_t hi = graph_u32(data + 28) & GRAPH_DATE_HIGH_MASK;
+
+	return (unsigned long)((hi << 32) | graph_u32(data + 32));
+}
+
+/*
+ * Generation numbers describe the real history; grafts and replaced
+ * objects change its shape, so none of them can be used then.
+ */
+static int graph_generations_usable(void)
+{
+	return !has_commit_grafts() && !has_replace_objects();
+}
+
+static uint32_t stored_generation(const struct commit_graph *g, uint32_t pos)
+{
+	const unsigned char *data = g->commit_data + GRAPH_DATA_WIDTH * pos;
+	return graph_u32(data + 28) >> GRAPH_GENERATION_SHIFT;
+}
+
+static uint32_t graph_generation(const struct commit_graph *g, uint32_t pos)
+{
+	uint32_t generation = stored_generation(g, pos);
+
+	/* files written before generation numbers were computed have 0 */
+	if (!generation || !graph_generations_usable())
+		return GENERATION_NUMBER_INFINITY;
+	return generation;
+}
+
+static void fill_commit_in_graph(const struct commit_graph *g,
+				 struct commit *item, uint32_t pos)
+{
+	static uint32_t *parents;
+	static int parents_alloc;
+	struct commit_list **pptr = &item->parents;
+	int i, nr;
+
+	item->object.parsed = 1;
+	item->tree = lookup_tree(g->commit_data + GRAPH_DATA_WIDTH * pos);
+	item->date = graph_commit_date(g, pos);
+	item->generation = graph_generation(g, pos);
+
+	nr = graph_parent_positions(g, pos, &parents, &parents_alloc);
+	for (i = 0; i < nr; i++) {
+		struct commit *new_parent;
+
+		if (parents[i] >= g->num_commits)
+			die("commit-graph has an invalid parent for %s",
+			    sha1_to_hex(item->object.sha1));
+		new_parent = lookup_commit(g->sha1s + 20 * parents[i]);
+		if (new_parent)
+			pptr = &commit_list_insert(new_parent, pptr)->next;
+	}
+}
+
+int parse_commit_in_graph(struct commit *item)
+{
+	uint32_t pos;
+
+	prepare_commit_graph();
+	if (!commit_graph)
+		return -1;
+	/* grafted and replaced commits must go through the object */
+	if (lookup_commit_graft(item->object.sha1) ||
+	    lookup_replace_object(item->object.sha1) != item->object.sha1)
+		return -1;
+	if (!find_commit_in_graph(commit_graph, item->object.sha1, &pos))
+		return -1;
+	fill_commit_in_graph(commit_graph, item, pos);
+	return 0;
+}
+
+uint32_t commit_graph_generation(const struct commit *item)
+{
+	uint32_t pos;
+
+	prepare_commit_graph();
+	if (!commit_graph ||
+	    !find_commit_in_graph(commit_graph, item->object.sha1, &pos))
+		return GENERATION_NUMBER_INFINITY;
+	return graph_generation(commit_graph, pos);
+}
+
+struct graph_commit {
+	unsigned char sha1[20];
+	unsigned char tree[20];
+	unsigned long date;
+	int nr_parents;
+	unsigned char (*parents)[20];
+	/* filled in by the writer once the list is sorted */
+	uint32_t *parent_pos;
+	uint32_t generation;
+};
+
+/*
+ * Extract what the commit-graph records from the commit object
+ * itself; parse_commit() is not used, as grafts must not end up in
+ * the file.
+ */
+static int read_graph_commit(const unsigned char *sha1, struct graph_commit *gc)
+{
+	enum object_type type;
+	unsigned long size;
+	const char *p, *tail;
+	char *buf;
+	int alloc = 0;
+
+	buf = read_sha1_file(sha1, &type, &size);
+	if (!buf)
+		return error("Could not read %s", sha1_to_hex(sha1));
+	if (type != OBJ_COMMIT) {
+		free(buf);
+		return error("Object %s not a commit", sha1_to_hex(sha1));
+	}
+
+	hashcpy(gc->sha1, sha1);
+	gc->nr_parents = 0;
+	gc->parents = NULL;
+	gc->parent_pos = NULL;
+	gc->generation = 0;
+	tail = buf + size;
+	if (tail <= buf + 46 || memcmp(buf, "tree ", 5) || buf[45] != '\n' ||
+	    get_sha1_hex(buf + 5, gc->tree)) {
+		free(buf);
+		return error("bogus commit object %s", sha1_to_hex(sha1));
+	}
+	p = buf + 46;
+	while (p + 48 < tail && !memcmp(p, "parent ", 7)) {
+		ALLOC_GROW(gc->parents, gc->nr_parents + 1, alloc);
+		if (get_sha1_hex(p + 7, gc->parents[gc->nr_parents]) ||
+		    p[47] != '\n') {
+			free(buf);
+			free(gc->parents);
+			return error("bad parents in commit %s",
+				     sha1_to_hex(sha1));
+		}
+		gc->nr_parents++;
+		p += 48;
+	}
+	gc->date = parse_commit_date(p, tail);
+	free(buf);
+	return 0;
+}
+
+static int graph_commit_cmp(const void *a_, const void *b_)
+{
+	const struct graph_commit *a = a_, *b = b_;
+	return hashcmp(a->sha1, b->sha1);
+}
+
+static const unsigned char *graph_commit_access(size_t index, void *table)
+{
+	struct graph_commit *list = table;
+	return list[index].sha1;
+}
+
+static void write_u32(struct sha1file *f, uint32_t v)
+{
+	v = htonl(v);
+	sha1write(f, &v, 4);
+}
+
+static void free_graph_commits(struct graph_commit *list, int nr)
+{
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		struct commit *c = lookup_commit(list[i].sha1);
+		if (c)
+			c->object.flags &= ~GRAPH_SEEN;
+		free(list[i].parents);
+		free(list[i].parent_pos);
+	}
+	free(list);
+}
+
+static void compute_generations(struct graph_commit *list, int nr)
+{
+	int *stack = NULL;
+	int i, j, stack_nr = 0, stack_alloc = 0;
+
+	for (i = 0; i < nr; i++) {
+		if (list[i].generation)
+			continue;
+		ALLOC_GROW(stack, stack_nr + 1, stack_alloc);
+		stack[stack_nr++] = i;
+		while (stack_nr) {
+			struct graph_commit *gc = &list[stack[stack_nr - 1]];
+			uint32_t max_generation = 0;
+			int pending = 0;
+
+			if (gc->generation) {
+				stack_nr--;
+				continue;
+			}
+			for (j = 0; j < gc->nr_parents; j++) {
+				struct graph_commit *p = &list[gc->parent_pos[j]];
+				if (!p->generation) {
+					ALLOC_GROW(stack, stack_nr + 1, stack_alloc);
+					stack[stack_nr++] = gc->parent_pos[j];
+					pending = 1;
+				} else if (max_generation < p->generation)
+					max_generation = p->generation;
+			}
+			if (pending)
+				continue;
+			gc->generation = max_generation < GENERATION_NUMBER_MAX ?
+					 max_generation + 1 : GENERATION_NUMBER_MAX;
+			stack_nr--;
+		}
+	}
+	free(stack);
+}
+
+int write_commit_graph(struct sha1_array *tips)
+{
+	static struct lock_file lock;
+	struct graph_commit *list = NULL;
+	struct commit **stack = NULL;
+	uint32_t *edges = NULL;
+	int nr = 0, alloc = 0, stack_nr = 0, stack_alloc = 0;
+	int edges_nr = 0, edges_alloc = 0;
+	int i, j, fd;
+	uint32_t fanout[256];
+	struct sha1file *f;
+
+	for (i = 0; i < tips->nr; i++) {
+		struct commit *c = lookup_commit(tips->sha1[i]);
+		if (!c)
+			return error("%s is not a commit",
+				     sha1_to_hex(tips->sha1[i]));
+		ALLOC_GROW(stack, stack_nr + 1, stack_alloc);
+		stack[stack_nr++] = c;
+	}
+
+	while (stack_nr) {
+		struct commit *c = stack[--stack_nr];
+		struct graph_commit *gc;
+
+		if (c->object.flags & GRAPH_SEEN)
+			continue;
+		c->object.flags |= GRAPH_SEEN;
+		ALLOC_GROW(list, nr + 1, alloc);
+		gc = &list[nr];
+		if (read_graph_commit(c->object.sha1, gc))
+			goto fail;
+		nr++;
+		for (j = 0; j < gc->nr_parents; j++) {
+			struct commit *p = lookup_commit(gc->parents[j]);
+			if (!p)
+				goto fail;
+			if (p->object.flags & GRAPH_SEEN)
+				continue;
+			ALLOC_GROW(stack, stack_nr + 1, stack_alloc);
+			stack[stack_nr++] = p;
+		}
+	}
+	free(stack);
+	stack = NULL;
+
+	qsort(list, nr, sizeof(*list), graph_commit_cmp);
+	for (i = 0; i < nr; i++) {
+		struct graph_commit *gc = &list[i];
+
+		gc->parent_pos = xmalloc(gc->nr_parents * sizeof(uint32_t));
+		for (j = 0; j < gc->nr_parents; j++) {
+			int pos = sha1_pos(gc->parents[j], list, nr,
+					   graph_commit_access);
+			if (pos < 0)
+				die("BUG: parent %s of %s is not in the graph",
+				    sha1_to_hex(gc->parents[j]),
+				    sha1_to_hex(gc->sha1));
+			gc->parent_pos[j] = pos;
+		}
+	}
+	compute_generations(list, nr);
+
+	memset(fanout, 0, sizeof(fanout));
+	for (i = 0; i < nr; i++)
+		fanout[list[i].sha1[0]]++;
+	for (i = 1; i < 256; i++)
+		fanout[i] += fanout[i - 1];
+
+	if (safe_create_leading_directories_const(commit_graph_path())) {
+		error("unable to create leading directories of %s",
+		      commit_graph_path());
+		goto fail;
+	}
+	fd = hold_lock_file_for_update(&lock, commit_graph_path(),
+				       LOCK_DIE_ON_ERROR);
+	f = sha1fd(fd, lock.filename);
+
+	for (i = 0; i < nr; i++)
+		if (list[i].nr_parents > 2)
+			edges_nr += list[i].nr_parents - 1;
+
+	write_u32(f, COMMIT_GRAPH_SIGNATURE);
+	write_u32(f, COMMIT_GRAPH_VERSION);
+	write_u32(f, nr);
+	write_u32(f, edges_nr);
+	for (i = 0; i < 256; i++)
+		write_u32(f, fanout[i]);
+	for (i = 0; i < nr; i++)
+		sha1write(f, list[i].sha1, 20);
+
+	edges_nr = 0;
+	for (i = 0; i < nr; i++) {
+		struct graph_commit *gc = &list[i];
+		uint32_t parent[2] = { GRAPH_PARENT_NONE, GRAPH_PARENT_NONE };
+		uint64_t date = gc->date;
+
+		for (j = 0; j < gc->nr_parents; j++) {
+			uint32_t pos = gc->parent_pos[j];
+			if (!j || gc->nr_parents == 2) {
+				parent[j] = pos;
+				continue;
+			}
+			if (j == 1)
+				parent[1] = GRAPH_EXTRA_EDGES | edges_nr;
+			ALLOC_GROW(edges, edges_nr + 1, edges_alloc);
+			edges[edges_nr++] = pos;
+		}
+		if (gc->nr_parents > 2)
+			edges[edges_nr - 1] |= GRAPH_LAST_EDGE;
+
+		sha1write(f, gc->tree, 20);
+		write_u32(f, parent[0]);
+		write_u32(f, parent[1]);
+		write_u32(f, (gc->generation << GRAPH_GENERATION_SHIFT) |
+			     ((date >> 32) & GRAPH_DATE_HIGH_MASK));
+		write_u32(f, date & 0xffffffff);
+	}
+	for (i = 0; i < edges_nr; i++)
+		write_u32(f, edges[i]);
+
+	sha1close(f, NULL, CSUM_FSYNC);
+	lock.fd = -1; /* closed by sha1close() */
+	if (commit_lock_file(&lock) < 0)
+		die_errno("unable to write commit-graph file %s",
+			  commit_graph_path());
+
+	free(edges);
+	free_graph_commits(list, nr);
+	return 0;
+
+fail:
+	free(stack);
+	free_graph_commits(list, nr);
+	return -1;
+}
+
+int verify_commit_graph(void)
+{
+	const struct commit_graph *g;
+	unsigned char sha1[20];
+	git_SHA_CTX ctx;
+	uint32_t *parents = NULL;
+	int parents_alloc = 0;
+	uint32_t i;
+	int j, errors = 0;
+
+	prepare_commit_graph();
+	g = commit_graph;
+	if (!g)
+		return file_exists(commit_graph_path());
+
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, g->data, g->data_len - 20);
+	git_SHA1_Final(sha1, &ctx);
+	if (hashcmp(sha1, g->data + g->data_len - 20)) {
+		error("commit-graph checksum mismatch");
+		errors++;
+	}
+
+	for (i = 0; i < g->num_commits; i++) {
+		const unsigned char *cur = g->sha1s + 20 * i;
+		const unsigned char *data = g->commit_data + GRAPH_DATA_WIDTH * i;
+		struct graph_commit gc;
+		int nr;
+
+		if (i && hashcmp(cur - 20, cur) >= 0) {
+			error("commit-graph is not sorted at %s",
+			      sha1_to_hex(cur));
+			errors++;
+		}
+		if (read_graph_commit(cur, &gc)) {
+			errors++;
+			continue;
+		}
+		nr = graph_parent_positions(g, i, &parents, &parents_alloc);
+		for (j = 0; j < nr && j < gc.nr_parents; j++)
+			if (parents[j] >= g->num_commits ||
+			    hashcmp(gc.parents[j], g->sha1s + 20 * parents[j]))
+				break;
+
+		if (hashcmp(gc.tree, data)) {
+			error("commit-graph has wrong tree for %s",
+			      sha1_to_hex(cur));
+			errors++;
+		}
+		if (gc.date != graph_commit_date(g, i)) {
+			error("commit-graph has wrong date for %s",
+			      sha1_to_hex(cur));
+			errors++;
+		}
+		if (nr != gc.nr_parents || j < nr) {
+			error("commit-graph has wrong parents for %s",
+			      sha1_to_hex(cur));
+			errors++;
+		} else if (stored_generation(g, i)) {
+			uint32_t max_generation = 0;
+			for (j = 0; j < nr; j++)
+				if (max_generation < stored_generation(g, parents[j]))
+					max_generation = stored_generation(g, parents[j]);
+			if (max_generation < GENERATION_NUMBER_MAX)
+				max_generation++;
+			if (stored_generation(g, i) != max_generation) {
+				error("commit-graph has wrong generation for %s",
+				      sha1_to_hex(cur));
+				errors++;
+			}
+		}
+		free(gc.parents);
+	}
+	free(parents);
+	return errors;
+}
@@ -0,0 +1,38 @@
+#ifndef COMMIT_GRAPH_H
+#define COMMIT_GRAPH_H
+
+#define COMMIT_GRAPH_SIGNATURE 0x43475048 /* "CGPH" */
+#define COMMIT_GRAPH_VERSION 1
+
+struct commit;
+struct sha1_array;
+
+/*
+ * If the commit-graph file knows about "item", fill in its tree,
+ * parents and date from there and mark it parsed, without reading
+ * the commit object.  Returns 0 on success, and -1 when the caller
+ * has to parse the object itself.
+ */
+extern int parse_commit_in_graph(struct commit *item);
+
+/*
+ * Return the generation number the commit-graph file records for
+ * "item", or GENERATION_NUMBER_INFINITY if it cannot be trusted.
+ */
+extern uint32_t commit_graph_generation(const struct commit *item);
+
+/*
+ * Write a commit-graph file covering the given commits and all of
+ * their ancestors to $GIT_OBJECT_DIRECTORY/info/commit-graph.
+ */
+extern int write_commit_graph(struct sha1_array *tips);
+
+/*
+ * Check the checksum and the contents of the commit-graph file
+ * against the object database. Returns the number of problems found.
+ */
+extern int verify_commit_graph(void);
+
+extern void close_commit_graph(void);
+
+#endif /* COMMIT_GRAPH_H */
@@ -7,6 +7,7 @@
 #include "revision.h"
 #include "notes.h"
 #include "gpg-interface.h"
+#include "commit-graph.h"
 
 int save_commit_buffer = 1;
 
@@ -75,7 +76,7 @@ struct commit *lookup_commit_reference_by_name(const char *name)
 	return commit;
 }
 
-static unsigned long parse_commit_date(const char *buf, const char *tail)
+unsigned long parse_commit_date(const char *buf, const char *tail)
 {
 	const char *dateptr;
 
@@ -227,6 +228,12 @@ struct commit_graft *lookup_commit_graft(const unsigned char *sha1)
 	return commit_graft[pos];
 }
 
+int has_commit_grafts(void)
+{
+	prepare_commit_graft();
+	return commit_graft_nr > 0;
+}
+
 int for_each_commit_graft(each_commit_graft_fn fn, void *cb_data)
 {
 	int i, ret;
@@ -299,6 +306,7 @@ int parse_commit_buffer(struct commit *item, const void *buffer, unsigned long s
 		}
 	}
 	item->date = parse_commit_date(bufptr, tail);
+	item->generation = commit_graph_generation(item);
 
 	return 0;
 }
@@ -314,6 +322,12 @@ int parse_commit(struct commit *item)
 		return -1;
 	if (item->object.parsed)
 		return 0;
+	/*
+	 * The commit-graph cannot give us the buffer, so it is only
+	 * consulted when the caller does not want it kept around.
+	 */
+	if (!save_commit_buffer && !parse_commit_in_graph(item))
+		return 0;
 	buffer = read_sha1_file(item->object.sha1, &type, &size);
 	if (!buffer)
 		return error("Could not read %s",
@@ -590,7 +604,13 @@ static struct commit *interesting(struct commit_list *list)
 	return NULL;
 }
 
-static struct commit_list *merge_bases_many(struct commit *one, int n, struct commit **twos)
+/*
+ * Parents with a generation below min_generation are not walked; the
+ * caller must not be interested in merge bases that low.
+ */
+static struct commit_list *merge_bases_many(struct commit *one, int n,
+					    struct commit **twos,
+					    uint32_t min_generation)
 {
 	struct commit_list *list = NULL;
 	struct commit_list *result = NULL;
@@ -647,6 +667,8 @@ static struct commit_list *merge_bases_many(struct commit *one, int n, struct co
 				continue;
 			if (parse_commit(p))
 				return NULL;
+			if (p->generation < min_generation)
+				continue;
 			p->object.flags |= flags;
 			commit_list_insert_by_date(p, &list);
 		}
@@ -702,7 +724,7 @@ struct commit_list *get_merge_bases_many(struct commit *one,
 	struct commit_list *result;
 	int cnt, i, j;
 
-	result = merge_bases_many(one, n, twos);
+	result = merge_bases_many(one, n, twos, 0);
 	for (i = 0; i < n; i++) {
 		if (one == twos[i])
 			return result;
@@ -735,7 +757,7 @@ struct commit_list *get_merge_bases_many(struct commit *one,
 		for (j = i+1; j < cnt; j++) {
 			if (!rslt[i] || !rslt[j])
 				continue;
-			result = merge_bases_many(rslt[i], 1, &rslt[j]);
+			result = merge_bases_many(rslt[i], 1, &rslt[j], 0);
 			clear_commit_marks(rslt[i], all_flags);
 			clear_commit_marks(rslt[j], all_flags);
 			for (list = result; list; list = list->next) {
@@ -778,26 +800,55 @@ int is_descendant_of(struct commit *commit, struct commit_list *with_commit)
 	return 0;
 }
 
-int in_merge_bases(struct commit *commit, struct commit **reference, int num)
+/*
+ * Is "commit" reachable from any of the "reference" commits?
+ */
+static int in_merge_bases_many(struct commit *commit, int nr_reference,
+			       struct commit **reference)
 {
 	struct commit_list *bases, *b;
-	int ret = 0;
+	uint32_t max_generation = 0, min_generation = 0;
+	int i, ret = 0;
+
+	if (parse_commit(commit))
+		return ret;
+	for (i = 0; i < nr_reference; i++) {
+		if (parse_commit(reference[i]))
+			return ret;
+		if (max_generation < reference[i]->generation)
+			max_generation = reference[i]->generation;
+	}
 
-	if (num == 1)
-		bases = get_merge_bases(commit, *reference, 1);
-	else
-		die("not yet");
+	if (commit->generation <= GENERATION_NUMBER_MAX) {
+		if (max_generation < commit->generation)
+			return ret;
+		/* nothing below commit can lead back to it */
+		min_generation = commit->generation;
+	}
+
+	bases = merge_bases_many(commit, nr_reference, reference,
+				 min_generation);
 	for (b = bases; b; b = b->next) {
-		if (!hashcmp(commit->object.sha1, b->item->object.sha1)) {
+		if (b->item == commit) {
 			ret = 1;
 			break;
 		}
 	}
-
 	free_commit_list(bases);
+
+	clear_commit_marks(commit, all_flags);
+	for (i = 0; i < nr_reference; i++)
+		clear_commit_marks(reference[i], all_flags);
 	return ret;
 }
 
+int in_merge_bases(struct commit *commit, struct commit **reference, int num)
+{
+	if (num != 1)
+		die("not yet");
+	return in_merge_bases_many(commit, num, reference);
+}
+
 struct commit_list *reduce_heads(struct commit_list *heads)
 {
 	struct commit_list *p;
@@ -815,7 +866,7 @@ struct commit_list *reduce_heads(struct commit_list *heads)
 
 	/* For each commit, see if it can be reached by others */
 	for (p = heads; p; p = p->next) {
-		struct commit_list *q, *base;
+		struct commit_list *q;
 
 		/* Do we already have this in the result? */
 		for (q = result; q; q = q->next)
@@ -830,21 +881,9 @@ struct commit_list *reduce_heads(struct commit_list *heads)
 				continue;
 			other[num_other++] = q->item;
 		}
-		if (num_other)
-			base = get_merge_bases_many(p->item, num_other, other, 1);
-		else
-			base = NULL;
-		/*
-		 * If p->item does not have anything common with other
-		 * commits, there won't be any merge base.  If it is
-		 * reachable from some of the others, p->item will be
-		 * the merge base.  If its history is connected with
-		 * others, but p->item is not reachable by others, we
-		 * will get something other than p->item back.
-		 */
-		if (!base || (base->item != p->item))
+		if (!num_other ||
+		    !in_merge_bases_many(p->item, num_other, other))
 			tail = &(commit_list_insert(p->item, tail)->next);
-		free_commit_list(base);
 	}
 	free(other);
 	return result;
@@ -19,8 +19,19 @@ struct commit {
 	struct commit_list *parents;
 	struct tree *tree;
 	char *buffer;
+	uint32_t generation;
 };
 
+/*
+ * Generation numbers come from the commit-graph file: a root commit
+ * has generation 1 and any other commit is one more than its largest
+ * parent.  A commit can only be reached from commits with a larger
+ * generation.  Parsed commits the graph does not know about are
+ * given GENERATION_NUMBER_INFINITY.
+ */
+#define GENERATION_NUMBER_INFINITY 0xFFFFFFFF
+#define GENERATION_NUMBER_MAX 0x3FFFFFFF
+
 extern int save_commit_buffer;
 extern const char *commit_type;
 
@@ -45,6 +56,7 @@ struct commit *lookup_commit_reference_by_name(const char *name);
  */
 struct commit *lookup_commit_or_die(const unsigned char *sha1, const char *ref_name);
 
+unsigned long parse_commit_date(const char *buf, const char *tail);
 int parse_commit_buffer(struct commit *item, const void *buffer, unsigned long size);
 int parse_commit(struct commit *item);
 
@@ -155,6 +167,7 @@ typedef int (*each_commit_graft_fn)(const struct commit_graft *, void *);
 struct commit_graft *read_graft_line(char *buf, int len);
 int register_commit_graft(struct commit_graft *, int);
 struct commit_graft *lookup_commit_graft(const unsigned char *sha1);
+int has_commit_grafts(void);
 
 extern struct commit_list *get_merge_bases(struct commit *rev1, struct commit *rev2, int cleanup);
 extern struct commit_list *get_merge_bases_many(struct commit *one, int n, struct commit **twos, int cleanup);
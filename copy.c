@@ -1,7 +1,42 @@
 #include "cache.h"
+#ifdef HAVE_SENDFILE
+#include <sys/sendfile.h>
+
+/*
+ * Let the kernel move the data without copying it through user
+ * space.  Returns 1 if sendfile() cannot be used on these descriptors
+ * (e.g. "ifd" is a pipe), in which case nothing has been copied yet.
+ */
+static int copy_fd_sendfile(int ifd, int ofd)
+{
+	int copied = 0;
+
+	while (1) {
+		ssize_t len = sendfile(ofd, ifd, NULL, 1 << 20);
+		if (!len)
+			return 0;
+		if (len < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			if (!copied && (errno == EINVAL || errno == ENOSYS))
+				return 1;
+			return error("copy-fd: sendfile returned %s",
+				     strerror(errno));
+		}
+		copied = 1;
+	}
+}
+#endif
 
 int copy_fd(int ifd, int ofd)
 {
+#ifdef HAVE_SENDFILE
+	int ret = copy_fd_sendfile(ifd, ofd);
+	if (ret <= 0) {
+		close(ifd);
+		return ret;
+	}
+#endif
 	while (1) {
 		char buffer[8192];
 		char *buf = buffer;
@@ -25,6 +25,7 @@ static int informative_errors;
 static const char daemon_usage[] =
 "git daemon [--verbose] [--syslog] [--export-all]\n"
 "           [--timeout=<n>] [--init-timeout=<n>] [--max-connections=<n>]\n"
+"           [--max-connections-per-ip=<n>] [--max-queued=<n>]\n"
 "           [--strict-paths] [--base-path=<path>] [--base-path-relaxed]\n"
 "           [--user-path | --user-path=<path>]\n"
 "           [--interpolated-path=<path>]\n"
@@ -601,6 +602,8 @@ static int addrcmp(const struct sockaddr_storage *s1,
 }
 
 static int max_connections = 32;
+static unsigned int max_connections_per_ip;
+static unsigned int max_queued;
 
 static unsigned int live_children;
 
@@ -666,24 +669,92 @@ static void check_dead_children(void)
 			cradle = &blanket->next;
 }
 
+static const char *ip2str(int family, struct sockaddr *sin, socklen_t len)
+{
+#ifdef NO_IPV6
+	static char ip[INET_ADDRSTRLEN];
+#else
+	static char ip[INET6_ADDRSTRLEN];
+#endif
+
+	switch (family) {
+#ifndef NO_IPV6
+	case AF_INET6:
+		inet_ntop(family, &((struct sockaddr_in6*)sin)->sin6_addr, ip, len);
+		break;
+#endif
+	case AF_INET:
+		inet_ntop(family, &((struct sockaddr_in*)sin)->sin_addr, ip, len);
+		break;
+	default:
+		strcpy(ip, "<unknown>");
+	}
+	return ip;
+}
+
+static unsigned int children_from(const struct sockaddr_storage *addr)
+{
+	const struct child *blanket;
+	unsigned int nr = 0;
+
+	/* children from the same address are kept next to each other */
+	for (blanket = firstborn; blanket; blanket = blanket->next)
+		if (!addrcmp(&blanket->address, addr))
+			nr++;
+		else if (nr)
+			break;
+	return nr;
+}
+
+static int may_start_child(const struct sockaddr_storage *addr)
+{
+	if (max_connections && live_children >= max_connections)
+		return 0;
+	if (max_connections_per_ip &&
+	    children_from(addr) >= max_connections_per_ip)
+		return 0;
+	return 1;
+}
+
+/*
+ * Connections that arrive while we are at one of the limits wait here,
+ * instead of costing a running child its life, until a slot frees up.
+ */
+static struct pending_connection {
+	struct pending_connection *next;
+	int fd;
+	socklen_t addrlen;
+	struct sockaddr_storage address;
+} *pending_head, **pending_tail = &pending_head;
+
+static unsigned int pending_nr;
+
+static int queue_connection(int incoming, struct sockaddr *addr, socklen_t addrlen)
+{
+	struct pending_connection *pending;
+
+	if (pending_nr >= max_queued)
+		return -1;
+
+	pending = xcalloc(1, sizeof(*pending));
+	pending->fd = incoming;
+	pending->addrlen = addrlen;
+	memcpy(&pending->address, addr, addrlen);
+	*pending_tail = pending;
+	pending_tail = &pending->next;
+	pending_nr++;
+	loginfo("Queued connection from %s (%u waiting)",
+		ip2str(addr->sa_family, addr, addrlen), pending_nr);
+	return 0;
+}
+
 static char **cld_argv;
-static void handle(int incoming, struct sockaddr *addr, socklen_t addrlen)
+static void start_child(int incoming, struct sockaddr *addr, socklen_t addrlen)
 {
 	struct child_process cld = { NULL };
 	char addrbuf[300] = "REMOTE_ADDR=", portbuf[300];
 	char *env[] = { addrbuf, portbuf, NULL };
 
-	if (max_connections && live_children >= max_connections) {
-		kill_some_child();
-		sleep(1);  /* give it some time to die */
-		check_dead_children();
-		if (live_children >= max_connections) {
-			close(incoming);
-			logerror("Too many children, dropping connection");
-			return;
-		}
-	}
-
 	if (addr->sa_family == AF_INET) {
 		struct sockaddr_in *sin_addr = (void *) addr;
 		inet_ntop(addr->sa_family, &sin_addr->sin_addr, addrbuf + 12,
@@ -717,6 +788,72 @@ static void handle(int incoming, struct sockaddr *addr, socklen_t addrlen)
 	close(incoming);
 }
 
+/*
+ * Start the queued connections that fit under the limits now, oldest
+ * first.  Connections from an address that is at its own limit stay
+ * queued and let those from other addresses go ahead of them.
+ */
+static void start_queued_connections(void)
+{
+	struct pending_connection **p = &pending_head, *pending;
+
+	while ((pending = *p)) {
+		if (max_connections && live_children >= max_connections)
+			break;
+		if (!may_start_child(&pending->address)) {
+			p = &pending->next;
+			continue;
+		}
+		*p = pending->next;
+		if (pending_tail == &pending->next)
+			pending_tail = p;
+		pending_nr--;
+		start_child(pending->fd,
+			    (struct sockaddr *)&pending->address,
+			    pending->addrlen);
+		free(pending);
+	}
+}
+
+static void handle(int incoming, struct sockaddr *addr, socklen_t addrlen)
+{
+	struct sockaddr_storage address;
+
+	memset(&address, 0, sizeof(address));
+	memcpy(&address, addr, addrlen);
+
+	if (max_connections_per_ip &&
+	    children_from(&address) >= max_connections_per_ip) {
+		if (queue_connection(incoming, addr, addrlen) < 0) {
+			close(incoming);
+			logerror("Too many connections from %s, dropping connection",
+				 ip2str(addr->sa_family, addr, addrlen));
+		}
+		return;
+	}
+
+	if (max_connections && live_children >= max_connections) {
+		if (max_queued) {
+			if (queue_connection(incoming, addr, addrlen) < 0) {
+				close(incoming);
+				logerror("Too many children and queued connections, "
+					 "dropping connection");
+			}
+			return;
+		}
+		kill_some_child();
+		sleep(1);  /* give it some time to die */
+		check_dead_children();
+		if (live_children >= max_connections) {
+			close(incoming);
+			logerror("Too many children, dropping connection");
+			return;
+		}
+	}
+
+	start_child(incoming, addr, addrlen);
+}
+
 static void child_handler(int signo)
 {
 	/*
@@ -743,29 +880,6 @@ struct socketlist {
 	size_t alloc;
 };
 
-static const char *ip2str(int family, struct sockaddr *sin, socklen_t len)
-{
-#ifdef NO_IPV6
-	static char ip[INET_ADDRSTRLEN];
-#else
-	static char ip[INET6_ADDRSTRLEN];
-#endif
-
-	switch (family) {
-#ifndef NO_IPV6
-	case AF_INET6:
-		inet_ntop(family, &((struct sockaddr_in6*)sin)->sin6_addr, ip, len);
-		break;
-#endif
-	case AF_INET:
-		inet_ntop(family, &((struct sockaddr_in*)sin)->sin_addr, ip, len);
-		break;
-	default:
-		strcpy(ip, "<unknown>");
-	}
-	return ip;
-}
-
 #ifndef NO_IPV6
 
 static int setup_named_sock(char *listen_addr, int listen_port, struct socketlist *socklist)
@@ -941,8 +1055,13 @@ static int service_loop(struct socketlist *socklist)
 		int i;
 
 		check_dead_children();
+		start_queued_connections();
 
-		if (poll(pfd, socklist->nr, -1) < 0) {
+		/*
+		 * A child may exit between the check above and poll();
+		 * do not wait for the next client to notice its slot.
+		 */
+		if (poll(pfd, socklist->nr, pending_nr ? 1000 : -1) < 0) {
 			if (errno != EINTR) {
 				logerror("Poll failed, resuming: %s",
 				      strerror(errno));
@@ -1156,6 +1275,16 @@ int main(int argc, char **argv)
 				max_connections = 0;	        /* unlimited */
 			continue;
 		}
+		if (!prefixcmp(arg, "--max-connections-per-ip=")) {
+			int n = atoi(arg+25);
+			max_connections_per_ip = n < 0 ? 0 : n;
+			continue;
+		}
+		if (!prefixcmp(arg, "--max-queued=")) {
+			int n = atoi(arg+13);
+			max_queued = n < 0 ? 0 : n;
+			continue;
+		}
 		if (!strcmp(arg, "--strict-paths")) {
 			strict_paths = 1;
 			continue;
@@ -24,6 +24,8 @@
 
 static int diff_detect_rename_default;
 static int diff_rename_limit_default = 400;
+static int diff_rename_threads_default;
+int diff_rename_cache;
 static int diff_suppress_blank_empty;
 int diff_use_color_default = -1;
 static const char *diff_word_regex_cfg;
@@ -177,6 +179,19 @@ int git_diff_basic_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (!strcmp(var, "diff.renamecache")) {
+		diff_rename_cache = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "diff.renamethreads")) {
+		diff_rename_threads_default = git_config_int(var, value);
+		if (diff_rename_threads_default < 0)
+			die(_("invalid number of threads specified (%d) for %s"),
+			    diff_rename_threads_default, var);
+		return 0;
+	}
+
 	switch (userdiff_config(var, value)) {
 		case 0: break;
 		case -1: return -1;
@@ -1957,7 +1972,7 @@ static void emit_binary_diff(FILE *file, mmfile_t *one, mmfile_t *two, char *pre
 	emit_binary_diff_body(file, two, one, prefix);
 }
 
-static void diff_filespec_load_driver(struct diff_filespec *one)
+void diff_filespec_load_driver(struct diff_filespec *one)
 {
 	/* Use already-loaded driver */
 	if (one->driver)
@@ -3030,6 +3045,7 @@ void diff_setup(struct diff_options *options)
 	options->line_termination = '\n';
 	options->break_opt = -1;
 	options->rename_limit = -1;
+	options->rename_threads = diff_rename_threads_default;
 	options->dirstat_permille = diff_dirstat_permille_default;
 	options->context = 3;
 
@@ -1,6 +1,10 @@
 #include "cache.h"
 #include "diff.h"
 #include "diffcore.h"
+#include "notes-cache.h"
+#include "userdiff.h"
+#include "varint.h"
+#include "xdiff-interface.h"
 
 /*
  * Idea here is very simple.
@@ -163,6 +167,155 @@ static struct spanhash_top *hash_chars(struct diff_filespec *one)
 	return hash;
 }
 
+/*
+ * The span hashes of blobs can be kept as notes in refs/notes/similarity,
+ * so that rename detection does not have to read and hash the same blobs
+ * again and again.  Each note starts with a byte of flags, followed by
+ * the number of spans, and then each hash value (as the difference to
+ * the one before) and count as varints, in the sorted order.
+ */
+#define SIMILARITY_CACHE_VALIDITY "span hashes, version 1"
+
+/* the spans were hashed as binary, i.e. without ignoring CRs */
+#define SIMILARITY_HASHED_BINARY 01
+/* buffer_is_binary() says the contents are binary */
+#define SIMILARITY_CONTENT_BINARY 02
+
+static struct notes_cache *similarity_cache;
+
+static struct notes_cache *similarity_cache_for(struct diff_filespec *one)
+{
+	if (!diff_rename_cache || !one->sha1_valid || !S_ISREG(one->mode) ||
+	    is_null_sha1(one->sha1))
+		return NULL;
+	if (!similarity_cache) {
+		similarity_cache = xmalloc(sizeof(*similarity_cache));
+		notes_cache_init(similarity_cache, "similarity",
+				 SIMILARITY_CACHE_VALIDITY);
+	}
+	return similarity_cache;
+}
+
+static void put_cached_hash(struct notes_cache *c, struct diff_filespec *one,
+			    struct spanhash_top *hash)
+{
+	struct strbuf buf = STRBUF_INIT;
+	unsigned char varint[16];
+	unsigned int i, n, prev, sz = 1u << hash->alloc_log2;
+	int flags = 0;
+
+	if (diff_filespec_is_binary(one))
+		flags |= SIMILARITY_HASHED_BINARY;
+	if (buffer_is_binary(one->data, one->size))
+		flags |= SIMILARITY_CONTENT_BINARY;
+	for (n = 0; n < sz && hash->data[n].cnt; n++)
+		; /* count them */
+
+	strbuf_addch(&buf, flags);
+	strbuf_add(&buf, varint, encode_varint(n, varint));
+	for (i = prev = 0; i < n; i++) {
+		struct spanhash *h = &hash->data[i];
+		strbuf_add(&buf, varint, encode_varint(h->hashval - prev, varint));
+		strbuf_add(&buf, varint, encode_varint(h->cnt, varint));
+		prev = h->hashval;
+	}
+	/* ignore errors, as we might be in a readonly repository */
+	notes_cache_put(c, one->sha1, buf.buf, buf.len);
+	strbuf_release(&buf);
+}
+
+static struct spanhash_top *parse_cached_hash(const unsigned char *buf,
+					      size_t size)
+{
+	const unsigned char *end = buf + size;
+	struct spanhash_top *hash;
+	uintmax_t n, i, hashval = 0;
+
+	/* the note is NUL-terminated, so a varint cannot run away */
+	buf++;
+	if (end <= buf)
+		return NULL;
+	n = decode_varint(&buf);
+	if (end < buf || (end - buf) / 2 < n)
+		return NULL;
+
+	hash = xmalloc(sizeof(*hash) + sizeof(struct spanhash) * (n + 1));
+	for (i = 0; i < n; i++) {
+		struct spanhash *h = &hash->data[i];
+
+		uintmax_t delta = decode_varint(&buf);
+
+		hashval += delta;
+		h->hashval = hashval;
+		h->cnt = decode_varint(&buf);
+		if (end < buf || HASHBASE <= hashval || !h->cnt ||
+		    (i && !delta)) {
+			free(hash);
+			return NULL;
+		}
+	}
+	hash->data[n].hashval = 0;
+	hash->data[n].cnt = 0;
+	hash->alloc_log2 = 0;
+	hash->free = 0;
+	return hash;
+}
+
+void *diffcore_count_cached(struct diff_filespec *one)
+{
+	struct notes_cache *c = similarity_cache_for(one);
+	struct spanhash_top *hash;
+	unsigned char *buf;
+	size_t size;
+	int binary;
+
+	if (!c)
+		return NULL;
+	buf = (unsigned char *)notes_cache_get(c, one->sha1, &size);
+	if (!buf)
+		return NULL;
+	if (!size) {
+		free(buf);
+		return NULL;
+	}
+
+	/*
+	 * The attributes may want the blob to be treated differently
+	 * at this path than where it was hashed.
+	 */
+	binary = one->is_binary;
+	if (binary == -1) {
+		diff_filespec_load_driver(one);
+		binary = one->driver->binary;
+	}
+	if (binary == -1)
+		binary = one->is_binary = !!(buf[0] & SIMILARITY_CONTENT_BINARY);
+	if (binary != !!(buf[0] & SIMILARITY_HASHED_BINARY)) {
+		free(buf);
+		return NULL;
+	}
+
+	hash = parse_cached_hash(buf, size);
+	free(buf);
+	return hash;
+}
+
+void *diffcore_count_prepare(struct diff_filespec *one)
+{
+	struct spanhash_top *hash = hash_chars(one);
+	struct notes_cache *c = similarity_cache_for(one);
+
+	if (c)
+		put_cached_hash(c, one, hash);
+	return hash;
+}
+
+void diffcore_count_cache_write(void)
+{
+	if (similarity_cache)
+		notes_cache_write(similarity_cache);
+}
+
 int diffcore_count_changes(struct diff_filespec *src,
 			   struct diff_filespec *dst,
 			   void **src_count_p,
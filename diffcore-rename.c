@@ -6,6 +6,7 @@
 #include "diffcore.h"
 #include "hash.h"
 #include "progress.h"
+#include "thread-utils.h"
 
 /* Table of rename/copy destinations */
 
@@ -118,6 +119,56 @@ struct diff_score {
 	short name_score;
 };
 
+#ifndef NO_PTHREADS
+static int rename_use_threads;
+
+/*
+ * Protects the filespecs of the rename sources, which are shared by
+ * the threads, as well as reading files and objects, checking their
+ * attributes, and the progress meter.
+ */
+static pthread_mutex_t rename_mutex;
+
+static inline void rename_lock(void)
+{
+	if (rename_use_threads)
+		pthread_mutex_lock(&rename_mutex);
+}
+
+static inline void rename_unlock(void)
+{
+	if (rename_use_threads)
+		pthread_mutex_unlock(&rename_mutex);
+}
+#else
+#define rename_lock()
+#define rename_unlock()
+#endif
+
+/*
+ * Read the size of the file, or (unless "size_only") hash its
+ * contents for diffcore_count_changes(), after which the text
+ * itself is no longer needed.  The hashes may be cached from an
+ * earlier run, in which case the contents need not be read at all.
+ */
+static int prepare_similarity(struct diff_filespec *one, int size_only)
+{
+	int err = 0;
+
+	rename_lock();
+	if (!one->cnt_data && !size_only)
+		one->cnt_data = diffcore_count_cached(one);
+	if (!one->cnt_data) {
+		err = diff_populate_filespec(one, size_only);
+		if (!err && !size_only) {
+			one->cnt_data = diffcore_count_prepare(one);
+			diff_free_filespec_blob(one);
+		}
+	}
+	rename_unlock();
+	return err;
+}
+
 static int estimate_similarity(struct diff_filespec *src,
 			       struct diff_filespec *dst,
 			       int minimum_score)
@@ -155,9 +206,7 @@ static int estimate_similarity(struct diff_filespec *src,
 	 * is a possible size - we really should have a flag to
 	 * say whether the size is valid or not!)
 	 */
-	if (!src->cnt_data && diff_populate_filespec(src, 1))
-		return 0;
-	if (!dst->cnt_data && diff_populate_filespec(dst, 1))
+	if (prepare_similarity(src, 1) || prepare_similarity(dst, 1))
 		return 0;
 
 	max_size = ((src->size > dst->size) ? src->size : dst->size);
@@ -175,9 +224,7 @@ static int estimate_similarity(struct diff_filespec *src,
 	if (max_size * (MAX_SCORE-minimum_score) < delta_size * MAX_SCORE)
 		return 0;
 
-	if (!src->cnt_data && diff_populate_filespec(src, 0))
-		return 0;
-	if (!dst->cnt_data && diff_populate_filespec(dst, 0))
+	if (prepare_similarity(src, 0) || prepare_similarity(dst, 0))
 		return 0;
 
 	delta_limit = (unsigned long)
@@ -404,6 +451,247 @@ static int find_exact_renames(struct diff_options *options)
 	return i;
 }
 
+static const char *path_basename(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	return slash ? slash + 1 : path;
+}
+
+/*
+ * Can the source still be paired with a destination before the
+ * rename matrix is computed?  When detecting copies, any source
+ * may be the best match of any number of destinations, so no.
+ */
+static int unpaired_src(int i)
+{
+	struct diff_filespec *one = rename_src[i].p->one;
+	return !one->rename_used && S_ISREG(one->mode);
+}
+
+static int unpaired_dst(int i)
+{
+	return !rename_dst[i].pair && S_ISREG(rename_dst[i].two->mode);
+}
+
+static int find_rename_src(const char *path)
+{
+	int first = 0, last = rename_src_nr;
+
+	while (last > first) {
+		int next = (last + first) >> 1;
+		int cmp = strcmp(path, rename_src[next].p->one->path);
+		if (!cmp)
+			return next;
+		if (cmp < 0)
+			last = next;
+		else
+			first = next + 1;
+	}
+	return -1;
+}
+
+/*
+ * Pair the source with the destination if they are similar enough
+ * to be a rename.
+ */
+static int try_rename_pair(int src_index, int dst_index, int minimum_score)
+{
+	struct diff_filespec *one = rename_src[src_index].p->one;
+	struct diff_filespec *two = rename_dst[dst_index].two;
+	int score;
+
+	/* leave broken pairs of the same path to the matrix */
+	if (!strcmp(one->path, two->path))
+		return 0;
+	score = estimate_similarity(one, two, minimum_score);
+	if (score < minimum_score)
+		return 0;
+	record_rename_pair(dst_index, src_index, score);
+	return 1;
+}
+
+struct basename_entry {
+	const char *basename;
+	int index;
+};
+
+static int basename_compare(const void *a_, const void *b_)
+{
+	const struct basename_entry *a = a_, *b = b_;
+	int cmp = strcmp(a->basename, b->basename);
+	return cmp ? cmp : a->index - b->index;
+}
+
+/* Find where the run of entries with the basename of "e[i]" ends */
+static int basename_run(struct basename_entry *e, int nr, int i)
+{
+	int end;
+
+	for (end = i + 1; end < nr; end++)
+		if (strcmp(e[end].basename, e[i].basename))
+			break;
+	return end;
+}
+
+/*
+ * Files are often moved to another directory without changing their
+ * names.  Pair each source whose basename no other remaining source
+ * has with the only remaining destination of that basename, if they
+ * are similar enough, without comparing them to anything else.
+ */
+static int find_basename_renames(int minimum_score)
+{
+	struct basename_entry *src, *dst;
+	int src_nr = 0, dst_nr = 0, i, j, count = 0;
+
+	src = xmalloc(rename_src_nr * sizeof(*src));
+	for (i = 0; i < rename_src_nr; i++) {
+		if (!unpaired_src(i))
+			continue;
+		src[src_nr].basename = path_basename(rename_src[i].p->one->path);
+		src[src_nr++].index = i;
+	}
+	dst = xmalloc(rename_dst_nr * sizeof(*dst));
+	for (i = 0; i < rename_dst_nr; i++) {
+		if (!unpaired_dst(i))
+			continue;
+		dst[dst_nr].basename = path_basename(rename_dst[i].two->path);
+		dst[dst_nr++].index = i;
+	}
+	qsort(src, src_nr, sizeof(*src), basename_compare);
+	qsort(dst, dst_nr, sizeof(*dst), basename_compare);
+
+	for (i = j = 0; i < src_nr && j < dst_nr; ) {
+		int cmp = strcmp(src[i].basename, dst[j].basename);
+		int src_end, dst_end;
+
+		if (cmp < 0) {
+			i++;
+			continue;
+		}
+		if (cmp > 0) {
+			j++;
+			continue;
+		}
+		src_end = basename_run(src, src_nr, i);
+		dst_end = basename_run(dst, dst_nr, j);
+		if (src_end == i + 1 && dst_end == j + 1)
+			count += try_rename_pair(src[i].index, dst[j].index,
+						 minimum_score);
+		i = src_end;
+		j = dst_end;
+	}
+	free(src);
+	free(dst);
+	return count;
+}
+
+/* The leading directories of a path, with the trailing slash */
+struct dir_move {
+	const char *src;
+	int src_len;
+	const char *dst;
+	int dst_len;
+	int count;
+};
+
+static int dir_compare(const char *a, int a_len, const char *b, int b_len)
+{
+	int cmp = memcmp(a, b, a_len < b_len ? a_len : b_len);
+	return cmp ? cmp : a_len - b_len;
+}
+
+static int dir_move_compare(const void *a_, const void *b_)
+{
+	const struct dir_move *a = a_, *b = b_;
+	int cmp = dir_compare(a->dst, a->dst_len, b->dst, b->dst_len);
+	return cmp ? cmp : dir_compare(a->src, a->src_len, b->src, b->src_len);
+}
+
+static int dir_move_dst_compare(const void *a_, const void *b_)
+{
+	const struct dir_move *a = a_, *b = b_;
+	return dir_compare(a->dst, a->dst_len, b->dst, b->dst_len);
+}
+
+/*
+ * When a directory is renamed, the renames found so far show where
+ * most files of each destination directory came from.  Pair each
+ * remaining destination with the remaining source of the same name
+ * in the directory that most of its neighbours came from, if they
+ * are similar enough.  This catches files whose basename is not
+ * unique, like the Makefile of each moved directory.
+ */
+static int find_directory_renames(int minimum_score)
+{
+	struct dir_move *moves;
+	struct strbuf path = STRBUF_INIT;
+	int nr = 0, i, j, count = 0;
+
+	moves = xmalloc(rename_dst_nr * sizeof(*moves));
+	for (i = 0; i < rename_dst_nr; i++) {
+		struct diff_filepair *p = rename_dst[i].pair;
+
+		if (!p)
+			continue;
+		moves[nr].src = p->one->path;
+		moves[nr].src_len = path_basename(p->one->path) - p->one->path;
+		moves[nr].dst = p->two->path;
+		moves[nr].dst_len = path_basename(p->two->path) - p->two->path;
+		moves[nr++].count = 1;
+	}
+	qsort(moves, nr, sizeof(*moves), dir_move_compare);
+
+	/*
+	 * Count the renames between each pair of directories, and keep
+	 * the most common source directory of each destination one.
+	 */
+	for (i = j = 0; i < nr; i++) {
+		if (j && !dir_move_compare(&moves[j - 1], &moves[i]))
+			moves[j - 1].count++;
+		else
+			moves[j++] = moves[i];
+	}
+	for (nr = j, i = j = 0; i < nr; i++) {
+		if (j && !dir_compare(moves[j - 1].dst, moves[j - 1].dst_len,
+				      moves[i].dst, moves[i].dst_len)) {
+			if (moves[j - 1].count < moves[i].count)
+				moves[j - 1] = moves[i];
+		} else
+			moves[j++] = moves[i];
+	}
+	nr = j;
+
+	for (i = 0; nr && i < rename_dst_nr; i++) {
+		const char *dst_path = rename_dst[i].two->path;
+		const char *base = path_basename(dst_path);
+		struct dir_move key;
+		struct dir_move *move;
+		int src_index;
+
+		if (!unpaired_dst(i))
+			continue;
+		key.dst = dst_path;
+		key.dst_len = base - dst_path;
+		move = bsearch(&key, moves, nr, sizeof(*moves),
+			       dir_move_dst_compare);
+		if (!move || !dir_compare(move->src, move->src_len,
+					  move->dst, move->dst_len))
+			continue;
+
+		strbuf_reset(&path);
+		strbuf_add(&path, move->src, move->src_len);
+		strbuf_addstr(&path, base);
+		src_index = find_rename_src(path.buf);
+		if (src_index < 0 || !unpaired_src(src_index))
+			continue;
+		count += try_rename_pair(src_index, i, minimum_score);
+	}
+	strbuf_release(&path);
+	free(moves);
+	return count;
+}
+
 #define NUM_CANDIDATE_PER_DST 4
 static void record_if_better(struct diff_score m[], struct diff_score *o)
 {
@@ -420,17 +708,149 @@ static void record_if_better(struct diff_score m[], struct diff_score *o)
 		m[worst] = *o;
 }
 
+/*
+ * The inexact rename matrix: for each destination that was not an
+ * exact rename, the best NUM_CANDIDATE_PER_DST sources.  Its rows
+ * are independent of each other, so threads fill them in parallel.
+ */
+struct rename_matrix {
+	struct diff_score *mx;
+	int *row_dst; /* index in rename_dst of each row */
+	int nr_rows;
+	int nr_cols; /* sources to compare with */
+	int minimum_score;
+	int skip_unmodified;
+	int skip_used; /* sources already renamed are no candidates */
+
+	/* under rename_lock() */
+	int next_row;
+	int rows_done;
+	struct progress *progress;
+};
+
+static void fill_rename_row(struct rename_matrix *rm, int row)
+{
+	int i = rm->row_dst[row], j;
+	struct diff_filespec *two = rename_dst[i].two;
+	struct diff_score *m = &rm->mx[row * NUM_CANDIDATE_PER_DST];
+
+	for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
+		m[j].dst = -1;
+
+	for (j = 0; j < rename_src_nr; j++) {
+		struct diff_filespec *one = rename_src[j].p->one;
+		struct diff_score this_src;
+
+		if (rm->skip_unmodified &&
+		    diff_unmodified_pair(rename_src[j].p))
+			continue;
+		if (rm->skip_used && one->rename_used)
+			continue;
+
+		this_src.score = estimate_similarity(one, two,
+						     rm->minimum_score);
+		this_src.name_score = basename_same(one, two);
+		this_src.dst = i;
+		this_src.src = j;
+		record_if_better(m, &this_src);
+	}
+}
+
+/*
+ * Fill the rows of the matrix one by one, until none are left.
+ */
+static void *fill_rename_matrix(void *data)
+{
+	struct rename_matrix *rm = data;
+
+	for (;;) {
+		int row;
+
+		rename_lock();
+		if (rm->next_row < rm->nr_rows)
+			row = rm->next_row++;
+		else
+			row = -1;
+		rename_unlock();
+		if (row < 0)
+			break;
+
+		fill_rename_row(rm, row);
+
+		rename_lock();
+		rm->rows_done++;
+		display_progress(rm->progress, rm->rows_done * rm->nr_cols);
+		rename_unlock();
+	}
+	return NULL;
+}
+
+#ifndef NO_PTHREADS
+/* Below this many pairs, starting threads costs more than it gains */
+#define RENAME_PAIRS_PER_THREAD 2048
+
+static int rename_thread_count(struct diff_options *options,
+			       int num_create, int num_src)
+{
+	int nr = options->rename_threads;
+
+	if (nr <= 0) {
+		nr = online_cpus();
+		if (num_create * num_src / RENAME_PAIRS_PER_THREAD < nr)
+			nr = num_create * num_src / RENAME_PAIRS_PER_THREAD;
+	}
+	if (num_create < nr)
+		nr = num_create;
+	return nr;
+}
+
+static void run_rename_threads(struct rename_matrix *rm, int nr)
+{
+	pthread_t *threads;
+	int i;
+
+	threads = xcalloc(nr, sizeof(*threads));
+	pthread_mutex_init(&rename_mutex, NULL);
+	rename_use_threads = 1;
+	for (i = 0; i < nr; i++) {
+		int err = pthread_create(&threads[i], NULL,
+					 fill_rename_matrix, rm);
+		if (err)
+			die("rename detection: unable to create thread: %s",
+			    strerror(err));
+	}
+	for (i = 0; i < nr; i++)
+		pthread_join(threads[i], NULL);
+	rename_use_threads = 0;
+	pthread_mutex_destroy(&rename_mutex);
+	free(threads);
+}
+#endif
+
+static void fill_rename_matrix_threaded(struct diff_options *options,
+					struct rename_matrix *rm)
+{
+#ifndef NO_PTHREADS
+	int nr = rename_thread_count(options, rm->nr_rows, rm->nr_cols);
+
+	if (1 < nr) {
+		run_rename_threads(rm, nr);
+		return;
+	}
+#endif
+	fill_rename_matrix(rm);
+}
+
 /*
  * Returns:
  * 0 if we are under the limit;
  * 1 if we need to disable inexact rename detection;
  * 2 if we would be under the limit if we were given -C instead of -C -C.
  */
-static int too_many_rename_candidates(int num_create,
+static int too_many_rename_candidates(int num_create, int num_src,
 				      struct diff_options *options)
 {
 	int rename_limit = options->rename_limit;
-	int num_src = rename_src_nr;
 	int i;
 
 	options->needed_rename_limit = 0;
@@ -496,10 +916,9 @@ void diffcore_rename(struct diff_options *options)
 	int minimum_score = options->rename_score;
 	struct diff_queue_struct *q = &diff_queued_diff;
 	struct diff_queue_struct outq;
-	struct diff_score *mx;
-	int i, j, rename_count, skip_unmodified = 0;
-	int num_create, dst_cnt;
-	struct progress *progress = NULL;
+	struct rename_matrix rm;
+	int i, rename_count, skip_unmodified = 0;
+	int num_create, num_src;
 
 	if (!minimum_score)
 		minimum_score = DEFAULT_RENAME_SCORE;
@@ -550,16 +969,28 @@ void diffcore_rename(struct diff_options *options)
 		goto cleanup;
 
 	/*
-	 * Calculate how many renames are left (but all the source
-	 * files still remain as options for rename/copies!)
+	 * Pair what the names give away before comparing every source
+	 * with every destination.  The sources used up that way are no
+	 * longer candidates for renames, but when detecting copies all
+	 * the source files remain as options.
 	 */
+	if (detect_rename != DIFF_DETECT_COPY) {
+		rename_count += find_basename_renames(minimum_score);
+		rename_count += find_directory_renames(minimum_score);
+		for (num_src = i = 0; i < rename_src_nr; i++)
+			if (!rename_src[i].p->one->rename_used)
+				num_src++;
+	} else
+		num_src = rename_src_nr;
+
+	/* Calculate how many renames are left */
 	num_create = (rename_dst_nr - rename_count);
 
 	/* All done? */
-	if (!num_create)
+	if (!num_create || !num_src)
 		goto cleanup;
 
-	switch (too_many_rename_candidates(num_create, options)) {
+	switch (too_many_rename_candidates(num_create, num_src, options)) {
 	case 1:
 		goto cleanup;
 	case 2:
@@ -570,59 +1001,39 @@ void diffcore_rename(struct diff_options *options)
 		break;
 	}
 
+	memset(&rm, 0, sizeof(rm));
+	rm.minimum_score = minimum_score;
+	rm.skip_unmodified = skip_unmodified;
+	rm.skip_used = detect_rename != DIFF_DETECT_COPY;
+	rm.nr_cols = num_src;
+	rm.row_dst = xmalloc(num_create * sizeof(*rm.row_dst));
+	for (i = 0; i < rename_dst_nr; i++)
+		if (!rename_dst[i].pair) /* not dealt with as exact match */
+			rm.row_dst[rm.nr_rows++] = i;
+	rm.mx = xcalloc(rm.nr_rows * NUM_CANDIDATE_PER_DST, sizeof(*rm.mx));
+
 	if (options->show_rename_progress) {
-		progress = start_progress_delay(
+		rm.progress = start_progress_delay(
 				"Performing inexact rename detection",
-				rename_dst_nr * rename_src_nr, 50, 1);
+				rm.nr_rows * rm.nr_cols, 50, 1);
 	}
-
-	mx = xcalloc(num_create * NUM_CANDIDATE_PER_DST, sizeof(*mx));
-	for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
-		struct diff_filespec *two = rename_dst[i].two;
-		struct diff_score *m;
-
-		if (rename_dst[i].pair)
-			continue; /* dealt with exact match already. */
-
-		m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
-		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
-			m[j].dst = -1;
-
-		for (j = 0; j < rename_src_nr; j++) {
-			struct diff_filespec *one = rename_src[j].p->one;
-			struct diff_score this_src;
-
-			if (skip_unmodified &&
-			    diff_unmodified_pair(rename_src[j].p))
-				continue;
-
-			this_src.score = estimate_similarity(one, two,
-							     minimum_score);
-			this_src.name_score = basename_same(one, two);
-			this_src.dst = i;
-			this_src.src = j;
-			record_if_better(m, &this_src);
-			/*
-			 * Once we run estimate_similarity,
-			 * We do not need the text anymore.
-			 */
-			diff_free_filespec_blob(one);
-			diff_free_filespec_blob(two);
-		}
-		dst_cnt++;
-		display_progress(progress, (i+1)*rename_src_nr);
-	}
-	stop_progress(&progress);
+	fill_rename_matrix_threaded(options, &rm);
+	stop_progress(&rm.progress);
 
 	/* cost matrix sorted by most to least similar pair */
-	qsort(mx, dst_cnt * NUM_CANDIDATE_PER_DST, sizeof(*mx), score_compare);
+	qsort(rm.mx, rm.nr_rows * NUM_CANDIDATE_PER_DST, sizeof(*rm.mx),
+	      score_compare);
 
-	rename_count += find_renames(mx, dst_cnt, minimum_score, 0);
+	rename_count += find_renames(rm.mx, rm.nr_rows, minimum_score, 0);
 	if (detect_rename == DIFF_DETECT_COPY)
-		rename_count += find_renames(mx, dst_cnt, minimum_score, 1);
-	free(mx);
+		rename_count += find_renames(rm.mx, rm.nr_rows,
+					     minimum_score, 1);
+	free(rm.mx);
+	free(rm.row_dst);
 
  cleanup:
+	diffcore_count_cache_write();
+
 	/* At this point, we have found some renames and copies and they
 	 * are recorded in rename_dst.  The original list is still in *q.
 	 */
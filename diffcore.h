@@ -59,6 +59,7 @@ extern void fill_filespec(struct diff_filespec *, const unsigned char *,
 extern int diff_populate_filespec(struct diff_filespec *, int);
 extern void diff_free_filespec_data(struct diff_filespec *);
 extern void diff_free_filespec_blob(struct diff_filespec *);
+extern void diff_filespec_load_driver(struct diff_filespec *);
 extern int diff_filespec_is_binary(struct diff_filespec *);
 
 struct diff_filepair {
@@ -121,6 +122,25 @@ void diff_debug_queue(const char *, struct diff_queue_struct *);
 #define diff_debug_queue(a,b) do { /* nothing */ } while (0)
 #endif
 
+/* Keep the data for diffcore_count_changes() in refs/notes/similarity? */
+extern int diff_rename_cache;
+
+/*
+ * Compute the data that diffcore_count_changes() keeps in "*src_count_p"
+ * and "*dst_count_p" for the populated filespec "one", and remember it
+ * if diff_rename_cache is set.
+ */
+extern void *diffcore_count_prepare(struct diff_filespec *one);
+
+/*
+ * Look up what diffcore_count_prepare() remembered for the blob of
+ * "one", which need not be populated.  Returns NULL if there is none.
+ */
+extern void *diffcore_count_cached(struct diff_filespec *one);
+
+/* Save what diffcore_count_prepare() remembered */
+extern void diffcore_count_cache_write(void);
+
 extern int diffcore_count_changes(struct diff_filespec *src,
 				  struct diff_filespec *dst,
 				  void **src_count_p,
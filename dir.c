@@ -8,6 +8,7 @@
 #include "cache.h"
 #include "dir.h"
 #include "refs.h"
+#include "varint.h"
 
 struct path_simplify {
 	int len;
@@ -15,7 +16,8 @@ struct path_simplify {
 };
 
 static int read_directory_recursive(struct dir_struct *dir, const char *path, int len,
-	int check_only, const struct path_simplify *simplify);
+	int check_only, const struct path_simplify *simplify,
+	struct untracked_cache_dir *untracked);
 static int get_dtype(struct dirent *de, const char *path, int len);
 
 /* helper string functions with support for the ignore_case flag */
@@ -437,6 +439,7 @@ int add_excludes_from_file_to_list(const char *fname,
 
 void add_excludes_from_file(struct dir_struct *dir, const char *fname)
 {
+	dir->standard_excludes = 0;
 	if (add_excludes_from_file_to_list(fname, "", 0, NULL,
 					   &dir->exclude_list[EXC_FILE], 0) < 0)
 		die("cannot use %s as an exclude file", fname);
@@ -609,6 +612,173 @@ struct dir_entry *dir_add_ignored(struct dir_struct *dir, const char *pathname,
 	return dir->ignored[dir->ignored_nr++] = dir_entry_new(pathname, len);
 }
 
+static struct untracked_cache_dir *new_untracked_dir(const char *name, int len)
+{
+	struct untracked_cache_dir *d = xcalloc(1, sizeof(*d) + len + 1);
+
+	memcpy(d->name, name, len);
+	d->name[len] = '\0';
+	return d;
+}
+
+static void clear_untracked_names(struct untracked_cache_dir *d)
+{
+	unsigned int i;
+
+	for (i = 0; i < d->untracked_nr; i++)
+		free(d->untracked[i]);
+	d->untracked_nr = 0;
+}
+
+static void free_untracked_dir(struct untracked_cache_dir *d)
+{
+	unsigned int i;
+
+	if (!d)
+		return;
+	for (i = 0; i < d->dirs_nr; i++)
+		free_untracked_dir(d->dirs[i]);
+	clear_untracked_names(d);
+	free(d->untracked);
+	free(d->dirs);
+	free(d);
+}
+
+static void drop_untracked_subdirs(struct untracked_cache_dir *d)
+{
+	unsigned int i;
+
+	for (i = 0; i < d->dirs_nr; i++)
+		free_untracked_dir(d->dirs[i]);
+	d->dirs_nr = 0;
+}
+
+static int untracked_dir_pos(struct untracked_cache_dir *d,
+			     const char *name, int len)
+{
+	int lo = 0, hi = d->dirs_nr;
+
+	while (lo < hi) {
+		int mi = (lo + hi) / 2;
+		const char *other = d->dirs[mi]->name;
+		int cmp = strncmp(name, other, len);
+
+		if (!cmp)
+			cmp = other[len] ? -1 : 0;
+		if (!cmp)
+			return mi;
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return -lo - 1;
+}
+
+/*
+ * Find (or create) the entry for the subdirectory "path" of the
+ * directory "d" in the untracked cache; "path" is the full path of the
+ * subdirectory with a trailing slash.
+ */
+static struct untracked_cache_dir *lookup_untracked(struct untracked_cache_dir *d,
+						    const char *path, int len)
+{
+	const char *name;
+	int pos;
+
+	if (!d)
+		return NULL;
+	len--;
+	name = path + len;
+	while (name > path && name[-1] != '/')
+		name--;
+	len -= name - path;
+	pos = untracked_dir_pos(d, name, len);
+	if (pos < 0) {
+		pos = -pos - 1;
+		ALLOC_GROW(d->dirs, d->dirs_nr + 1, d->dirs_alloc);
+		memmove(d->dirs + pos + 1, d->dirs + pos,
+			(d->dirs_nr - pos) * sizeof(*d->dirs));
+		d->dirs[pos] = new_untracked_dir(name, len);
+		d->dirs_nr++;
+	}
+	d->dirs[pos]->visited = 1;
+	return d->dirs[pos];
+}
+
+/*
+ * Fill "us" with the stat data of "path", all zero if there is no
+ * such file.  Returns 1 if the file was modified so recently that
+ * another modification within the same second could go unnoticed.
+ */
+static int stat_untracked(const char *path, struct untracked_stat *us,
+			  time_t now)
+{
+	struct stat st;
+
+	memset(us, 0, sizeof(*us));
+	if (lstat(path, &st))
+		return 0;
+	if (trust_ctime) {
+		us->ctime_sec = (unsigned int)st.st_ctime;
+#ifdef USE_NSEC
+		us->ctime_nsec = ST_CTIME_NSEC(st);
+#endif
+	}
+	us->mtime_sec = (unsigned int)st.st_mtime;
+#ifdef USE_NSEC
+	us->mtime_nsec = ST_MTIME_NSEC(st);
+#endif
+	us->ino = (unsigned int)st.st_ino;
+	us->size = (unsigned int)st.st_size;
+	return now <= st.st_mtime;
+}
+
+/*
+ * Did the directory "path" (with a trailing slash, or empty for the
+ * top level) change since it was scanned into "d"?  The directory and
+ * its ignore file have to be the same, and so do the untracked
+ * directories that were looked into to see if they are empty.
+ */
+static int untracked_dir_changed(struct dir_struct *dir,
+				 struct untracked_cache_dir *d,
+				 struct strbuf *path, int check_only)
+{
+	struct untracked_stat us;
+	size_t len = path->len;
+	unsigned int i;
+
+	if (!d->valid || d->check_only != check_only)
+		return 1;
+	stat_untracked(len ? path->buf : ".", &us, 0);
+	if (memcmp(&us, &d->stat_data, sizeof(us)))
+		return 1;
+	strbuf_addstr(path, dir->exclude_per_dir);
+	stat_untracked(path->buf, &us, 0);
+	strbuf_setlen(path, len);
+	if (memcmp(&us, &d->exclude_stat, sizeof(us)))
+		return 1;
+	for (i = 0; i < d->dirs_nr; i++) {
+		struct untracked_cache_dir *sub = d->dirs[i];
+		int changed;
+
+		if (!sub->check_only)
+			continue;
+		strbuf_addf(path, "%s/", sub->name);
+		changed = untracked_dir_changed(dir, sub, path, 1);
+		strbuf_setlen(path, len);
+		if (changed)
+			return 1;
+	}
+	return 0;
+}
+
+static void add_untracked_name(struct untracked_cache_dir *d, const char *name)
+{
+	ALLOC_GROW(d->untracked, d->untracked_nr + 1, d->untracked_alloc);
+	d->untracked[d->untracked_nr++] = xstrdup(name);
+}
+
 enum exist_status {
 	index_nonexistent = 0,
 	index_directory,
@@ -723,7 +893,8 @@ enum directory_treatment {
 
 static enum directory_treatment treat_directory(struct dir_struct *dir,
 	const char *dirname, int len,
-	const struct path_simplify *simplify)
+	const struct path_simplify *simplify,
+	struct untracked_cache_dir *untracked)
 {
 	/* The "len-1" is to strip the final '/' */
 	switch (directory_exists_in_index(dirname, len-1)) {
@@ -749,7 +920,8 @@ static enum directory_treatment treat_directory(struct dir_struct *dir,
 	/* This is the "show_other_directories" case */
 	if (!(dir->flags & DIR_HIDE_EMPTY_DIRECTORIES))
 		return show_directory;
-	if (!read_directory_recursive(dir, dirname, len, 1, simplify))
+	if (!read_directory_recursive(dir, dirname, len, 1, simplify,
+				      lookup_untracked(untracked, dirname, len)))
 		return ignore_directory;
 	return show_directory;
 }
@@ -875,7 +1047,8 @@ enum path_treatment {
 static enum path_treatment treat_one_path(struct dir_struct *dir,
 					  char *path, int *len,
 					  const struct path_simplify *simplify,
-					  int dtype, struct dirent *de)
+					  int dtype, struct dirent *de,
+					  struct untracked_cache_dir *untracked)
 {
 	int exclude = excluded(dir, path, &dtype);
 	if (exclude && (dir->flags & DIR_COLLECT_IGNORED)
@@ -909,7 +1082,7 @@ static enum path_treatment treat_one_path(struct dir_struct *dir,
 	case DT_DIR:
 		memcpy(path + *len, "/", 2);
 		(*len)++;
-		switch (treat_directory(dir, path, *len, simplify)) {
+		switch (treat_directory(dir, path, *len, simplify, untracked)) {
 		case show_directory:
 			if (exclude != !!(dir->flags
 					  & DIR_SHOW_IGNORED))
@@ -933,7 +1106,8 @@ static enum path_treatment treat_path(struct dir_struct *dir,
 				      char *path, int path_max,
 				      int baselen,
 				      const struct path_simplify *simplify,
-				      int *len)
+				      int *len,
+				      struct untracked_cache_dir *untracked)
 {
 	int dtype;
 
@@ -949,7 +1123,101 @@ static enum path_treatment treat_path(struct dir_struct *dir,
 		return path_ignored;
 
 	dtype = DTYPE(de);
-	return treat_one_path(dir, path, len, simplify, dtype, de);
+	return treat_one_path(dir, path, len, simplify, dtype, de, untracked);
+}
+
+/*
+ * Add the untracked paths the untracked cache remembers for the
+ * directory "base", which did not change since it was scanned, and
+ * read the subdirectories that were recursed into.
+ */
+static int read_cached_directory(struct dir_struct *dir,
+				 const char *base, int baselen,
+				 const struct path_simplify *simplify,
+				 struct untracked_cache_dir *untracked)
+{
+	int contents = untracked->contents;
+	char path[PATH_MAX + 1];
+	unsigned int i;
+
+	the_index.untracked->dir_cached++;
+	if (untracked->check_only)
+		return contents;
+
+	memcpy(path, base, baselen);
+	for (i = 0; i < untracked->untracked_nr; i++) {
+		int len = strlen(untracked->untracked[i]);
+
+		if (baselen + len > PATH_MAX)
+			continue;
+		memcpy(path + baselen, untracked->untracked[i], len + 1);
+		dir_add_name(dir, path, baselen + len);
+	}
+	for (i = 0; i < untracked->dirs_nr; i++) {
+		struct untracked_cache_dir *sub = untracked->dirs[i];
+		int len = strlen(sub->name);
+
+		if (sub->check_only || baselen + len + 1 > PATH_MAX)
+			continue;
+		memcpy(path + baselen, sub->name, len);
+		memcpy(path + baselen + len, "/", 2);
+		contents += read_directory_recursive(dir, path, baselen + len + 1,
+						     0, simplify, sub);
+	}
+	return contents;
+}
+
+/*
+ * Get ready to scan the directory "base" into "untracked", forgetting
+ * what was found the last time.  Returns 1 if the directory and the
+ * ignore file were modified too recently for the result of the scan
+ * to be trusted later.
+ */
+static int prepare_untracked_scan(struct dir_struct *dir,
+				  const char *base, int baselen,
+				  struct untracked_cache_dir *untracked)
+{
+	struct untracked_cache *uc = the_index.untracked;
+	struct strbuf path = STRBUF_INIT;
+	struct untracked_stat exclude_stat;
+	unsigned int i;
+	int racy;
+
+	racy = stat_untracked(baselen ? base : ".", &untracked->stat_data,
+			      uc->scan_time);
+	strbuf_add(&path, base, baselen);
+	strbuf_addstr(&path, dir->exclude_per_dir);
+	racy |= stat_untracked(path.buf, &exclude_stat, uc->scan_time);
+	strbuf_release(&path);
+
+	/* everything below depends on the patterns of the ignore file */
+	if (memcmp(&exclude_stat, &untracked->exclude_stat, sizeof(exclude_stat)))
+		drop_untracked_subdirs(untracked);
+	untracked->exclude_stat = exclude_stat;
+	clear_untracked_names(untracked);
+	for (i = 0; i < untracked->dirs_nr; i++)
+		untracked->dirs[i]->visited = 0;
+	uc->dir_opened++;
+	the_index.cache_changed = 1;
+	return racy;
+}
+
+/* Forget the subdirectories the last scan did not look at */
+static void finish_untracked_scan(struct untracked_cache_dir *untracked,
+				  int check_only, int contents, int racy)
+{
+	unsigned int i, j;
+
+	for (i = j = 0; i < untracked->dirs_nr; i++) {
+		if (untracked->dirs[i]->visited)
+			untracked->dirs[j++] = untracked->dirs[i];
+		else
+			free_untracked_dir(untracked->dirs[i]);
+	}
+	untracked->dirs_nr = j;
+	untracked->contents = contents;
+	untracked->check_only = check_only;
+	untracked->valid = !racy;
 }
 
 /*
@@ -960,28 +1228,50 @@ static enum path_treatment treat_path(struct dir_struct *dir,
  *
  * Also, we ignore the name ".git" (even if it is not a directory).
  * That likely will not change.
+ *
+ * With "untracked", the result is taken from the untracked cache if
+ * the directory did not change, and recorded there otherwise.
  */
 static int read_directory_recursive(struct dir_struct *dir,
 				    const char *base, int baselen,
 				    int check_only,
-				    const struct path_simplify *simplify)
+				    const struct path_simplify *simplify,
+				    struct untracked_cache_dir *untracked)
 {
-	DIR *fdir = opendir(*base ? base : ".");
-	int contents = 0;
+	DIR *fdir;
+	int contents = 0, own_contents = 0, racy = 0;
 	struct dirent *de;
 	char path[PATH_MAX + 1];
 
-	if (!fdir)
+	if (untracked) {
+		struct strbuf sb = STRBUF_INIT;
+		int changed;
+
+		strbuf_add(&sb, base, baselen);
+		changed = untracked_dir_changed(dir, untracked, &sb, check_only);
+		strbuf_release(&sb);
+		if (!changed)
+			return read_cached_directory(dir, base, baselen,
+						     simplify, untracked);
+		racy = prepare_untracked_scan(dir, base, baselen, untracked);
+	}
+
+	fdir = opendir(*base ? base : ".");
+	if (!fdir) {
+		if (untracked)
+			finish_untracked_scan(untracked, check_only, 0, 1);
 		return 0;
+	}
 
 	memcpy(path, base, baselen);
 
 	while ((de = readdir(fdir)) != NULL) {
 		int len;
 		switch (treat_path(dir, de, path, sizeof(path),
-				   baselen, simplify, &len)) {
+				   baselen, simplify, &len, untracked)) {
 		case path_recurse:
-			contents += read_directory_recursive(dir, path, len, 0, simplify);
+			contents += read_directory_recursive(dir, path, len, 0, simplify,
+							     lookup_untracked(untracked, path, len));
 			continue;
 		case path_ignored:
 			continue;
@@ -989,13 +1279,16 @@ static int read_directory_recursive(struct dir_struct *dir,
 			break;
 		}
 		contents++;
+		own_contents++;
 		if (check_only)
 			goto exit_early;
-		else
-			dir_add_name(dir, path, len);
+		else if (dir_add_name(dir, path, len) && untracked)
+			add_untracked_name(untracked, path + baselen);
 	}
 exit_early:
 	closedir(fdir);
+	if (untracked)
+		finish_untracked_scan(untracked, check_only, own_contents, racy);
 
 	return contents;
 }
@@ -1082,24 +1375,87 @@ static int treat_leading_path(struct dir_struct *dir,
 			return 0;
 		blen = baselen;
 		if (treat_one_path(dir, pathbuf, &blen, simplify,
-				   DT_DIR, NULL) == path_ignored)
+				   DT_DIR, NULL, NULL) == path_ignored)
 			return 0; /* do not recurse into it */
 		if (len <= baselen)
 			return 1; /* finished checking */
 	}
 }
 
+/*
+ * Return the top of the untracked cache if it can be used for this
+ * traversal, after throwing away what it knows if the exclude files
+ * that apply everywhere changed.  The cache only remembers what
+ * "git status" asks about: untracked files and directories with
+ * the standard excludes, from the top of the work tree.
+ */
+static struct untracked_cache_dir *validate_untracked_cache(struct dir_struct *dir,
+							     int len,
+							     const struct path_simplify *simplify)
+{
+	struct untracked_cache *uc = the_index.untracked;
+	struct untracked_stat info_exclude_stat, excludes_file_stat;
+	const char *work_tree = get_git_work_tree();
+	const char *excludes = excludes_file ? excludes_file : "";
+	time_t now = time(NULL);
+
+	if (!uc || len || simplify || !dir->standard_excludes || !work_tree)
+		return NULL;
+	if (dir->flags != (DIR_SHOW_OTHER_DIRECTORIES | DIR_HIDE_EMPTY_DIRECTORIES))
+		return NULL;
+	if (strcmp(dir->exclude_per_dir, ".gitignore") ||
+	    dir->exclude_list[EXC_CMDL].nr)
+		return NULL;
+	if (stat_untracked(git_path("info/exclude"), &info_exclude_stat, now) |
+	    stat_untracked(excludes, &excludes_file_stat, now))
+		return NULL;
+
+	if (!uc->root ||
+	    uc->dir_flags != dir->flags ||
+	    strcmp(uc->work_tree, work_tree) ||
+	    strcmp(uc->excludes_file, excludes) ||
+	    memcmp(&uc->info_exclude_stat, &info_exclude_stat,
+		   sizeof(info_exclude_stat)) ||
+	    memcmp(&uc->excludes_file_stat, &excludes_file_stat,
+		   sizeof(excludes_file_stat))) {
+		free_untracked_dir(uc->root);
+		uc->root = new_untracked_dir("", 0);
+		free(uc->work_tree);
+		uc->work_tree = xstrdup(work_tree);
+		free(uc->excludes_file);
+		uc->excludes_file = xstrdup(excludes);
+		uc->info_exclude_stat = info_exclude_stat;
+		uc->excludes_file_stat = excludes_file_stat;
+		uc->dir_flags = dir->flags;
+		the_index.cache_changed = 1;
+	}
+	uc->scan_time = now;
+	uc->dir_opened = uc->dir_cached = 0;
+	return uc->root;
+}
+
 int read_directory(struct dir_struct *dir, const char *path, int len, const char **pathspec)
 {
 	struct path_simplify *simplify;
+	struct untracked_cache_dir *untracked;
 
 	if (has_symlink_leading_path(path, len))
 		return dir->nr;
 
 	simplify = create_simplify(pathspec);
+	untracked = validate_untracked_cache(dir, len, simplify);
 	if (!len || treat_leading_path(dir, path, len, simplify))
-		read_directory_recursive(dir, path, len, 0, simplify);
+		read_directory_recursive(dir, path, len, 0, simplify, untracked);
 	free_simplify(simplify);
+	if (untracked && trace_want("GIT_TRACE_UNTRACKED_STATS")) {
+		struct strbuf sb = STRBUF_INIT;
+
+		strbuf_addf(&sb, "untracked cache: %d directories read, %d cached\n",
+			    the_index.untracked->dir_opened,
+			    the_index.untracked->dir_cached);
+		trace_strbuf("GIT_TRACE_UNTRACKED_STATS", &sb);
+		strbuf_release(&sb);
+	}
 	qsort(dir->entries, dir->nr, sizeof(struct dir_entry *), cmp_name);
 	qsort(dir->ignored, dir->ignored_nr, sizeof(struct dir_entry *), cmp_name);
 	return dir->nr;
@@ -1222,6 +1578,7 @@ int remove_dir_recursively(struct strbuf *path, int flag)
 void setup_standard_excludes(struct dir_struct *dir)
 {
 	const char *path;
+	int only_standard = !dir->exclude_list[EXC_FILE].nr;
 
 	dir->exclude_per_dir = ".gitignore";
 	path = git_path("info/exclude");
@@ -1229,6 +1586,7 @@ void setup_standard_excludes(struct dir_struct *dir)
 		add_excludes_from_file(dir, path);
 	if (excludes_file && !access(excludes_file, R_OK))
 		add_excludes_from_file(dir, excludes_file);
+	dir->standard_excludes = only_standard;
 }
 
 int remove_path(const char *name)
@@ -1297,3 +1655,226 @@ void free_pathspec(struct pathspec *pathspec)
 	free(pathspec->items);
 	pathspec->items = NULL;
 }
+
+struct untracked_cache *new_untracked_cache(void)
+{
+	struct untracked_cache *uc = xcalloc(1, sizeof(*uc));
+
+	uc->work_tree = xstrdup("");
+	uc->excludes_file = xstrdup("");
+	return uc;
+}
+
+void free_untracked_cache(struct untracked_cache *uc)
+{
+	if (!uc)
+		return;
+	free_untracked_dir(uc->root);
+	free(uc->work_tree);
+	free(uc->excludes_file);
+	free(uc);
+}
+
+/*
+ * Index add and remove change what is untracked in the directory of
+ * the path, and whether its leading directories are shown as
+ * untracked or recursed into, so all of them have to be scanned again.
+ */
+void untracked_cache_invalidate_path(struct index_state *istate,
+				     const char *path)
+{
+	struct untracked_cache_dir *d;
+
+	if (!istate->untracked || !istate->untracked->root)
+		return;
+	d = istate->untracked->root;
+	for (;;) {
+		const char *slash = strchr(path, '/');
+		int pos;
+
+		d->valid = 0;
+		if (!slash)
+			break;
+		pos = untracked_dir_pos(d, path, slash - path);
+		if (pos < 0)
+			break;
+		d = d->dirs[pos];
+		path = slash + 1;
+	}
+}
+
+#define UNTRACKED_VALID 01
+#define UNTRACKED_CHECK_ONLY 02
+
+static void write_varint(struct strbuf *out, uintmax_t value)
+{
+	unsigned char buf[16];
+
+	strbuf_add(out, buf, encode_varint(value, buf));
+}
+
+static void write_untracked_stat(struct strbuf *out,
+				 const struct untracked_stat *us)
+{
+	uint32_t data[6];
+
+	data[0] = htonl(us->ctime_sec);
+	data[1] = htonl(us->ctime_nsec);
+	data[2] = htonl(us->mtime_sec);
+	data[3] = htonl(us->mtime_nsec);
+	data[4] = htonl(us->ino);
+	data[5] = htonl(us->size);
+	strbuf_add(out, data, sizeof(data));
+}
+
+static void write_untracked_dir(struct strbuf *out,
+				struct untracked_cache_dir *d)
+{
+	unsigned int i;
+
+	strbuf_add(out, d->name, strlen(d->name) + 1);
+	write_varint(out, (d->valid ? UNTRACKED_VALID : 0) |
+		     (d->check_only ? UNTRACKED_CHECK_ONLY : 0));
+	write_varint(out, d->contents);
+	write_varint(out, d->untracked_nr);
+	write_varint(out, d->dirs_nr);
+	write_untracked_stat(out, &d->stat_data);
+	write_untracked_stat(out, &d->exclude_stat);
+	for (i = 0; i < d->untracked_nr; i++)
+		strbuf_add(out, d->untracked[i], strlen(d->untracked[i]) + 1);
+	for (i = 0; i < d->dirs_nr; i++)
+		write_untracked_dir(out, d->dirs[i]);
+}
+
+void write_untracked_extension(struct strbuf *out, struct untracked_cache *uc)
+{
+	strbuf_add(out, uc->work_tree, strlen(uc->work_tree) + 1);
+	strbuf_add(out, uc->excludes_file, strlen(uc->excludes_file) + 1);
+	write_varint(out, uc->dir_flags);
+	write_untracked_stat(out, &uc->info_exclude_stat);
+	write_untracked_stat(out, &uc->excludes_file_stat);
+	if (uc->root)
+		write_untracked_dir(out, uc->root);
+}
+
+struct untracked_reader {
+	const unsigned char *data, *end;
+};
+
+static const char *read_untracked_string(struct untracked_reader *rd)
+{
+	const unsigned char *nul = memchr(rd->data, '\0', rd->end - rd->data);
+	const char *string = (const char *)rd->data;
+
+	if (!nul)
+		return NULL;
+	rd->data = nul + 1;
+	return string;
+}
+
+static int read_untracked_varint(struct untracked_reader *rd, unsigned int *value)
+{
+	const unsigned char *p = rd->data;
+
+	while (p < rd->end && (*p & 128))
+		p++;
+	if (p >= rd->end)
+		return -1;
+	*value = decode_varint(&rd->data);
+	return 0;
+}
+
+static int read_untracked_stat(struct untracked_reader *rd,
+			       struct untracked_stat *us)
+{
+	uint32_t data[6];
+
+	if (rd->end - rd->data < sizeof(data))
+		return -1;
+	memcpy(data, rd->data, sizeof(data));
+	rd->data += sizeof(data);
+	us->ctime_sec = ntohl(data[0]);
+	us->ctime_nsec = ntohl(data[1]);
+	us->mtime_sec = ntohl(data[2]);
+	us->mtime_nsec = ntohl(data[3]);
+	us->ino = ntohl(data[4]);
+	us->size = ntohl(data[5]);
+	return 0;
+}
+
+static struct untracked_cache_dir *read_untracked_dir(struct untracked_reader *rd)
+{
+	struct untracked_cache_dir *d;
+	const char *name = read_untracked_string(rd);
+	unsigned int flags, contents, untracked_nr, dirs_nr, i;
+
+	if (!name ||
+	    read_untracked_varint(rd, &flags) ||
+	    read_untracked_varint(rd, &contents) ||
+	    read_untracked_varint(rd, &untracked_nr) ||
+	    read_untracked_varint(rd, &dirs_nr) ||
+	    /* every name takes at least one byte */
+	    untracked_nr > rd->end - rd->data ||
+	    dirs_nr > rd->end - rd->data)
+		return NULL;
+	d = new_untracked_dir(name, strlen(name));
+	d->valid = !!(flags & UNTRACKED_VALID);
+	d->check_only = !!(flags & UNTRACKED_CHECK_ONLY);
+	d->visited = 1;
+	d->contents = contents;
+	if (read_untracked_stat(rd, &d->stat_data) ||
+	    read_untracked_stat(rd, &d->exclude_stat))
+		goto corrupt;
+	d->untracked_alloc = untracked_nr;
+	d->untracked = xmalloc(untracked_nr * sizeof(*d->untracked));
+	for (i = 0; i < untracked_nr; i++) {
+		const char *untracked = read_untracked_string(rd);
+		if (!untracked)
+			goto corrupt;
+		d->untracked[d->untracked_nr++] = xstrdup(untracked);
+	}
+	d->dirs_alloc = dirs_nr;
+	d->dirs = xmalloc(dirs_nr * sizeof(*d->dirs));
+	for (i = 0; i < dirs_nr; i++) {
+		struct untracked_cache_dir *sub = read_untracked_dir(rd);
+		if (!sub)
+			goto corrupt;
+		d->dirs[d->dirs_nr++] = sub;
+	}
+	return d;
+
+corrupt:
+	free_untracked_dir(d);
+	return NULL;
+}
+
+struct untracked_cache *read_untracked_extension(const void *data, unsigned long sz)
+{
+	struct untracked_cache *uc;
+	struct untracked_reader rd;
+	const char *work_tree, *excludes;
+
+	rd.data = data;
+	rd.end = rd.data + sz;
+	work_tree = read_untracked_string(&rd);
+	excludes = work_tree ? read_untracked_string(&rd) : NULL;
+	if (!excludes)
+		return NULL;
+	uc = xcalloc(1, sizeof(*uc));
+	uc->work_tree = xstrdup(work_tree);
+	uc->excludes_file = xstrdup(excludes);
+	if (read_untracked_varint(&rd, &uc->dir_flags) ||
+	    read_untracked_stat(&rd, &uc->info_exclude_stat) ||
+	    read_untracked_stat(&rd, &uc->excludes_file_stat))
+		goto corrupt;
+	if (rd.data < rd.end) {
+		uc->root = read_untracked_dir(&rd);
+		if (!uc->root || rd.data != rd.end)
+			goto corrupt;
+	}
+	return uc;
+
+corrupt:
+	free_untracked_cache(uc);
+	return NULL;
+}
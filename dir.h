@@ -24,6 +24,52 @@ struct exclude_list {
 	} **excludes;
 };
 
+/*
+ * The untracked cache remembers, for each directory "git status" had
+ * to read, what it found there, so that the next run can skip the
+ * directories that did not change.  It is kept in the index (see
+ * Documentation/technical/index-format.txt).
+ *
+ * The parts of stat data a directory or an ignore file is checked
+ * against; a file that does not exist has all of them zero.
+ */
+struct untracked_stat {
+	unsigned int ctime_sec, ctime_nsec;
+	unsigned int mtime_sec, mtime_nsec;
+	unsigned int ino, size;
+};
+
+struct untracked_cache_dir {
+	struct untracked_cache_dir **dirs;
+	char **untracked;
+	unsigned int untracked_nr, untracked_alloc;
+	unsigned int dirs_nr, dirs_alloc;
+	/* paths that count as contents of this directory itself */
+	unsigned int contents;
+	struct untracked_stat stat_data;
+	struct untracked_stat exclude_stat;
+	/* the cached data is usable if the stat data still matches */
+	unsigned valid : 1;
+	/* only looked into to see if it has untracked contents at all */
+	unsigned check_only : 1;
+	/* seen by the last scan of the parent */
+	unsigned visited : 1;
+	char name[FLEX_ARRAY];
+};
+
+struct untracked_cache {
+	/* the work tree and the exclude files the cache is valid for */
+	char *work_tree;
+	char *excludes_file;
+	struct untracked_stat info_exclude_stat;
+	struct untracked_stat excludes_file_stat;
+	unsigned int dir_flags;
+	struct untracked_cache_dir *root;
+	/* only valid during read_directory() */
+	time_t scan_time;
+	int dir_opened, dir_cached;
+};
+
 struct exclude_stack {
 	struct exclude_stack *prev;
 	char *filebuf;
@@ -59,6 +105,9 @@ struct dir_struct {
 
 	struct exclude_stack *exclude_stack;
 	char basebuf[PATH_MAX];
+
+	/* set by setup_standard_excludes() */
+	unsigned standard_excludes : 1;
 };
 
 #define MATCHED_RECURSIVELY 1
@@ -100,6 +149,12 @@ extern int is_empty_dir(const char *dir);
 
 extern void setup_standard_excludes(struct dir_struct *dir);
 
+extern struct untracked_cache *new_untracked_cache(void);
+extern void free_untracked_cache(struct untracked_cache *);
+extern struct untracked_cache *read_untracked_extension(const void *data, unsigned long sz);
+extern void write_untracked_extension(struct strbuf *out, struct untracked_cache *);
+extern void untracked_cache_invalidate_path(struct index_state *, const char *);
+
 #define REMOVE_DIR_EMPTY_ONLY 01
 #define REMOVE_DIR_KEEP_NESTED_GIT 02
 extern int remove_dir_recursively(struct strbuf *path, int flag);
@@ -67,6 +67,18 @@ unsigned long pack_size_limit_cfg;
 /* Parallel index stat data preload? */
 int core_preload_index = 0;
 
+/* Use the commit-graph file to parse commits? */
+int core_commit_graph = 1;
+
+/* Look objects up in the multi-pack index first? */
+int core_multi_pack_index = 1;
+
+/* Let grep skip blobs with the help of the grep-index file? */
+int core_grep_index = 1;
+
+/* Hook that reports the paths changed in the work tree */
+const char *core_fsmonitor;
+
 /* This is set by setup_git_dir_gently() and/or git_default_config() */
 char *git_work_tree_cfg;
 static char *work_tree;
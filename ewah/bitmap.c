@@ -0,0 +1,117 @@
+#include "cache.h"
+#include "ewok.h"
+
+#define EWORD_ONE ((eword_t)1)
+#define BLOCK(pos) ((pos) / BITS_IN_EWORD)
+#define MASK(pos) (EWORD_ONE << ((pos) % BITS_IN_EWORD))
+
+struct bitmap *bitmap_new(void)
+{
+	struct bitmap *self = xcalloc(1, sizeof(*self));
+	self->word_alloc = 32;
+	self->words = xcalloc(self->word_alloc, sizeof(eword_t));
+	return self;
+}
+
+void bitmap_free(struct bitmap *self)
+{
+	if (!self)
+		return;
+	free(self->words);
+	free(self);
+}
+
+static void bitmap_grow(struct bitmap *self, size_t words)
+{
+	size_t old = self->word_alloc;
+
+	if (words <= old)
+		return;
+	self->word_alloc = alloc_nr(old) > words ? alloc_nr(old) : words;
+	self->words = xrealloc(self->words, self->word_alloc * sizeof(eword_t));
+	memset(self->words + old, 0, (self->word_alloc - old) * sizeof(eword_t));
+}
+
+void bitmap_set(struct bitmap *self, size_t pos)
+{
+	bitmap_grow(self, BLOCK(pos) + 1);
+	self->words[BLOCK(pos)] |= MASK(pos);
+}
+
+int bitmap_get(const struct bitmap *self, size_t pos)
+{
+	size_t block = BLOCK(pos);
+	return block < self->word_alloc && (self->words[block] & MASK(pos));
+}
+
+void bitmap_or(struct bitmap *self, const struct bitmap *other)
+{
+	size_t i;
+
+	bitmap_grow(self, other->word_alloc);
+	for (i = 0; i < other->word_alloc; i++)
+		self->words[i] |= other->words[i];
+}
+
+void bitmap_or_ewah(struct bitmap *self, const struct ewah_bitmap *other)
+{
+	size_t i = 0, pos = 0;
+
+	while (i < other->buffer_size) {
+		eword_t rlw = other->buffer[i++];
+		size_t running = (rlw >> 1) & 0xffffffff;
+		size_t literal = rlw >> 33;
+
+		if (rlw & 1) {
+			bitmap_grow(self, pos + running);
+			memset(self->words + pos, 0xff, running * sizeof(eword_t));
+		}
+		pos += running;
+
+		if (literal > other->buffer_size - i)
+			literal = other->buffer_size - i;
+		bitmap_grow(self, pos + literal);
+		while (literal--)
+			self->words[pos++] |= other->buffer[i++];
+	}
+}
+
+void bitmap_and_not(struct bitmap *self, const struct bitmap *other)
+{
+	size_t i, n = self->word_alloc < other->word_alloc ?
+		self->word_alloc : other->word_alloc;
+
+	for (i = 0; i < n; i++)
+		self->words[i] &= ~other->words[i];
+}
+
+static unsigned popcount_word(eword_t word)
+{
+	unsigned count = 0;
+	while (word) {
+		word &= word - 1;
+		count++;
+	}
+	return count;
+}
+
+size_t bitmap_popcount(const struct bitmap *self)
+{
+	size_t i, count = 0;
+
+	for (i = 0; i < self->word_alloc; i++)
+		count += popcount_word(self->words[i]);
+	return count;
+}
+
+struct ewah_bitmap *bitmap_to_ewah(const struct bitmap *self)
+{
+	struct ewah_bitmap *ewah = ewah_new();
+	size_t i, last = self->word_alloc;
+
+	while (last && !self->words[last - 1])
+		last--;
+	for (i = 0; i < last; i++)
+		ewah_add(ewah, self->words[i]);
+	return ewah;
+}
@@ -0,0 +1,156 @@
+#include "cache.h"
+#include "ewok.h"
+
+#define RLW_RUNNING_BITS 32
+#define RLW_LITERAL_BITS 31
+#define RLW_LARGEST_RUNNING_COUNT ((((eword_t)1) << RLW_RUNNING_BITS) - 1)
+#define RLW_LARGEST_LITERAL_COUNT ((((eword_t)1) << RLW_LITERAL_BITS) - 1)
+#define RLW_RUNNING_SHIFT 1
+#define RLW_LITERAL_SHIFT (1 + RLW_RUNNING_BITS)
+
+static inline int rlw_run_bit(eword_t rlw)
+{
+	return rlw & 1;
+}
+
+static inline eword_t rlw_running_len(eword_t rlw)
+{
+	return (rlw >> RLW_RUNNING_SHIFT) & RLW_LARGEST_RUNNING_COUNT;
+}
+
+static inline eword_t rlw_literal_words(eword_t rlw)
+{
+	return rlw >> RLW_LITERAL_SHIFT;
+}
+
+static inline eword_t rlw_make(int bit, eword_t running, eword_t literal)
+{
+	return (eword_t)bit |
+		(running << RLW_RUNNING_SHIFT) |
+		(literal << RLW_LITERAL_SHIFT);
+}
+
+static void buffer_push(struct ewah_bitmap *self, eword_t word)
+{
+	ALLOC_GROW(self->buffer, self->buffer_size + 1, self->alloc_size);
+	self->buffer[self->buffer_size++] = word;
+}
+
+struct ewah_bitmap *ewah_new(void)
+{
+	struct ewah_bitmap *self = xcalloc(1, sizeof(*self));
+	buffer_push(self, 0);
+	return self;
+}
+
+void ewah_free(struct ewah_bitmap *self)
+{
+	if (!self)
+		return;
+	free(self->buffer);
+	free(self);
+}
+
+void ewah_add(struct ewah_bitmap *self, eword_t word)
+{
+	eword_t rlw = self->buffer[self->rlw];
+	eword_t running = rlw_running_len(rlw);
+	eword_t literal = rlw_literal_words(rlw);
+
+	self->bit_size += BITS_IN_EWORD;
+
+	if (word == 0 || word == ~(eword_t)0) {
+		int bit = !!word;
+
+		/* Can we extend the run of the current RLW? */
+		if (!literal && running < RLW_LARGEST_RUNNING_COUNT &&
+		    (!running || rlw_run_bit(rlw) == bit)) {
+			self->buffer[self->rlw] = rlw_make(bit, running + 1, 0);
+			return;
+		}
+		self->rlw = self->buffer_size;
+		buffer_push(self, rlw_make(bit, 1, 0));
+		return;
+	}
+
+	if (literal == RLW_LARGEST_LITERAL_COUNT) {
+		self->rlw = self->buffer_size;
+		buffer_push(self, rlw_make(0, 0, 0));
+		rlw = 0;
+		running = literal = 0;
+	}
+	self->buffer[self->rlw] = rlw_make(rlw_run_bit(rlw), running, literal + 1);
+	buffer_push(self, word);
+}
+
+static void put_be64(struct strbuf *out, eword_t word)
+{
+	uint32_t half[2];
+
+	half[0] = htonl((uint32_t)(word >> 32));
+	half[1] = htonl((uint32_t)word);
+	strbuf_add(out, half, sizeof(half));
+}
+
+static eword_t get_be64(const unsigned char *p)
+{
+	return ((eword_t)ntohl(*(uint32_t *)p) << 32) |
+		ntohl(*(uint32_t *)(p + 4));
+}
+
+static void put_be32(struct strbuf *out, uint32_t value)
+{
+	value = htonl(value);
+	strbuf_add(out, &value, sizeof(value));
+}
+
+void ewah_serialize_strbuf(struct ewah_bitmap *self, struct strbuf *out)
+{
+	size_t i;
+
+	put_be32(out, self->bit_size);
+	put_be32(out, self->buffer_size);
+	for (i = 0; i < self->buffer_size; i++)
+		put_be64(out, self->buffer[i]);
+	put_be32(out, self->rlw);
+}
+
+ssize_t ewah_read_mmap(struct ewah_bitmap *self, const void *map, size_t len)
+{
+	const unsigned char *p = map;
+	size_t words, i, need;
+	uint64_t need_words;
+
+	if (len < 8)
+		return -1;
+	self->bit_size = ntohl(*(uint32_t *)p);
+	words = ntohl(*(uint32_t *)(p + 4));
+	p += 8;
+
+	need = 8 + words * 8 + 4;
+	if (!words || words > len / 8 || need > len)
+		return -1;
+
+	self->buffer_size = 0;
+	ALLOC_GROW(self->buffer, words, self->alloc_size);
+	for (i = 0; i < words; i++, p += 8)
+		self->buffer[i] = get_be64(p);
+	self->buffer_size = words;
+
+	self->rlw = ntohl(*(uint32_t *)p);
+	if (self->rlw >= words)
+		return -1;
+
+	/* Make sure the RLWs describe exactly bit_size bits. */
+	for (i = 0, need_words = 0; i < words; ) {
+		eword_t rlw = self->buffer[i++];
+		eword_t literal = rlw_literal_words(rlw);
+		if (literal > words - i)
+			return -1;
+		need_words += rlw_running_len(rlw) + literal;
+		i += literal;
+	}
+	if (need_words * BITS_IN_EWORD != self->bit_size)
+		return -1;
+	return need;
+}
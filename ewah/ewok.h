@@ -0,0 +1,67 @@
+#ifndef EWOK_H
+#define EWOK_H
+
+/*
+ * A small implementation of EWAH (Enhanced Word-Aligned Hybrid)
+ * compressed bitmaps, as used by the pack bitmap index, plus a plain
+ * uncompressed bitmap to do the actual set arithmetic on.
+ *
+ * An EWAH bitmap is a sequence of 64-bit words.  It starts with a
+ * "running length word" (RLW) which says that the next N words are
+ * all zeroes or all ones, followed by M literal words that are stored
+ * verbatim.  After the literal words comes the next RLW.  In a RLW,
+ * bit 0 is the value of the run, bits 1-32 are N and bits 33-63 are M.
+ */
+
+struct strbuf;
+
+typedef uint64_t eword_t;
+#define BITS_IN_EWORD (sizeof(eword_t) * 8)
+
+struct ewah_bitmap {
+	eword_t *buffer;
+	size_t buffer_size;
+	size_t alloc_size;
+	size_t bit_size;
+	size_t rlw; /* position of the last RLW in buffer */
+};
+
+struct ewah_bitmap *ewah_new(void);
+void ewah_free(struct ewah_bitmap *self);
+
+/*
+ * Append one uncompressed word covering the next BITS_IN_EWORD bits
+ * of the bitmap.
+ */
+void ewah_add(struct ewah_bitmap *self, eword_t word);
+
+/*
+ * On-disk representation, all in network byte order: the number of
+ * bits, the number of words, the words themselves and the position
+ * of the last RLW.
+ */
+void ewah_serialize_strbuf(struct ewah_bitmap *self, struct strbuf *out);
+
+/*
+ * Read a serialized bitmap of at most "len" bytes from "map".
+ * Returns the number of bytes used, or -1 if the data is corrupt.
+ */
+ssize_t ewah_read_mmap(struct ewah_bitmap *self, const void *map, size_t len);
+
+/* An uncompressed bitmap that grows as bits are set. */
+struct bitmap {
+	eword_t *words;
+	size_t word_alloc;
+};
+
+struct bitmap *bitmap_new(void);
+void bitmap_free(struct bitmap *self);
+void bitmap_set(struct bitmap *self, size_t pos);
+int bitmap_get(const struct bitmap *self, size_t pos);
+void bitmap_or(struct bitmap *self, const struct bitmap *other);
+void bitmap_or_ewah(struct bitmap *self, const struct ewah_bitmap *other);
+void bitmap_and_not(struct bitmap *self, const struct bitmap *other);
+size_t bitmap_popcount(const struct bitmap *self);
+struct ewah_bitmap *bitmap_to_ewah(const struct bitmap *self);
+
+#endif
@@ -0,0 +1,259 @@
+#include "cache.h"
+#include "fsmonitor.h"
+#include "run-command.h"
+#include "ewah/ewok.h"
+
+#define INDEX_EXTENSION_VERSION 1
+#define HOOK_INTERFACE_VERSION "1"
+
+int read_fsmonitor_extension(struct index_state *istate,
+			     const void *data_, unsigned long sz)
+{
+	const char *data = data_;
+	const char *token;
+	uint32_t version, nr;
+	ssize_t ret;
+
+	if (sz < sizeof(version) + 1)
+		return error("corrupt fsmonitor extension (too short)");
+	memcpy(&version, data, sizeof(version));
+	if (ntohl(version) != INDEX_EXTENSION_VERSION)
+		return error("bad fsmonitor extension version %u",
+			     ntohl(version));
+	data += sizeof(version);
+	sz -= sizeof(version);
+	token = data;
+	data = memchr(token, '\0', sz);
+	if (!data)
+		return error("corrupt fsmonitor extension (token)");
+	data++;
+	sz -= data - token;
+	if (sz < sizeof(nr))
+		return error("corrupt fsmonitor extension (too short)");
+	memcpy(&nr, data, sizeof(nr));
+	data += sizeof(nr);
+	sz -= sizeof(nr);
+
+	discard_fsmonitor(istate);
+	istate->fsmonitor_dirty = ewah_new();
+	ret = ewah_read_mmap(istate->fsmonitor_dirty, data, sz);
+	if (ret != sz) {
+		discard_fsmonitor(istate);
+		return error("corrupt fsmonitor extension (bitmap)");
+	}
+	istate->fsmonitor_dirty_nr = ntohl(nr);
+	istate->fsmonitor_last_update = xstrdup(token);
+	return 0;
+}
+
+void fill_fsmonitor_bitmap(struct index_state *istate)
+{
+	struct bitmap *dirty;
+	unsigned int i, nr;
+
+	if (istate->fsmonitor_dirty) {
+		ewah_free(istate->fsmonitor_dirty);
+		istate->fsmonitor_dirty = NULL;
+	}
+	if (!core_fsmonitor || !istate->fsmonitor_last_update)
+		return;
+
+	/* positions count the entries as they are written out */
+	dirty = bitmap_new();
+	for (i = nr = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+
+		if (ce->ce_flags & CE_REMOVE)
+			continue;
+		if (!(ce->ce_flags & CE_FSMONITOR_VALID))
+			bitmap_set(dirty, nr);
+		nr++;
+	}
+	istate->fsmonitor_dirty = bitmap_to_ewah(dirty);
+	istate->fsmonitor_dirty_nr = nr;
+	bitmap_free(dirty);
+}
+
+void write_fsmonitor_extension(struct strbuf *sb, struct index_state *istate)
+{
+	uint32_t version = htonl(INDEX_EXTENSION_VERSION);
+	uint32_t nr = htonl(istate->fsmonitor_dirty_nr);
+
+	strbuf_add(sb, &version, sizeof(version));
+	strbuf_add(sb, istate->fsmonitor_last_update,
+		   strlen(istate->fsmonitor_last_update) + 1);
+	strbuf_add(sb, &nr, sizeof(nr));
+	ewah_serialize_strbuf(istate->fsmonitor_dirty, sb);
+}
+
+void discard_fsmonitor(struct index_state *istate)
+{
+	if (istate->fsmonitor_dirty)
+		ewah_free(istate->fsmonitor_dirty);
+	istate->fsmonitor_dirty = NULL;
+	istate->fsmonitor_dirty_nr = 0;
+	free(istate->fsmonitor_last_update);
+	istate->fsmonitor_last_update = NULL;
+	istate->fsmonitor_has_run_once = 0;
+}
+
+static void invalidate_all(struct index_state *istate)
+{
+	unsigned int i;
+
+	for (i = 0; i < istate->cache_nr; i++)
+		istate->cache[i]->ce_flags &= ~CE_FSMONITOR_VALID;
+}
+
+/* The path, or everything below it if it is a directory, changed */
+static void invalidate_path(struct index_state *istate, const char *name)
+{
+	int len = strlen(name);
+	int pos;
+
+	while (len && name[len - 1] == '/')
+		len--;
+	if (!len) {
+		invalidate_all(istate);
+		return;
+	}
+	pos = index_name_pos(istate, name, len);
+	if (pos < 0)
+		pos = -pos - 1;
+	for (; pos < istate->cache_nr; pos++) {
+		struct cache_entry *ce = istate->cache[pos];
+
+		if (strncmp(ce->name, name, len))
+			break;
+		if (ce->name[len] == '\0' || ce->name[len] == '/')
+			ce->ce_flags &= ~CE_FSMONITOR_VALID;
+	}
+}
+
+/*
+ * Ask the hook what changed since the last token.  Returns the
+ * output of the hook, a new token followed by the changed paths, or
+ * -1 if it cannot be used.
+ */
+static int query_fsmonitor(const char *token, struct strbuf *out)
+{
+	struct child_process cp;
+	const char *argv[4];
+	int ret = 0;
+
+	argv[0] = core_fsmonitor;
+	argv[1] = HOOK_INTERFACE_VERSION;
+	argv[2] = token ? token : "";
+	argv[3] = NULL;
+	memset(&cp, 0, sizeof(cp));
+	cp.argv = argv;
+	cp.dir = get_git_work_tree();
+	cp.out = -1;
+	cp.no_stdin = 1;
+
+	if (start_command(&cp))
+		return error("could not run fsmonitor hook %s", core_fsmonitor);
+	if (strbuf_read(out, cp.out, 1024) < 0)
+		ret = -1;
+	close(cp.out);
+	if (finish_command(&cp))
+		ret = -1;
+	if (!ret && !memchr(out->buf, '\0', out->len))
+		ret = error("fsmonitor hook %s did not give a token",
+			    core_fsmonitor);
+	return ret;
+}
+
+static int fsmonitor_config(const char *var, const char *value, void *cb)
+{
+	if (!strcmp(var, "core.fsmonitor")) {
+		if (git_config_pathname(&core_fsmonitor, var, value))
+			return -1;
+		if (!*core_fsmonitor)
+			core_fsmonitor = NULL;
+	}
+	return 0;
+}
+
+/*
+ * Some commands read the index before their configuration (e.g.
+ * "status" looks for .gitmodules first), so core.fsmonitor is read
+ * here, the first time it is needed.
+ */
+static void load_fsmonitor_config(void)
+{
+	static int loaded;
+
+	if (loaded)
+		return;
+	loaded = 1;
+	git_config(fsmonitor_config, NULL);
+}
+
+void refresh_fsmonitor(struct index_state *istate)
+{
+	struct strbuf out = STRBUF_INIT;
+	const char *p, *end;
+
+	load_fsmonitor_config();
+	if (!core_fsmonitor || istate->fsmonitor_has_run_once ||
+	    !get_git_work_tree())
+		return;
+	if (query_fsmonitor(istate->fsmonitor_last_update, &out)) {
+		/* check everything, and start over the next time */
+		invalidate_all(istate);
+		if (istate->fsmonitor_last_update)
+			istate->cache_changed = 1;
+		discard_fsmonitor(istate);
+		istate->fsmonitor_has_run_once = 1;
+		strbuf_release(&out);
+		return;
+	}
+
+	if (!istate->fsmonitor_last_update)
+		invalidate_all(istate);
+	p = out.buf;
+	end = out.buf + out.len;
+	if (!istate->fsmonitor_last_update ||
+	    strcmp(istate->fsmonitor_last_update, p)) {
+		free(istate->fsmonitor_last_update);
+		istate->fsmonitor_last_update = xstrdup(p);
+		istate->cache_changed = 1;
+	}
+	for (p += strlen(p) + 1; p < end; p += strlen(p) + 1)
+		invalidate_path(istate, p);
+	istate->fsmonitor_has_run_once = 1;
+	strbuf_release(&out);
+}
+
+void tweak_fsmonitor(struct index_state *istate)
+{
+	struct ewah_bitmap *dirty_ewah = istate->fsmonitor_dirty;
+
+	if (!istate->fsmonitor_last_update)
+		return;
+	load_fsmonitor_config();
+	if (!core_fsmonitor) {
+		discard_fsmonitor(istate);
+		return;
+	}
+
+	if (dirty_ewah) {
+		struct bitmap *dirty = bitmap_new();
+		unsigned int i;
+
+		if (istate->fsmonitor_dirty_nr == istate->cache_nr) {
+			bitmap_or_ewah(dirty, dirty_ewah);
+			for (i = 0; i < istate->cache_nr; i++)
+				if (!bitmap_get(dirty, i))
+					istate->cache[i]->ce_flags |= CE_FSMONITOR_VALID;
+		} else {
+			/* written for other entries; trust none */
+			free(istate->fsmonitor_last_update);
+			istate->fsmonitor_last_update = NULL;
+		}
+		bitmap_free(dirty);
+		ewah_free(dirty_ewah);
+		istate->fsmonitor_dirty = NULL;
+	}
+}
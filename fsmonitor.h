@@ -0,0 +1,68 @@
+#ifndef FSMONITOR_H
+#define FSMONITOR_H
+
+struct index_state;
+struct cache_entry;
+struct strbuf;
+
+/*
+ * With core.fsmonitor set to a hook, entries marked CE_FSMONITOR_VALID
+ * are known not to have changed in the work tree since their stat data
+ * was last found to match, and are not lstat()ed again.  The hook is
+ * asked which paths changed since the token it gave the last time; it
+ * is run as
+ *
+ *	<hook> 1 <token>
+ *
+ * from the top of the work tree, with an empty token the first time,
+ * and prints a new token and then the changed paths, each terminated
+ * by a NUL.  The path "/" means everything may have changed.  The
+ * token and the entries that are not known to be clean are kept in
+ * the "FSMN" index extension, with the number of entries the bitmap
+ * was computed for.  The hook is only run when the work tree is
+ * about to be looked at, by refresh_index() and preload_index().
+ */
+int read_fsmonitor_extension(struct index_state *istate,
+			     const void *data, unsigned long sz);
+void write_fsmonitor_extension(struct strbuf *sb, struct index_state *istate);
+
+/*
+ * Prepare the extension data of "istate" for do_write_index(); this
+ * has to see all entries, before a split index replaces them with
+ * the ones that are not shared.
+ */
+void fill_fsmonitor_bitmap(struct index_state *istate);
+
+/*
+ * Called when the index has been read: mark the entries the index
+ * extension says are clean valid.
+ */
+void tweak_fsmonitor(struct index_state *istate);
+
+/*
+ * Ask the hook what changed since the token of "istate", once per
+ * in-core index, and invalidate those entries.
+ */
+void refresh_fsmonitor(struct index_state *istate);
+
+void discard_fsmonitor(struct index_state *istate);
+
+/*
+ * Whether "ce" is known not to have changed.  The marks read from
+ * the index are only good once the hook has been asked about them.
+ */
+static inline int fsmonitor_valid(const struct index_state *istate,
+				  const struct cache_entry *ce)
+{
+	return istate->fsmonitor_has_run_once &&
+		(ce->ce_flags & CE_FSMONITOR_VALID);
+}
+
+/* The stat data of "ce" was just found to match the work tree */
+static inline void mark_fsmonitor_valid(struct cache_entry *ce)
+{
+	if (core_fsmonitor)
+		ce->ce_flags |= CE_FSMONITOR_VALID;
+}
+
+#endif
@@ -9,6 +9,7 @@ git repack [options]
 --
 a               pack everything in a single pack
 A               same as -a, and turn unreachable objects loose
+b               write a bitmap index along with the pack (needs -a)
 d               remove redundant packs, and run git-prune-packed
 f               pass --no-reuse-delta to git-pack-objects
 F               pass --no-reuse-object to git-pack-objects
@@ -25,7 +26,7 @@ SUBDIRECTORY_OK='Yes'
 . git-sh-setup
 
 no_update_info= all_into_one= remove_redundant= unpack_unreachable=
-local= no_reuse= extra=
+local= no_reuse= extra= write_bitmaps=
 while test $# != 0
 do
 	case "$1" in
@@ -33,6 +34,7 @@ do
 	-a)	all_into_one=t ;;
 	-A)	all_into_one=t
 		unpack_unreachable=--unpack-unreachable ;;
+	-b)	write_bitmaps=t ;;
 	-d)	remove_redundant=t ;;
 	-q)	GIT_QUIET=t ;;
 	-f)	no_reuse=--no-reuse-delta ;;
@@ -51,6 +53,12 @@ true)
 	extra="$extra --delta-base-offset" ;;
 esac
 
+test -n "$write_bitmaps" ||
+case "`git config --bool repack.writebitmaps || echo false`" in
+true)
+	write_bitmaps=$all_into_one ;;
+esac
+
 PACKDIR="$GIT_OBJECT_DIRECTORY/pack"
 PACKTMP="$PACKDIR/.tmp-$$-pack"
 rm -f "$PACKTMP"-*
@@ -59,6 +67,8 @@ trap 'rm -f "$PACKTMP"-*' 0 1 2 3 15
 # There will be more repacking strategies to come...
 case ",$all_into_one," in
 ,,)
+	test -z "$write_bitmaps" ||
+		die "fatal: bitmap indexes can only be written with -a or -A"
 	args='--unpacked --incremental'
 	;;
 ,t,)
@@ -84,7 +94,7 @@ esac
 
 mkdir -p "$PACKDIR" || exit
 
-args="$args $local ${GIT_QUIET:+-q} $no_reuse$extra"
+args="$args $local ${GIT_QUIET:+-q} $no_reuse$extra${write_bitmaps:+ --write-bitmap-index}"
 names=$(git pack-objects --keep-true-parents --honor-pack-keep --non-empty --all --reflog $args </dev/null "$PACKTMP") ||
 	exit 1
 if [ -z "$names" ]; then
@@ -100,7 +110,7 @@ rollback=
 failed=
 for name in $names
 do
-	for sfx in pack idx
+	for sfx in pack idx bitmap
 	do
 		file=pack-$name.$sfx
 		test -f "$PACKDIR/$file" || continue
@@ -151,6 +161,12 @@ do
 	mv -f "$PACKTMP-$name.pack" "$PACKDIR/pack-$name.pack" &&
 	mv -f "$PACKTMP-$name.idx"  "$PACKDIR/pack-$name.idx" ||
 	exit
+	if test -f "$PACKTMP-$name.bitmap"
+	then
+		chmod a-w "$PACKTMP-$name.bitmap"
+		mv -f "$PACKTMP-$name.bitmap" "$PACKDIR/pack-$name.bitmap" ||
+		exit
+	fi
 done
 
 # Remove the "old-" files
@@ -158,6 +174,7 @@ for name in $names
 do
 	rm -f "$PACKDIR/old-pack-$name.idx"
 	rm -f "$PACKDIR/old-pack-$name.pack"
+	rm -f "$PACKDIR/old-pack-$name.bitmap"
 done
 
 # End of pack replacement.
@@ -172,7 +189,7 @@ then
 		  do
 			case " $fullbases " in
 			*" $e "*) ;;
-			*)	rm -f "$e.pack" "$e.idx" "$e.keep" ;;
+			*)	rm -f "$e.pack" "$e.idx" "$e.keep" "$e.bitmap" ;;
 			esac
 		  done
 		)
@@ -180,6 +197,14 @@ then
 	git prune-packed ${GIT_QUIET:+-q}
 fi
 
+# A multi-pack index naming packs that are gone is ignored; bring it
+# up to date with the new set of packs.
+if test -f "$PACKDIR/multi-pack-index"
+then
+	git multi-pack-index write ||
+	die "fatal: failed to update the multi-pack-index"
+fi
+
 case "$no_update_info" in
 t) : ;;
 *) git update-server-info ;;
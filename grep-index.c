@@ -0,0 +1,777 @@
+#include "cache.h"
+#include "grep.h"
+#include "grep-index.h"
+#include "commit.h"
+#include "csum-file.h"
+#include "dir.h"
+#include "diff.h"
+#include "revision.h"
+#include "list-objects.h"
+#include "sha1-array.h"
+#include "varint.h"
+#include "xdiff-interface.h"
+#include "ewah/ewok.h"
+
+/*
+ * See Documentation/technical/grep-index-format.txt for the layout
+ * of the file.  All integers are stored in network byte order.
+ */
+#define GIDX_HEADER_SIZE	16
+#define GIDX_FANOUT_SIZE	(4 * 256)
+#define GIDX_TRIGRAM_WIDTH	8
+
+struct grep_index {
+	const unsigned char *data;
+	size_t data_len;
+	uint32_t num_blobs;
+	uint32_t num_trigrams;
+	const uint32_t *fanout;
+	const unsigned char *sha1s;
+	const unsigned char *trigrams;
+	const unsigned char *postings;
+	size_t postings_len;
+};
+
+struct grep_index_filter {
+	struct grep_index *index;
+	/* positions of the blobs that may have a hit */
+	struct bitmap *candidates;
+};
+
+static const char *grep_index_path(void)
+{
+	static char *path;
+
+	if (!path)
+		path = xstrdup(mkpath("%s/info/grep-index",
+				      get_object_directory()));
+	return path;
+}
+
+static inline uint32_t gidx_u32(const unsigned char *p)
+{
+	return ntohl(*(const uint32_t *)p);
+}
+
+/*
+ * Trigrams are three bytes of a line, with ASCII letters folded to
+ * lower case so that the same file serves --ignore-case.
+ */
+static inline uint32_t trigram(const unsigned char *p)
+{
+	return ((uint32_t)tolower(p[0]) << 16) |
+		((uint32_t)tolower(p[1]) << 8) |
+		(uint32_t)tolower(p[2]);
+}
+
+static struct grep_index *load_grep_index(const char *path)
+{
+	struct grep_index *gi;
+	const uint32_t *hdr;
+	void *map;
+	size_t size;
+	uint64_t tables;
+	uint32_t version, nr, nr_trigrams, i, prev;
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	size = xsize_t(st.st_size);
+	if (size < GIDX_HEADER_SIZE + GIDX_FANOUT_SIZE + 20) {
+		close(fd);
+		error("grep-index file %s is too small", path);
+		return NULL;
+	}
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	hdr = map;
+	if (ntohl(hdr[0]) != GREP_INDEX_SIGNATURE) {
+		error("grep-index file %s has a bad signature", path);
+		goto bad;
+	}
+	version = ntohl(hdr[1]);
+	if (version != GREP_INDEX_VERSION) {
+		error("grep-index file %s is version %"PRIu32
+		      " and is not supported by this binary", path, version);
+		goto bad;
+	}
+	nr = ntohl(hdr[2]);
+	nr_trigrams = ntohl(hdr[3]);
+	tables = GIDX_HEADER_SIZE + GIDX_FANOUT_SIZE + (uint64_t)nr * 20 +
+		 (uint64_t)nr_trigrams * GIDX_TRIGRAM_WIDTH;
+	if ((uint64_t)size < tables + 20) {
+		error("wrong grep-index file size in %s", path);
+		goto bad;
+	}
+	for (i = prev = 0; i < 256; i++) {
+		uint32_t n = ntohl(hdr[4 + i]);
+		if (n < prev) {
+			error("non-monotonic grep-index %s", path);
+			goto bad;
+		}
+		prev = n;
+	}
+	if (prev != nr) {
+		error("grep-index fan-out does not match in %s", path);
+		goto bad;
+	}
+
+	gi = xcalloc(1, sizeof(*gi));
+	gi->data = map;
+	gi->data_len = size;
+	gi->num_blobs = nr;
+	gi->num_trigrams = nr_trigrams;
+	gi->fanout = hdr + 4;
+	gi->sha1s = gi->data + GIDX_HEADER_SIZE + GIDX_FANOUT_SIZE;
+	gi->trigrams = gi->sha1s + (size_t)nr * 20;
+	gi->postings = gi->data + tables;
+	gi->postings_len = size - tables - 20;
+	return gi;
+
+bad:
+	munmap(map, size);
+	return NULL;
+}
+
+static void close_grep_index(struct grep_index *gi)
+{
+	if (!gi)
+		return;
+	munmap((void *)gi->data, gi->data_len);
+	free(gi);
+}
+
+static int find_blob(const struct grep_index *gi,
+		     const unsigned char *sha1, uint32_t *pos)
+{
+	uint32_t lo, hi;
+
+	hi = ntohl(gi->fanout[*sha1]);
+	lo = *sha1 ? ntohl(gi->fanout[*sha1 - 1]) : 0;
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(sha1, gi->sha1s + 20 * mi);
+		if (!cmp) {
+			*pos = mi;
+			return 1;
+		}
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return 0;
+}
+
+/* Find where the postings of the n-th trigram start and end */
+static void trigram_postings(const struct grep_index *gi, uint32_t n,
+			     const unsigned char **start,
+			     const unsigned char **end)
+{
+	const unsigned char *entry = gi->trigrams + GIDX_TRIGRAM_WIDTH * n;
+	size_t off = gidx_u32(entry + 4), next;
+
+	if (n + 1 < gi->num_trigrams)
+		next = gidx_u32(entry + GIDX_TRIGRAM_WIDTH + 4);
+	else
+		next = gi->postings_len;
+	if (next < off || gi->postings_len < next)
+		die("grep-index has a bad offset for trigram %06"PRIx32,
+		    gidx_u32(entry));
+	*start = gi->postings + off;
+	*end = gi->postings + next;
+}
+
+static int find_trigram(const struct grep_index *gi, uint32_t t,
+			const unsigned char **start,
+			const unsigned char **end)
+{
+	uint32_t lo = 0, hi = gi->num_trigrams;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		uint32_t cur = gidx_u32(gi->trigrams + GIDX_TRIGRAM_WIDTH * mi);
+		if (t == cur) {
+			trigram_postings(gi, mi, start, end);
+			return 1;
+		}
+		if (t < cur)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return 0;
+}
+
+/*
+ * The postings of a trigram are the positions of the blobs that have
+ * it, in increasing order, each but the first stored as the varint
+ * difference to the one before.
+ */
+static int decode_postings(const struct grep_index *gi,
+			   const unsigned char *p, const unsigned char *end,
+			   uint32_t **list, int *alloc)
+{
+	uint32_t pos = 0;
+	int nr = 0;
+
+	while (p < end) {
+		uintmax_t delta = decode_varint(&p);
+		if (end < p || (nr && !delta) || gi->num_blobs - pos <= delta)
+			die("grep-index has corrupt postings");
+		pos += delta;
+		ALLOC_GROW(*list, nr + 1, *alloc);
+		(*list)[nr++] = pos;
+	}
+	return nr;
+}
+
+static int uint32_cmp(const void *a_, const void *b_)
+{
+	uint32_t a = *(const uint32_t *)a_, b = *(const uint32_t *)b_;
+	return a < b ? -1 : a > b;
+}
+
+struct trigram_list {
+	uint32_t *t;
+	int nr, alloc;
+};
+
+static void add_trigrams(struct trigram_list *list,
+			 const unsigned char *p, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i + 2 < len; i++) {
+		ALLOC_GROW(list->t, list->nr + 1, list->alloc);
+		list->t[list->nr++] = trigram(p + i);
+	}
+}
+
+static void sort_trigrams(struct trigram_list *list)
+{
+	int i, j;
+
+	qsort(list->t, list->nr, sizeof(*list->t), uint32_cmp);
+	for (i = j = 0; i < list->nr; i++)
+		if (!j || list->t[j - 1] != list->t[i])
+			list->t[j++] = list->t[i];
+	list->nr = j;
+}
+
+/* Skip a bracket expression; "p" points after its '[' */
+static const char *skip_bracket(const char *p, const char *end)
+{
+	if (p < end && *p == '^')
+		p++;
+	if (p < end && *p == ']')
+		p++;
+	while (p < end && *p != ']') {
+		if (*p == '[' && p + 1 < end &&
+		    (p[1] == ':' || p[1] == '=' || p[1] == '.')) {
+			char close = p[1];
+			for (p += 2; p + 1 < end; p++)
+				if (p[0] == close && p[1] == ']')
+					break;
+			if (end <= p + 1)
+				return NULL;
+			p++;
+		}
+		p++;
+	}
+	return p < end ? p + 1 : NULL;
+}
+
+/*
+ * Collect the trigrams of the runs of literal bytes in the pattern
+ * that every match must contain.  Returns -1 when the pattern uses
+ * something (alternation, groups, Perl syntax) that this does not
+ * know how to look through.
+ */
+static int pattern_trigrams(const struct grep_opt *opt,
+			    const struct grep_pat *p,
+			    struct trigram_list *list)
+{
+	const char *pat = p->pattern, *end = pat + p->patternlen;
+	int ere = !!(opt->regflags & REG_EXTENDED);
+	int icase = p->ignore_case || (opt->regflags & REG_ICASE);
+	struct strbuf run = STRBUF_INIT;
+
+	if (p->fixed) {
+		add_trigrams(list, (const unsigned char *)pat, p->patternlen);
+		return 0;
+	}
+	if (opt->pcre)
+		return -1;
+
+	while (pat < end) {
+		unsigned char c = *pat++;
+		enum { LITERAL, BREAK, REPEAT } what = LITERAL;
+
+		switch (c) {
+		case '\\':
+			if (pat == end)
+				goto unknown;
+			c = *pat++;
+			if (!ere && (c == '(' || c == '|'))
+				goto unknown;
+			if (!ere && (c == '{' || c == '?' || c == '+'))
+				what = REPEAT;
+			else if (isalnum(c) || strchr("<>`'{}", c))
+				what = BREAK;
+			break;
+		case '[':
+			pat = skip_bracket(pat, end);
+			if (!pat)
+				goto unknown;
+			what = BREAK;
+			break;
+		case '.': case '^': case '$': case '\n':
+			what = BREAK;
+			break;
+		case '*':
+			what = REPEAT;
+			break;
+		case '+': case '?': case '{':
+			if (ere)
+				what = REPEAT;
+			break;
+		case '(': case ')': case '|':
+			if (ere)
+				goto unknown;
+			break;
+		}
+		/* other cases of non-ASCII bytes may match */
+		if (what == LITERAL && icase && 0x80 <= c)
+			what = BREAK;
+
+		if (what == LITERAL) {
+			strbuf_addch(&run, c);
+			continue;
+		}
+		/* the byte before a repetition may not be there at all */
+		if (what == REPEAT && run.len)
+			strbuf_setlen(&run, run.len - 1);
+		if (what == REPEAT && c == '{') {
+			pat = memchr(pat, '}', end - pat);
+			if (!pat)
+				goto unknown;
+			pat++;
+		}
+		add_trigrams(list, (const unsigned char *)run.buf, run.len);
+		strbuf_reset(&run);
+	}
+	add_trigrams(list, (const unsigned char *)run.buf, run.len);
+	strbuf_release(&run);
+	return 0;
+
+unknown:
+	strbuf_release(&run);
+	return -1;
+}
+
+/* Keep the positions of "*list" that are also in "other" */
+static int intersect(uint32_t *list, int nr, const uint32_t *other, int other_nr)
+{
+	int i, j, k;
+
+	for (i = j = k = 0; i < nr && j < other_nr; ) {
+		if (list[i] < other[j])
+			i++;
+		else if (other[j] < list[i])
+			j++;
+		else {
+			list[k++] = list[i++];
+			j++;
+		}
+	}
+	return k;
+}
+
+/*
+ * Mark the blobs that have all trigrams of the list as candidates.
+ */
+static void add_candidates(struct grep_index_filter *filter,
+			   const struct trigram_list *list)
+{
+	const struct grep_index *gi = filter->index;
+	const unsigned char **start, **end;
+	uint32_t *pos = NULL, *other = NULL;
+	int i, seed = 0, nr, pos_alloc = 0, other_alloc = 0;
+
+	start = xmalloc(list->nr * sizeof(*start));
+	end = xmalloc(list->nr * sizeof(*end));
+	for (i = 0; i < list->nr; i++) {
+		if (!find_trigram(gi, list->t[i], &start[i], &end[i]))
+			goto done; /* no blob has it */
+		/* start from the rarest one */
+		if (end[i] - start[i] < end[seed] - start[seed])
+			seed = i;
+	}
+
+	nr = decode_postings(gi, start[seed], end[seed], &pos, &pos_alloc);
+	for (i = 0; nr && i < list->nr; i++) {
+		int other_nr;
+
+		if (i == seed)
+			continue;
+		other_nr = decode_postings(gi, start[i], end[i],
+					   &other, &other_alloc);
+		nr = intersect(pos, nr, other, other_nr);
+	}
+	for (i = 0; i < nr; i++)
+		bitmap_set(filter->candidates, pos[i]);
+
+done:
+	free(start);
+	free(end);
+	free(pos);
+	free(other);
+}
+
+struct grep_index_filter *grep_index_filter(const struct grep_opt *opt)
+{
+	struct grep_index_filter *filter;
+	struct trigram_list list = { NULL, 0, 0 };
+	struct grep_pat *p;
+	struct grep_index *gi;
+
+	if (!core_grep_index)
+		return NULL;
+	/* files without a hit may be the ones to show */
+	if (opt->invert || opt->unmatch_name_only || opt->header_list)
+		return NULL;
+	for (p = opt->pattern_list; p; p = p->next) {
+		switch (p->token) {
+		case GREP_PATTERN:
+		case GREP_AND:
+		case GREP_OR:
+		case GREP_OPEN_PAREN:
+		case GREP_CLOSE_PAREN:
+			break;
+		default:
+			return NULL; /* --not and header patterns */
+		}
+	}
+
+	gi = load_grep_index(grep_index_path());
+	if (!gi)
+		return NULL;
+	filter = xmalloc(sizeof(*filter));
+	filter->index = gi;
+	filter->candidates = bitmap_new();
+
+	/*
+	 * A line can only hit if one of the patterns matches it, so
+	 * the candidates are the blobs that have all the trigrams of
+	 * at least one pattern.
+	 */
+	for (p = opt->pattern_list; p; p = p->next) {
+		if (p->token != GREP_PATTERN)
+			continue;
+		list.nr = 0;
+		if (pattern_trigrams(opt, p, &list) || !list.nr) {
+			free(list.t);
+			free_grep_index_filter(filter);
+			return NULL;
+		}
+		sort_trigrams(&list);
+		add_candidates(filter, &list);
+	}
+	free(list.t);
+	return filter;
+}
+
+int grep_index_may_match(const struct grep_index_filter *filter,
+			 const unsigned char *sha1)
+{
+	uint32_t pos;
+
+	if (!filter || !find_blob(filter->index, sha1, &pos))
+		return 1;
+	return bitmap_get(filter->candidates, pos);
+}
+
+void free_grep_index_filter(struct grep_index_filter *filter)
+{
+	if (!filter)
+		return;
+	close_grep_index(filter->index);
+	bitmap_free(filter->candidates);
+	free(filter);
+}
+
+/*
+ * While writing, each trigram a blob has is recorded as the trigram
+ * in the upper and the position of the blob in the lower 32 bits.
+ */
+struct posting_list {
+	uint64_t *p;
+	size_t nr, alloc;
+};
+
+static void add_posting(struct posting_list *list, uint32_t t, uint32_t pos)
+{
+	ALLOC_GROW(list->p, list->nr + 1, list->alloc);
+	list->p[list->nr++] = ((uint64_t)t << 32) | pos;
+}
+
+static int uint64_cmp(const void *a_, const void *b_)
+{
+	uint64_t a = *(const uint64_t *)a_, b = *(const uint64_t *)b_;
+	return a < b ? -1 : a > b;
+}
+
+/*
+ * Add the trigrams of the lines of the blob.  Returns -1 for blobs
+ * that are not indexed: binary ones, and ones too large to read.
+ */
+static int index_blob(const unsigned char *sha1, uint32_t pos,
+		      struct trigram_list *list, struct posting_list *postings)
+{
+	enum object_type type;
+	unsigned long size;
+	unsigned char *buf, *bol, *eol, *end;
+	int i;
+
+	if (sha1_object_info(sha1, &size) != OBJ_BLOB ||
+	    big_file_threshold < size)
+		return -1;
+	buf = read_sha1_file(sha1, &type, &size);
+	if (!buf)
+		return error("unable to read %s", sha1_to_hex(sha1));
+	if (buffer_is_binary((char *)buf, size)) {
+		free(buf);
+		return -1;
+	}
+
+	list->nr = 0;
+	end = buf + size;
+	for (bol = buf; bol < end; bol = eol + 1) {
+		eol = memchr(bol, '\n', end - bol);
+		if (!eol)
+			eol = end;
+		add_trigrams(list, bol, eol - bol);
+	}
+	sort_trigrams(list);
+	for (i = 0; i < list->nr; i++)
+		add_posting(postings, list->t[i], pos);
+	free(buf);
+	return 0;
+}
+
+static void collect_commit(struct commit *commit, void *data)
+{
+}
+
+static void collect_blob(struct object *obj, const struct name_path *path,
+			 const char *last, void *data)
+{
+	if (obj->type == OBJ_BLOB)
+		sha1_array_append(data, obj->sha1);
+}
+
+static void write_u32(struct sha1file *f, uint32_t v)
+{
+	v = htonl(v);
+	sha1write(f, &v, 4);
+}
+
+int write_grep_index(struct rev_info *revs)
+{
+	static struct lock_file lock;
+	struct sha1_array blobs = SHA1_ARRAY_INIT;
+	struct posting_list postings = { NULL, 0, 0 };
+	struct trigram_list list = { NULL, 0, 0 };
+	struct grep_index *old;
+	struct strbuf data = STRBUF_INIT;
+	uint32_t *old_pos = NULL, *new_pos, *decoded = NULL;
+	uint32_t fanout[256], nr, nr_trigrams;
+	int i, fd, ret = 0, decoded_alloc = 0;
+	size_t j;
+	struct sha1file *f;
+
+	if (prepare_revision_walk(revs))
+		return error("revision walk setup failed");
+	traverse_commit_list(revs, collect_commit, collect_blob, &blobs);
+	sha1_array_sort(&blobs);
+
+	/*
+	 * Blobs that the existing file covers keep their trigrams;
+	 * only the others are read.  new_pos[] is the position of
+	 * each blob in the new file, or -1 if it is not indexed.
+	 */
+	old = load_grep_index(grep_index_path());
+	if (old) {
+		old_pos = xmalloc(old->num_blobs * sizeof(*old_pos));
+		for (j = 0; j < old->num_blobs; j++)
+			old_pos[j] = -1;
+	}
+	new_pos = xmalloc(blobs.nr * sizeof(*new_pos));
+	for (i = nr = 0; i < blobs.nr; i++) {
+		uint32_t pos;
+
+		if (i && !hashcmp(blobs.sha1[i - 1], blobs.sha1[i])) {
+			new_pos[i] = -1;
+			continue;
+		}
+		if (old && find_blob(old, blobs.sha1[i], &pos)) {
+			old_pos[pos] = nr;
+			new_pos[i] = nr++;
+			continue;
+		}
+		if (index_blob(blobs.sha1[i], nr, &list, &postings)) {
+			new_pos[i] = -1;
+			continue;
+		}
+		new_pos[i] = nr++;
+	}
+	free(list.t);
+
+	if (old) {
+		for (j = 0; j < old->num_trigrams; j++) {
+			const unsigned char *start, *end;
+			uint32_t t = gidx_u32(old->trigrams +
+					      GIDX_TRIGRAM_WIDTH * j);
+			int k, n;
+
+			trigram_postings(old, j, &start, &end);
+			n = decode_postings(old, start, end,
+					    &decoded, &decoded_alloc);
+			for (k = 0; k < n; k++)
+				if (old_pos[decoded[k]] != -1)
+					add_posting(&postings, t,
+						    old_pos[decoded[k]]);
+		}
+		free(decoded);
+		free(old_pos);
+		close_grep_index(old);
+	}
+	qsort(postings.p, postings.nr, sizeof(*postings.p), uint64_cmp);
+
+	memset(fanout, 0, sizeof(fanout));
+	for (i = 0; i < blobs.nr; i++)
+		if (new_pos[i] != -1)
+			fanout[blobs.sha1[i][0]]++;
+	for (i = 1; i < 256; i++)
+		fanout[i] += fanout[i - 1];
+
+	nr_trigrams = 0;
+	for (j = 0; j < postings.nr; j++)
+		if (!j || (postings.p[j - 1] >> 32) != (postings.p[j] >> 32))
+			nr_trigrams++;
+
+	if (safe_create_leading_directories_const(grep_index_path())) {
+		ret = error("unable to create leading directories of %s",
+			    grep_index_path());
+		goto done;
+	}
+	fd = hold_lock_file_for_update(&lock, grep_index_path(),
+				       LOCK_DIE_ON_ERROR);
+	f = sha1fd(fd, lock.filename);
+
+	write_u32(f, GREP_INDEX_SIGNATURE);
+	write_u32(f, GREP_INDEX_VERSION);
+	write_u32(f, nr);
+	write_u32(f, nr_trigrams);
+	for (i = 0; i < 256; i++)
+		write_u32(f, fanout[i]);
+	for (i = 0; i < blobs.nr; i++)
+		if (new_pos[i] != -1)
+			sha1write(f, blobs.sha1[i], 20);
+
+	for (j = 0; j < postings.nr; j++) {
+		uint32_t t = postings.p[j] >> 32;
+		uint32_t pos = postings.p[j] & 0xffffffff;
+		unsigned char varint[16];
+		uint32_t prev = 0;
+
+		if (!j || (postings.p[j - 1] >> 32) != t) {
+			if (0xffffffff < data.len)
+				die("grep-index would be too large");
+			write_u32(f, t);
+			write_u32(f, data.len);
+		} else
+			prev = postings.p[j - 1] & 0xffffffff;
+		strbuf_add(&data, varint, encode_varint(pos - prev, varint));
+	}
+	sha1write(f, data.buf, data.len);
+
+	sha1close(f, NULL, CSUM_FSYNC);
+	lock.fd = -1; /* closed by sha1close() */
+	if (commit_lock_file(&lock) < 0)
+		die_errno("unable to write grep-index file %s",
+			  grep_index_path());
+
+done:
+	strbuf_release(&data);
+	free(postings.p);
+	free(new_pos);
+	sha1_array_clear(&blobs);
+	return ret;
+}
+
+int verify_grep_index(void)
+{
+	struct grep_index *gi;
+	unsigned char sha1[20];
+	git_SHA_CTX ctx;
+	uint32_t *decoded = NULL;
+	int decoded_alloc = 0, errors = 0;
+	uint32_t i;
+
+	gi = load_grep_index(grep_index_path());
+	if (!gi)
+		return file_exists(grep_index_path());
+
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, gi->data, gi->data_len - 20);
+	git_SHA1_Final(sha1, &ctx);
+	if (hashcmp(sha1, gi->data + gi->data_len - 20)) {
+		error("grep-index checksum mismatch");
+		errors++;
+	}
+
+	for (i = 0; i < gi->num_blobs; i++) {
+		const unsigned char *cur = gi->sha1s + 20 * i;
+
+		if (i && hashcmp(cur - 20, cur) >= 0) {
+			error("grep-index is not sorted at %s",
+			      sha1_to_hex(cur));
+			errors++;
+		}
+		if (!has_sha1_file(cur)) {
+			error("grep-index lists missing blob %s",
+			      sha1_to_hex(cur));
+			errors++;
+		}
+	}
+
+	for (i = 0; i < gi->num_trigrams; i++) {
+		const unsigned char *entry = gi->trigrams + GIDX_TRIGRAM_WIDTH * i;
+		const unsigned char *start, *end;
+		uint32_t t = gidx_u32(entry);
+
+		if (0xffffff < t ||
+		    (i && t <= gidx_u32(entry - GIDX_TRIGRAM_WIDTH))) {
+			error("grep-index has a bad trigram %08"PRIx32, t);
+			errors++;
+		}
+		trigram_postings(gi, i, &start, &end);
+		if (start == end) {
+			error("grep-index has no postings for trigram %06"PRIx32,
+			      t);
+			errors++;
+		}
+		decode_postings(gi, start, end, &decoded, &decoded_alloc);
+	}
+	free(decoded);
+	close_grep_index(gi);
+	return errors;
+}
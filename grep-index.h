@@ -0,0 +1,41 @@
+#ifndef GREP_INDEX_H
+#define GREP_INDEX_H
+
+#define GREP_INDEX_SIGNATURE 0x47494458 /* "GIDX" */
+#define GREP_INDEX_VERSION 1
+
+struct grep_opt;
+struct grep_index_filter;
+struct rev_info;
+
+/*
+ * Work out which of the blobs in the grep-index file can have a line
+ * that the patterns of "opt" match.  Returns NULL if there is no file
+ * or if the patterns do not allow to rule any blob out, e.g. because
+ * they have no literal part three bytes long, or with --invert-match.
+ */
+extern struct grep_index_filter *grep_index_filter(const struct grep_opt *opt);
+
+/*
+ * Can the blob "sha1" contain a hit?  Blobs that the file does not
+ * know about always can.
+ */
+extern int grep_index_may_match(const struct grep_index_filter *filter,
+				const unsigned char *sha1);
+
+extern void free_grep_index_filter(struct grep_index_filter *filter);
+
+/*
+ * Write a grep-index file covering the blobs reachable from the walk
+ * set up in "revs" to $GIT_OBJECT_DIRECTORY/info/grep-index.  Blobs
+ * that the existing file covers are not read again.
+ */
+extern int write_grep_index(struct rev_info *revs);
+
+/*
+ * Check the checksum and the structure of the grep-index file.
+ * Returns the number of problems found.
+ */
+extern int verify_grep_index(void);
+
+#endif /* GREP_INDEX_H */
@@ -449,13 +449,12 @@ void free_grep_patterns(struct grep_opt *opt)
 
 static char *end_of_line(char *cp, unsigned long *left)
 {
-	unsigned long l = *left;
-	while (l && *cp != '\n') {
-		l--;
-		cp++;
-	}
-	*left = l;
-	return cp;
+	char *eol = memchr(cp, '\n', *left);
+
+	if (!eol)
+		eol = cp + *left;
+	*left -= eol - cp;
+	return eol;
 }
 
 static int word_char(char ch)
@@ -922,21 +921,42 @@ static void show_pre_context(struct grep_opt *opt, const char *name, char *buf,
 	}
 }
 
+/*
+ * Without --not, a line can only hit if at least one of the atoms of
+ * the expression matches it, so the lines that none of them match can
+ * be skipped, however the atoms are combined.
+ */
 static int should_lookahead(struct grep_opt *opt)
 {
 	struct grep_pat *p;
 
-	if (opt->extended)
-		return 0; /* punt for too complex stuff */
 	if (opt->invert)
 		return 0;
+	if (opt->header_list)
+		return 0; /* header lines are matched differently */
 	for (p = opt->pattern_list; p; p = p->next) {
-		if (p->token != GREP_PATTERN)
-			return 0; /* punt for "header only" and stuff */
+		switch (p->token) {
+		case GREP_PATTERN:
+		case GREP_AND:
+		case GREP_OR:
+		case GREP_OPEN_PAREN:
+		case GREP_CLOSE_PAREN:
+			break;
+		default:
+			return 0; /* punt for "--not", "header only" and stuff */
+		}
 	}
 	return 1;
 }
 
+static void clear_lookahead(struct grep_opt *opt)
+{
+	struct grep_pat *p;
+
+	for (p = opt->pattern_list; p; p = p->next)
+		p->lookahead_from = NULL;
+}
+
 static int look_ahead(struct grep_opt *opt,
 		      unsigned long *left_p,
 		      unsigned *lno_p,
@@ -952,11 +972,26 @@ static int look_ahead(struct grep_opt *opt,
 		int hit;
 		regmatch_t m;
 
-		hit = patmatch(p, bol, bol + *left_p, &m, 0);
-		if (!hit || m.rm_so < 0 || m.rm_eo < 0)
+		if (p->token != GREP_PATTERN)
+			continue;
+		/*
+		 * With more than one pattern, the others may hit much
+		 * later than the earliest one; do not look for them
+		 * again until we are past where they were found.
+		 */
+		if (!p->lookahead_from ||
+		    (p->lookahead_hit && p->lookahead_hit < bol)) {
+			hit = patmatch(p, bol, bol + *left_p, &m, 0);
+			p->lookahead_from = bol;
+			if (!hit || m.rm_so < 0 || m.rm_eo < 0)
+				p->lookahead_hit = NULL;
+			else
+				p->lookahead_hit = bol + m.rm_so;
+		}
+		if (!p->lookahead_hit)
 			continue;
-		if (earliest < 0 || m.rm_so < earliest)
-			earliest = m.rm_so;
+		if (earliest < 0 || p->lookahead_hit - bol < earliest)
+			earliest = p->lookahead_hit - bol;
 	}
 
 	if (earliest < 0) {
@@ -1034,6 +1069,8 @@ static int grep_buffer_1(struct grep_opt *opt, const char *name,
 	opt->priv = &xecfg;
 
 	try_lookahead = should_lookahead(opt);
+	if (try_lookahead)
+		clear_lookahead(opt);
 
 	while (left) {
 		char *eol, ch;
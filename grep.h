@@ -44,6 +44,12 @@ struct grep_pat {
 	pcre *pcre_regexp;
 	pcre_extra *pcre_extra_info;
 	kwset_t kws;
+	/*
+	 * look_ahead() searched the buffer from lookahead_from on and
+	 * found the first hit at lookahead_hit (NULL if there is none).
+	 */
+	char *lookahead_from;
+	char *lookahead_hit;
 	unsigned fixed:1;
 	unsigned ignore_case:1;
 	unsigned word_regexp:1;
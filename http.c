@@ -4,9 +4,11 @@
 #include "run-command.h"
 #include "url.h"
 #include "credential.h"
+#include "sha1-array.h"
 
 int active_requests;
 int http_is_verbose;
+int http_auth_seen;
 size_t http_post_buffer = 16 * LARGE_PACKET_MAX;
 
 #if LIBCURL_VERSION_NUM >= 0x070a06
@@ -655,6 +657,19 @@ void finish_active_slot(struct active_request_slot *slot)
 	closedown_active_slot(slot);
 	curl_easy_getinfo(slot->curl, CURLINFO_HTTP_CODE, &slot->http_code);
 
+	/* Remember whether the server ever asked us to authenticate. */
+	if (slot->http_code == 401)
+		http_auth_seen = 1;
+#if LIBCURL_VERSION_NUM >= 0x070a08
+	else if (!http_auth_seen) {
+		long avail = 0;
+		/* curl may have answered a challenge on its own */
+		curl_easy_getinfo(slot->curl, CURLINFO_HTTPAUTH_AVAIL, &avail);
+		if (avail)
+			http_auth_seen = 1;
+	}
+#endif
+
 	if (slot->finished != NULL)
 		(*slot->finished) = 1;
 
@@ -913,6 +928,31 @@ static char *fetch_pack_index(unsigned char *sha1, const char *base_url)
 	return tmp;
 }
 
+static int setup_pack_index(struct packed_git **packs_head,
+	unsigned char *sha1, char *tmp_idx)
+{
+	struct packed_git *new_pack;
+	int ret;
+
+	new_pack = parse_pack_index(sha1, tmp_idx);
+	if (!new_pack) {
+		unlink(tmp_idx);
+		return -1; /* parse_pack_index() already issued error message */
+	}
+
+	ret = verify_pack_index(new_pack);
+	if (!ret) {
+		close_pack_index(new_pack);
+		ret = move_temp_to_file(tmp_idx, sha1_pack_index_name(sha1));
+	}
+	if (ret)
+		return -1;
+
+	new_pack->next = *packs_head;
+	*packs_head = new_pack;
+	return 0;
+}
+
 static int fetch_and_setup_pack_index(struct packed_git **packs_head,
 	unsigned char *sha1, const char *base_url)
 {
@@ -924,41 +964,153 @@ static int fetch_and_setup_pack_index(struct packed_git **packs_head,
 		new_pack = parse_pack_index(sha1, NULL);
 		if (!new_pack)
 			return -1; /* parse_pack_index() already issued error message */
-		goto add_pack;
+		new_pack->next = *packs_head;
+		*packs_head = new_pack;
+		return 0;
 	}
 
 	tmp_idx = fetch_pack_index(sha1, base_url);
 	if (!tmp_idx)
 		return -1;
 
-	new_pack = parse_pack_index(sha1, tmp_idx);
-	if (!new_pack) {
-		unlink(tmp_idx);
-		free(tmp_idx);
+	ret = setup_pack_index(packs_head, sha1, tmp_idx);
+	free(tmp_idx);
+	return ret;
+}
 
-		return -1; /* parse_pack_index() already issued error message */
-	}
+/*
+ * A pack index that is downloaded together with others.  It goes to
+ * the same temporary file fetch_pack_index() would use, so that one
+ * interrupted here is resumed there and the other way around.
+ */
+struct pack_index_request {
+	unsigned char sha1[20];
+	struct strbuf tmpfile;
+	FILE *file;
+	struct curl_slist *headers;
+	struct active_request_slot *slot;
+	struct slot_results results;
+	int done;
+};
 
-	ret = verify_pack_index(new_pack);
-	if (!ret) {
-		close_pack_index(new_pack);
-		ret = move_temp_to_file(tmp_idx, sha1_pack_index_name(sha1));
+static void process_pack_index_response(void *callback_data)
+{
+	struct pack_index_request *req = callback_data;
+	req->done = 1;
+}
+
+static int start_pack_index_request(struct pack_index_request *req,
+				    const char *base_url)
+{
+	struct strbuf url = STRBUF_INIT;
+	long posn;
+
+	strbuf_init(&req->tmpfile, 0);
+	strbuf_addf(&req->tmpfile, "%s.temp.temp",
+		    sha1_pack_index_name(req->sha1));
+	req->file = fopen(req->tmpfile.buf, "a");
+	if (!req->file)
+		return error("Unable to open local file %s", req->tmpfile.buf);
+
+	if (http_is_verbose)
+		fprintf(stderr, "Getting index for pack %s\n",
+			sha1_to_hex(req->sha1));
+
+	end_url_with_slash(&url, base_url);
+	strbuf_addf(&url, "objects/pack/pack-%s.idx", sha1_to_hex(req->sha1));
+
+	req->slot = get_active_slot();
+	req->slot->results = &req->results;
+	req->slot->callback_func = process_pack_index_response;
+	req->slot->callback_data = req;
+	curl_easy_setopt(req->slot->curl, CURLOPT_FILE, req->file);
+	curl_easy_setopt(req->slot->curl, CURLOPT_WRITEFUNCTION, fwrite);
+	curl_easy_setopt(req->slot->curl, CURLOPT_URL, url.buf);
+	curl_easy_setopt(req->slot->curl, CURLOPT_NOBODY, 0);
+
+	posn = ftell(req->file);
+	if (posn > 0) {
+		strbuf_reset(&url);
+		strbuf_addf(&url, "Range: bytes=%ld-", posn);
+		req->headers = curl_slist_append(req->headers, url.buf);
+		curl_easy_setopt(req->slot->curl, CURLOPT_HTTPHEADER,
+				 req->headers);
 	}
-	free(tmp_idx);
-	if (ret)
-		return -1;
+	strbuf_release(&url);
 
-add_pack:
-	new_pack->next = *packs_head;
-	*packs_head = new_pack;
+	if (!start_active_slot(req->slot)) {
+		req->slot = NULL;
+		return error("Unable to start HTTP request for pack index %s",
+			     sha1_to_hex(req->sha1));
+	}
 	return 0;
 }
 
+static int finish_pack_index_request(struct packed_git **packs_head,
+				     struct pack_index_request *req)
+{
+	int ret = -1;
+
+	while (!req->done)
+		run_active_slot(req->slot);
+	fclose(req->file);
+	req->file = NULL;
+	curl_slist_free_all(req->headers);
+	req->headers = NULL;
+
+	if (req->results.curl_result == CURLE_OK) {
+		char *tmp_idx = xstrdup(req->tmpfile.buf);
+
+		tmp_idx[req->tmpfile.len - 5] = '\0';
+		if (!move_temp_to_file(req->tmpfile.buf, tmp_idx))
+			ret = setup_pack_index(packs_head, req->sha1, tmp_idx);
+		free(tmp_idx);
+	}
+	return ret;
+}
+
+/*
+ * Download the indexes of the listed packs that we do not have yet,
+ * keeping up to http.maxRequests of them in flight at a time.  An
+ * index that fails here, e.g. because the server wants credentials,
+ * is tried again on its own by fetch_and_setup_pack_index().
+ */
+static void fetch_pack_indices(struct packed_git **packs_head,
+			       struct sha1_array *packs, const char *base_url)
+{
+	struct pack_index_request *reqs;
+	int i, nr = 0;
+
+	reqs = xcalloc(packs->nr, sizeof(*reqs));
+	for (i = 0; i < packs->nr; i++) {
+		struct pack_index_request *req = &reqs[nr];
+
+		if (has_pack_index(packs->sha1[i]))
+			continue;
+		hashcpy(req->sha1, packs->sha1[i]);
+		if (start_pack_index_request(req, base_url)) {
+			if (req->file)
+				fclose(req->file);
+			strbuf_release(&req->tmpfile);
+			memset(req, 0, sizeof(*req));
+			break;
+		}
+		nr++;
+	}
+
+	for (i = 0; i < nr; i++) {
+		finish_pack_index_request(packs_head, &reqs[i]);
+		strbuf_release(&reqs[i].tmpfile);
+	}
+	free(reqs);
+}
+
 int http_get_info_packs(const char *base_url, struct packed_git **packs_head)
 {
 	int ret = 0, i = 0;
 	char *url, *data;
 	struct strbuf buf = STRBUF_INIT;
+	struct sha1_array packs = SHA1_ARRAY_INIT;
 	unsigned char sha1[20];
 
 	end_url_with_slash(&buf, base_url);
@@ -978,8 +1130,7 @@ int http_get_info_packs(const char *base_url, struct packed_git **packs_head)
 			    !prefixcmp(data + i, " pack-") &&
 			    !prefixcmp(data + i + 46, ".pack\n")) {
 				get_sha1_hex(data + i + 6, sha1);
-				fetch_and_setup_pack_index(packs_head, sha1,
-						      base_url);
+				sha1_array_append(&packs, sha1);
 				i += 51;
 				break;
 			}
@@ -990,7 +1141,22 @@ int http_get_info_packs(const char *base_url, struct packed_git **packs_head)
 		i++;
 	}
 
+	if (packs.nr > 1)
+		fetch_pack_indices(packs_head, &packs, base_url);
+	for (i = 0; i < packs.nr; i++) {
+		struct packed_git *p;
+
+		for (p = *packs_head; p; p = p->next)
+			if (!hashcmp(p->sha1, packs.sha1[i]))
+				break;
+		if (!p)
+			fetch_and_setup_pack_index(packs_head, packs.sha1[i],
+						   base_url);
+	}
+
 cleanup:
+	sha1_array_clear(&packs);
+	strbuf_release(&buf);
 	free(url);
 	return ret;
 }
@@ -91,6 +91,7 @@ extern void http_cleanup(void);
 
 extern int active_requests;
 extern int http_is_verbose;
+extern int http_auth_seen;
 extern size_t http_post_buffer;
 
 extern char curl_errorstr[CURL_ERROR_SIZE];
@@ -48,6 +48,7 @@ static struct commit *make_virtual_commit(struct tree *tree, const char *comment
 	commit->tree = tree;
 	commit->util = desc;
 	commit->object.parsed = 1;
+	commit->generation = GENERATION_NUMBER_INFINITY;
 	return commit;
 }
 
@@ -0,0 +1,582 @@
+#include "cache.h"
+#include "csum-file.h"
+#include "dir.h"
+#include "midx.h"
+
+/*
+ * See Documentation/technical/multi-pack-index-format.txt for the
+ * layout of the file.  All integers are stored in network byte order.
+ */
+#define MIDX_HEADER_SIZE	20
+#define MIDX_FANOUT_SIZE	(4 * 256)
+#define MIDX_OFFSET_WIDTH	8
+#define MIDX_LARGE_OFFSET	0x80000000
+
+struct multi_pack_index {
+	const unsigned char *data;
+	size_t data_len;
+	uint32_t num_packs;
+	uint32_t num_objects;
+	uint32_t num_large_offsets;
+	const char **pack_names;
+	const unsigned char *pack_checksums;
+	const uint32_t *fanout;
+	const unsigned char *sha1s;
+	const unsigned char *offsets;
+	const unsigned char *large_offsets;
+
+	/* the packs named above, once prepare_multi_pack_index() found them */
+	struct packed_git **packs;
+	/* 0: not checked yet, 1: matches the index, -1: does not */
+	signed char *pack_ok;
+};
+
+static struct multi_pack_index *midx;
+
+static const char *midx_path(void)
+{
+	static char *path;
+
+	if (!path)
+		path = xstrdup(mkpath("%s/pack/multi-pack-index",
+				      get_object_directory()));
+	return path;
+}
+
+static inline uint32_t midx_u32(const unsigned char *p)
+{
+	return ntohl(*(const uint32_t *)p);
+}
+
+static void free_midx(struct multi_pack_index *m)
+{
+	if (!m)
+		return;
+	munmap((void *)m->data, m->data_len);
+	free(m->pack_names);
+	free(m->packs);
+	free(m->pack_ok);
+	free(m);
+}
+
+static struct multi_pack_index *load_multi_pack_index(const char *path)
+{
+	struct multi_pack_index *m;
+	const unsigned char *data, *names, *names_end;
+	void *map;
+	size_t size;
+	uint32_t nr_packs, nr, nr_large, names_len, i, prev;
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	size = xsize_t(st.st_size);
+	if (size < MIDX_HEADER_SIZE + 4 + MIDX_FANOUT_SIZE + 20) {
+		close(fd);
+		error("multi-pack-index file %s is too small", path);
+		return NULL;
+	}
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	data = map;
+
+	if (midx_u32(data) != MIDX_SIGNATURE) {
+		error("multi-pack-index file %s has a bad signature", path);
+		goto bad;
+	}
+	if (midx_u32(data + 4) != MIDX_VERSION) {
+		error("multi-pack-index file %s is version %"PRIu32
+		      " and is not supported by this binary",
+		      path, midx_u32(data + 4));
+		goto bad;
+	}
+	nr_packs = midx_u32(data + 8);
+	nr = midx_u32(data + 12);
+	nr_large = midx_u32(data + 16);
+	names_len = midx_u32(data + MIDX_HEADER_SIZE);
+	if ((uint64_t)size != MIDX_HEADER_SIZE + 4 + (uint64_t)names_len +
+			      (uint64_t)nr_packs * 20 + MIDX_FANOUT_SIZE +
+			      (uint64_t)nr * (20 + MIDX_OFFSET_WIDTH) +
+			      (uint64_t)nr_large * 8 + 20) {
+		error("wrong multi-pack-index file size in %s", path);
+		goto bad;
+	}
+
+	m = xcalloc(1, sizeof(*m));
+	m->data = data;
+	m->data_len = size;
+	m->num_packs = nr_packs;
+	m->num_objects = nr;
+	m->num_large_offsets = nr_large;
+
+	names = data + MIDX_HEADER_SIZE + 4;
+	names_end = names + names_len;
+	m->pack_names = xcalloc(nr_packs, sizeof(*m->pack_names));
+	for (i = 0; i < nr_packs; i++) {
+		const unsigned char *end = memchr(names, '\0', names_end - names);
+		if (!end || end == names) {
+			error("corrupt pack names in multi-pack-index %s", path);
+			free(m->pack_names);
+			free(m);
+			goto bad;
+		}
+		m->pack_names[i] = (const char *)names;
+		names = end + 1;
+	}
+	m->pack_checksums = names_end;
+	m->fanout = (const uint32_t *)(m->pack_checksums + (size_t)nr_packs * 20);
+	m->sha1s = (const unsigned char *)m->fanout + MIDX_FANOUT_SIZE;
+	m->offsets = m->sha1s + (size_t)nr * 20;
+	m->large_offsets = m->offsets + (size_t)nr * MIDX_OFFSET_WIDTH;
+
+	for (i = prev = 0; i < 256; i++) {
+		uint32_t n = ntohl(m->fanout[i]);
+		if (n < prev) {
+			error("non-monotonic multi-pack-index %s", path);
+			free(m->pack_names);
+			free(m);
+			goto bad;
+		}
+		prev = n;
+	}
+	if (prev != nr) {
+		error("multi-pack-index fan-out does not match in %s", path);
+		free(m->pack_names);
+		free(m);
+		goto bad;
+	}
+
+	m->packs = xcalloc(nr_packs, sizeof(*m->packs));
+	m->pack_ok = xcalloc(nr_packs, sizeof(*m->pack_ok));
+	return m;
+
+bad:
+	munmap(map, size);
+	return NULL;
+}
+
+/*
+ * Find the packed_git for each pack named in the index.  Returns -1
+ * if one of them is not there (any more).
+ */
+static int find_midx_packs(struct multi_pack_index *m)
+{
+	struct strbuf name = STRBUF_INIT;
+	uint32_t i;
+	int ret = 0;
+
+	for (i = 0; i < m->num_packs; i++) {
+		const char *idx_name = m->pack_names[i];
+		size_t len = strlen(idx_name);
+		struct packed_git *p;
+
+		if (len < 4 || strcmp(idx_name + len - 4, ".idx")) {
+			ret = -1;
+			break;
+		}
+		strbuf_reset(&name);
+		strbuf_addf(&name, "%s/pack/%.*s.pack", get_object_directory(),
+			    (int)(len - 4), idx_name);
+		for (p = packed_git; p; p = p->next)
+			if (p->pack_local && !strcmp(p->pack_name, name.buf))
+				break;
+		if (!p) {
+			ret = -1;
+			break;
+		}
+		m->packs[i] = p;
+	}
+	strbuf_release(&name);
+	return ret;
+}
+
+void prepare_multi_pack_index(void)
+{
+	uint32_t i;
+
+	if (midx || !core_multi_pack_index)
+		return;
+	midx = load_multi_pack_index(midx_path());
+	if (!midx)
+		return;
+	if (find_midx_packs(midx)) {
+		/* stale; the packs will be searched one by one */
+		free_midx(midx);
+		midx = NULL;
+		return;
+	}
+	for (i = 0; i < midx->num_packs; i++)
+		midx->packs[i]->multi_pack_index = 1;
+}
+
+void close_multi_pack_index(void)
+{
+	uint32_t i;
+
+	if (!midx)
+		return;
+	for (i = 0; i < midx->num_packs; i++)
+		if (midx->packs[i])
+			midx->packs[i]->multi_pack_index = 0;
+	free_midx(midx);
+	midx = NULL;
+}
+
+static int midx_pos(const struct multi_pack_index *m, const unsigned char *sha1,
+		    uint32_t *pos)
+{
+	uint32_t lo, hi;
+
+	hi = ntohl(m->fanout[*sha1]);
+	lo = *sha1 ? ntohl(m->fanout[*sha1 - 1]) : 0;
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(m->sha1s + 20 * mi, sha1);
+
+		if (!cmp) {
+			*pos = mi;
+			return 1;
+		}
+		if (cmp > 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return 0;
+}
+
+static off_t midx_offset(const struct multi_pack_index *m, uint32_t pos,
+			 uint32_t *pack_id)
+{
+	const unsigned char *p = m->offsets + MIDX_OFFSET_WIDTH * pos;
+	uint32_t offset = midx_u32(p + 4);
+
+	*pack_id = midx_u32(p);
+	if (!(offset & MIDX_LARGE_OFFSET))
+		return offset;
+	offset &= ~MIDX_LARGE_OFFSET;
+	if (offset >= m->num_large_offsets)
+		return 0;
+	p = m->large_offsets + 8 * offset;
+	return ((off_t)midx_u32(p) << 32) | midx_u32(p + 4);
+}
+
+static const unsigned char *pack_checksum(struct packed_git *p)
+{
+	return (const unsigned char *)p->index_data + p->index_size - 40;
+}
+
+/*
+ * A pack can be rewritten under the same name with its objects at
+ * different offsets, so compare its checksum to the one we recorded
+ * before trusting our offsets into it.
+ */
+static int midx_pack_ok(struct multi_pack_index *m, uint32_t pack_id)
+{
+	struct packed_git *p = m->packs[pack_id];
+
+	if (!m->pack_ok[pack_id]) {
+		if (open_pack_index(p) || !is_pack_valid(p) ||
+		    hashcmp(pack_checksum(p), m->pack_checksums + 20 * pack_id))
+			m->pack_ok[pack_id] = -1;
+		else
+			m->pack_ok[pack_id] = 1;
+	}
+	return m->pack_ok[pack_id] > 0;
+}
+
+int fill_midx_entry(const unsigned char *sha1, struct pack_entry *e)
+{
+	struct packed_git *p;
+	uint32_t pos, pack_id, i;
+	off_t offset;
+
+	if (!midx || !midx_pos(midx, sha1, &pos))
+		return 0;
+	offset = midx_offset(midx, pos, &pack_id);
+	if (!offset || pack_id >= midx->num_packs ||
+	    !midx_pack_ok(midx, pack_id))
+		return -1;
+
+	p = midx->packs[pack_id];
+	for (i = 0; i < p->num_bad_objects; i++)
+		if (!hashcmp(sha1, p->bad_object_sha1 + 20 * i))
+			return -1;
+	/* the pack may have been deleted since we checked it */
+	if (!is_pack_valid(p)) {
+		warning("packfile %s cannot be accessed", p->pack_name);
+		return -1;
+	}
+	e->offset = offset;
+	e->p = p;
+	hashcpy(e->sha1, sha1);
+	return 1;
+}
+
+/*
+ * Writing.
+ */
+
+struct midx_pack {
+	struct packed_git *p;
+	const char *idx_name;
+	uint32_t nr_picked;
+	unsigned expire:1;
+};
+
+struct midx_entry {
+	unsigned char sha1[20];
+	uint32_t pack_id;
+	off_t offset;
+	time_t mtime;
+};
+
+static int midx_pack_cmp(const void *a_, const void *b_)
+{
+	const struct midx_pack *a = a_, *b = b_;
+	return strcmp(a->idx_name, b->idx_name);
+}
+
+/*
+ * Sort by object name, and for duplicates prefer the younger pack,
+ * like find_pack_entry() does.
+ */
+static int midx_entry_cmp(const void *a_, const void *b_)
+{
+	const struct midx_entry *a = a_, *b = b_;
+	int cmp = hashcmp(a->sha1, b->sha1);
+
+	if (cmp)
+		return cmp;
+	if (a->mtime != b->mtime)
+		return a->mtime < b->mtime ? 1 : -1;
+	return a->pack_id < b->pack_id ? -1 : a->pack_id > b->pack_id;
+}
+
+static void write_u32(struct sha1file *f, uint32_t v)
+{
+	v = htonl(v);
+	sha1write(f, &v, 4);
+}
+
+int write_multi_pack_index(int expire)
+{
+	static struct lock_file lock;
+	struct midx_pack *packs = NULL;
+	struct midx_entry *entries = NULL;
+	uint32_t *remap;
+	uint32_t nr_packs = 0, alloc_packs = 0, nr_kept, nr = 0, alloc = 0;
+	uint32_t nr_large = 0, names_len = 0, fanout[256], i, j;
+	struct packed_git *p;
+	struct sha1file *f;
+	int fd;
+
+	prepare_packed_git();
+	for (p = packed_git; p; p = p->next) {
+		const char *slash;
+
+		if (!p->pack_local)
+			continue;
+		if (open_pack_index(p))
+			return error("unable to open index for %s", p->pack_name);
+		ALLOC_GROW(packs, nr_packs + 1, alloc_packs);
+		slash = strrchr(p->pack_name, '/');
+		packs[nr_packs].p = p;
+		packs[nr_packs].idx_name =
+			xstrdup(mkpath("%.*s.idx",
+				       (int)strlen(slash + 1) - 5, slash + 1));
+		packs[nr_packs].nr_picked = 0;
+		packs[nr_packs].expire = 0;
+		nr_packs++;
+	}
+	qsort(packs, nr_packs, sizeof(*packs), midx_pack_cmp);
+
+	for (i = 0; i < nr_packs; i++) {
+		p = packs[i].p;
+		ALLOC_GROW(entries, nr + p->num_objects, alloc);
+		for (j = 0; j < p->num_objects; j++) {
+			struct midx_entry *e = &entries[nr++];
+			hashcpy(e->sha1, nth_packed_object_sha1(p, j));
+			e->offset = nth_packed_object_offset(p, j);
+			e->pack_id = i;
+			e->mtime = p->mtime;
+		}
+	}
+	qsort(entries, nr, sizeof(*entries), midx_entry_cmp);
+
+	/* keep the preferred copy of each object */
+	for (i = j = 0; i < nr; i++) {
+		if (j && !hashcmp(entries[j - 1].sha1, entries[i].sha1))
+			continue;
+		entries[j++] = entries[i];
+		packs[entries[i].pack_id].nr_picked++;
+	}
+	nr = j;
+
+	/* drop the packs that are left without objects, if asked to */
+	remap = xmalloc(nr_packs * sizeof(*remap));
+	for (i = nr_kept = 0; i < nr_packs; i++) {
+		if (expire && !packs[i].nr_picked && !packs[i].p->pack_keep) {
+			packs[i].expire = 1;
+			continue;
+		}
+		remap[i] = nr_kept++;
+		names_len += strlen(packs[i].idx_name) + 1;
+	}
+	names_len = (names_len + 3) & ~3;
+
+	memset(fanout, 0, sizeof(fanout));
+	for (i = 0; i < nr; i++) {
+		fanout[entries[i].sha1[0]]++;
+		if (entries[i].offset >= MIDX_LARGE_OFFSET)
+			nr_large++;
+	}
+	for (i = 1; i < 256; i++)
+		fanout[i] += fanout[i - 1];
+
+	if (safe_create_leading_directories_const(midx_path()))
+		die("unable to create leading directories of %s", midx_path());
+	fd = hold_lock_file_for_update(&lock, midx_path(), LOCK_DIE_ON_ERROR);
+	f = sha1fd(fd, lock.filename);
+
+	write_u32(f, MIDX_SIGNATURE);
+	write_u32(f, MIDX_VERSION);
+	write_u32(f, nr_kept);
+	write_u32(f, nr);
+	write_u32(f, nr_large);
+
+	write_u32(f, names_len);
+	for (i = j = 0; i < nr_packs; i++) {
+		if (packs[i].expire)
+			continue;
+		sha1write(f, (void *)packs[i].idx_name,
+			  strlen(packs[i].idx_name) + 1);
+		j += strlen(packs[i].idx_name) + 1;
+	}
+	for (; j < names_len; j++)
+		sha1write(f, "", 1);
+	for (i = 0; i < nr_packs; i++)
+		if (!packs[i].expire)
+			sha1write(f, (void *)pack_checksum(packs[i].p), 20);
+
+	for (i = 0; i < 256; i++)
+		write_u32(f, fanout[i]);
+	for (i = 0; i < nr; i++)
+		sha1write(f, entries[i].sha1, 20);
+	for (i = j = 0; i < nr; i++) {
+		write_u32(f, remap[entries[i].pack_id]);
+		if (entries[i].offset < MIDX_LARGE_OFFSET)
+			write_u32(f, entries[i].offset);
+		else
+			write_u32(f, MIDX_LARGE_OFFSET | j++);
+	}
+	for (i = 0; i < nr; i++) {
+		if (entries[i].offset < MIDX_LARGE_OFFSET)
+			continue;
+		write_u32(f, entries[i].offset >> 32);
+		write_u32(f, entries[i].offset & 0xffffffff);
+	}
+
+	sha1close(f, NULL, CSUM_FSYNC);
+	lock.fd = -1; /* closed by sha1close() */
+	if (adjust_shared_perm(lock.filename))
+		die_errno("unable to make multi-pack-index readable");
+	if (commit_lock_file(&lock) < 0)
+		die_errno("unable to write multi-pack-index file %s",
+			  midx_path());
+
+	/* only now that nothing refers to them can the packs go */
+	for (i = 0; i < nr_packs; i++) {
+		static const char *exts[] = { ".pack", ".idx", ".bitmap" };
+		struct strbuf name = STRBUF_INIT;
+		size_t base_len;
+
+		if (!packs[i].expire)
+			continue;
+		strbuf_addstr(&name, packs[i].p->pack_name);
+		base_len = name.len - strlen(".pack");
+		for (j = 0; j < ARRAY_SIZE(exts); j++) {
+			strbuf_setlen(&name, base_len);
+			strbuf_addstr(&name, exts[j]);
+			if (unlink(name.buf) && errno != ENOENT)
+				error("unable to remove %s: %s",
+				      name.buf, strerror(errno));
+		}
+		strbuf_release(&name);
+	}
+
+	for (i = 0; i < nr_packs; i++)
+		free((char *)packs[i].idx_name);
+	free(packs);
+	free(entries);
+	free(remap);
+	return 0;
+}
+
+int verify_multi_pack_index(void)
+{
+	struct multi_pack_index *m;
+	unsigned char sha1[20];
+	git_SHA_CTX ctx;
+	uint32_t i;
+	int errors = 0;
+
+	m = load_multi_pack_index(midx_path());
+	if (!m)
+		return file_exists(midx_path());
+
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, m->data, m->data_len - 20);
+	git_SHA1_Final(sha1, &ctx);
+	if (hashcmp(sha1, m->data + m->data_len - 20)) {
+		error("multi-pack-index checksum mismatch");
+		errors++;
+	}
+
+	prepare_packed_git();
+	if (find_midx_packs(m)) {
+		error("multi-pack-index refers to a missing pack");
+		free_midx(m);
+		return errors + 1;
+	}
+	for (i = 0; i < m->num_packs; i++) {
+		if (open_pack_index(m->packs[i]) ||
+		    hashcmp(pack_checksum(m->packs[i]), m->pack_checksums + 20 * i)) {
+			error("multi-pack-index does not match pack %s",
+			      m->pack_names[i]);
+			free_midx(m);
+			return errors + 1;
+		}
+	}
+
+	for (i = 0; i < m->num_objects; i++) {
+		const unsigned char *cur = m->sha1s + 20 * i;
+		uint32_t pack_id;
+		off_t offset = midx_offset(m, i, &pack_id);
+
+		if (i && hashcmp(cur - 20, cur) >= 0) {
+			error("multi-pack-index is not sorted at %s",
+			      sha1_to_hex(cur));
+			errors++;
+		}
+		if (pack_id >= m->num_packs) {
+			error("multi-pack-index has a bad pack for %s",
+			      sha1_to_hex(cur));
+			errors++;
+			continue;
+		}
+		if (!offset || find_pack_entry_one(cur, m->packs[pack_id]) != offset) {
+			error("multi-pack-index has a wrong offset for %s",
+			      sha1_to_hex(cur));
+			errors++;
+		}
+	}
+
+	free_midx(m);
+	return errors;
+}
@@ -0,0 +1,40 @@
+#ifndef MIDX_H
+#define MIDX_H
+
+#define MIDX_SIGNATURE 0x4d494458 /* "MIDX" */
+#define MIDX_VERSION 1
+
+struct pack_entry;
+
+/*
+ * Load $GIT_OBJECT_DIRECTORY/pack/multi-pack-index, if there is one
+ * and it is usable, and mark the packs it covers.  Called by
+ * prepare_packed_git() once the local packs are known.
+ */
+extern void prepare_multi_pack_index(void);
+
+/*
+ * Look "sha1" up in the multi-pack index.  Returns 1 and fills "e" if
+ * it is found, 0 if it is not in any of the packs the index covers,
+ * and -1 if the index points to a pack that cannot be used, in which
+ * case the caller has to search all packs.
+ */
+extern int fill_midx_entry(const unsigned char *sha1, struct pack_entry *e);
+
+/*
+ * Write a multi-pack index covering all local packs.  With "expire",
+ * packs none of whose objects are picked by the index (because all of
+ * them are in other packs too) are left out and deleted, unless they
+ * have a .keep file.
+ */
+extern int write_multi_pack_index(int expire);
+
+/*
+ * Check the checksum and the contents of the multi-pack index against
+ * the packs.  Returns the number of problems found.
+ */
+extern int verify_multi_pack_index(void);
+
+extern void close_multi_pack_index(void);
+
+#endif /* MIDX_H */
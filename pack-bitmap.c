@@ -0,0 +1,701 @@
+#include "cache.h"
+#include "commit.h"
+#include "tag.h"
+#include "tree-walk.h"
+#include "diff.h"
+#include "revision.h"
+#include "refs.h"
+#include "decorate.h"
+#include "progress.h"
+#include "csum-file.h"
+#include "pack.h"
+#include "pack-revindex.h"
+#include "pack-bitmap.h"
+#include "ewah/ewok.h"
+
+/*
+ * See Documentation/technical/bitmap-format.txt for the layout of the
+ * .bitmap file.  A bit position is the position of the object in the
+ * pack, i.e. objects are numbered in the order of their offsets.
+ */
+#define BITMAP_HEADER_SIZE	32
+
+/* Write a bitmap for one in this many commits, besides the ref tips. */
+#define BITMAP_COMMIT_INTERVAL	100
+
+struct stored_bitmap {
+	const unsigned char *map; /* serialized form, if not yet loaded */
+	size_t map_len;
+	struct ewah_bitmap *bitmap;
+};
+
+struct bitmap_index {
+	struct packed_git *pack;
+
+	unsigned char *map;
+	size_t map_size;
+
+	/* objects of each type, by pack position */
+	struct bitmap *commits;
+	struct bitmap *trees;
+	struct bitmap *blobs;
+	struct bitmap *tags;
+
+	/* name hash of each object, by pack position */
+	const unsigned char *name_hashes;
+
+	/* commit -> struct stored_bitmap */
+	struct decoration stored;
+
+	/* the answer computed by prepare_bitmap_walk() */
+	struct bitmap *result;
+};
+
+static struct bitmap_index bitmap_git;
+
+static int find_object_pos(struct bitmap_index *bi, const unsigned char *sha1)
+{
+	off_t offset = find_pack_entry_one(sha1, bi->pack);
+
+	if (!offset)
+		return -1;
+	return find_revindex_position(bi->pack, offset);
+}
+
+static struct ewah_bitmap *lookup_stored_bitmap(struct bitmap_index *bi,
+						struct commit *commit)
+{
+	struct stored_bitmap *st = lookup_decoration(&bi->stored, &commit->object);
+
+	if (!st)
+		return NULL;
+	if (!st->bitmap) {
+		st->bitmap = ewah_new();
+		if (ewah_read_mmap(st->bitmap, st->map, st->map_len) < 0)
+			die("corrupt bitmap for commit %s in %s",
+			    sha1_to_hex(commit->object.sha1),
+			    bi->pack->pack_name);
+	}
+	return st->bitmap;
+}
+
+static int seen_pos(const struct bitmap *base, const struct bitmap *seen, int pos)
+{
+	return bitmap_get(base, pos) || (seen && bitmap_get(seen, pos));
+}
+
+/*
+ * Set the bits of all objects reachable from the tree "sha1" in
+ * "base", except those that are already set in "base" or "seen".
+ * Both are closed under reachability, so a tree whose bit is set
+ * does not have to be looked into.
+ */
+static int add_tree_to_bitmap(struct bitmap_index *bi, struct bitmap *base,
+			      const struct bitmap *seen,
+			      const unsigned char *sha1)
+{
+	struct tree_desc desc;
+	struct name_entry entry;
+	enum object_type type;
+	unsigned long size;
+	void *buf = read_sha1_file(sha1, &type, &size);
+	int ret = 0;
+
+	if (!buf || type != OBJ_TREE) {
+		free(buf);
+		return error("unable to read tree %s", sha1_to_hex(sha1));
+	}
+	init_tree_desc(&desc, buf, size);
+	while (tree_entry(&desc, &entry)) {
+		int pos;
+
+		if (S_ISGITLINK(entry.mode))
+			continue;
+		pos = find_object_pos(bi, entry.sha1);
+		if (pos < 0) {
+			ret = -1;
+			break;
+		}
+		if (seen_pos(base, seen, pos))
+			continue;
+		bitmap_set(base, pos);
+		if (S_ISDIR(entry.mode) &&
+		    add_tree_to_bitmap(bi, base, seen, entry.sha1)) {
+			ret = -1;
+			break;
+		}
+	}
+	free(buf);
+	return ret;
+}
+
+static int add_commit_to_bitmap(struct bitmap_index *bi, struct bitmap *base,
+				const struct bitmap *seen, struct commit *tip)
+{
+	struct commit_list *stack = NULL, *walked = NULL;
+	int ret = 0;
+
+	commit_list_insert(tip, &stack);
+	while (stack) {
+		struct commit *commit = pop_commit(&stack);
+		struct commit_list *parent;
+		struct ewah_bitmap *stored;
+		int pos = find_object_pos(bi, commit->object.sha1);
+
+		if (pos < 0) {
+			ret = -1;
+			goto out;
+		}
+		if (seen_pos(base, seen, pos))
+			continue;
+		stored = lookup_stored_bitmap(bi, commit);
+		if (stored) {
+			bitmap_or_ewah(base, stored);
+			continue;
+		}
+		if (parse_commit(commit)) {
+			ret = -1;
+			goto out;
+		}
+		bitmap_set(base, pos);
+		commit_list_insert(commit, &walked);
+		for (parent = commit->parents; parent; parent = parent->next)
+			commit_list_insert(parent->item, &stack);
+	}
+
+	/*
+	 * Trees are only looked at once the commits are done, so that
+	 * the trees of ancestors with a stored bitmap are already set
+	 * and shared subtrees do not have to be read.
+	 */
+	while (walked) {
+		struct commit *commit = pop_commit(&walked);
+		const unsigned char *tree = commit->tree->object.sha1;
+		int pos = find_object_pos(bi, tree);
+
+		if (pos < 0) {
+			ret = -1;
+			goto out;
+		}
+		if (seen_pos(base, seen, pos))
+			continue;
+		bitmap_set(base, pos);
+		if (add_tree_to_bitmap(bi, base, seen, tree)) {
+			ret = -1;
+			goto out;
+		}
+	}
+
+out:
+	free_commit_list(stack);
+	free_commit_list(walked);
+	return ret;
+}
+
+/*
+ * Set the bits of everything reachable from "obj" in "base".  Returns
+ * -1 if some of these objects are not in the bitmapped pack.
+ */
+static int add_object_to_bitmap(struct bitmap_index *bi, struct bitmap *base,
+				const struct bitmap *seen, struct object *obj)
+{
+	int pos;
+
+	while (obj->type == OBJ_TAG) {
+		pos = find_object_pos(bi, obj->sha1);
+		if (pos < 0)
+			return -1;
+		bitmap_set(base, pos);
+		if (parse_object(obj->sha1) != obj)
+			return -1;
+		obj = ((struct tag *)obj)->tagged;
+		if (!obj)
+			return -1;
+	}
+
+	if (obj->type == OBJ_NONE && !parse_object(obj->sha1))
+		return -1;
+	if (obj->type == OBJ_COMMIT)
+		return add_commit_to_bitmap(bi, base, seen, (struct commit *)obj);
+
+	pos = find_object_pos(bi, obj->sha1);
+	if (pos < 0)
+		return -1;
+	if (seen_pos(base, seen, pos))
+		return 0;
+	bitmap_set(base, pos);
+	if (obj->type == OBJ_TREE)
+		return add_tree_to_bitmap(bi, base, seen, obj->sha1);
+	return 0;
+}
+
+static const char *bitmap_path(struct packed_git *p)
+{
+	static struct strbuf path = STRBUF_INIT;
+	size_t len = strlen(p->pack_name);
+
+	strbuf_reset(&path);
+	if (len < 5 || strcmp(p->pack_name + len - 5, ".pack"))
+		return NULL;
+	len -= 5;
+	strbuf_add(&path, p->pack_name, len);
+	strbuf_addstr(&path, ".bitmap");
+	return path.buf;
+}
+
+static struct bitmap *read_type_bitmap(struct bitmap_index *bi,
+				       const unsigned char **ptr,
+				       const unsigned char *end)
+{
+	struct ewah_bitmap *ewah = ewah_new();
+	struct bitmap *bitmap = NULL;
+	ssize_t len = ewah_read_mmap(ewah, *ptr, end - *ptr);
+
+	if (len >= 0 &&
+	    ewah->bit_size <= ((uint64_t)bi->pack->num_objects + BITS_IN_EWORD)) {
+		bitmap = bitmap_new();
+		bitmap_or_ewah(bitmap, ewah);
+		*ptr += len;
+	}
+	ewah_free(ewah);
+	return bitmap;
+}
+
+static int load_bitmap_index(struct bitmap_index *bi, struct packed_git *p)
+{
+	const char *path = bitmap_path(p);
+	const unsigned char *ptr, *end;
+	const uint32_t *hdr;
+	uint32_t i, nr;
+	struct stat st;
+	int fd;
+
+	if (!path)
+		return -1;
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+	if (open_pack_index(p)) {
+		close(fd);
+		return -1;
+	}
+
+	bi->pack = p;
+	bi->map_size = xsize_t(st.st_size);
+	if (bi->map_size < BITMAP_HEADER_SIZE + 20) {
+		close(fd);
+		return error("bitmap file %s is too small", path);
+	}
+	bi->map = xmmap(NULL, bi->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	hdr = (const uint32_t *)bi->map;
+	if (ntohl(hdr[0]) != BITMAP_SIGNATURE) {
+		error("bitmap file %s has a bad signature", path);
+		goto bad;
+	}
+	if (ntohl(hdr[1]) != BITMAP_VERSION) {
+		error("bitmap file %s is version %"PRIu32
+		      " and is not supported by this binary",
+		      path, ntohl(hdr[1]));
+		goto bad;
+	}
+	nr = ntohl(hdr[2]);
+	if (hashcmp(bi->map + 12,
+		    (const unsigned char *)p->index_data + p->index_size - 40)) {
+		error("bitmap file %s does not match its pack", path);
+		goto bad;
+	}
+
+	ptr = bi->map + BITMAP_HEADER_SIZE;
+	end = bi->map + bi->map_size - 20;
+	if (!(bi->commits = read_type_bitmap(bi, &ptr, end)) ||
+	    !(bi->trees = read_type_bitmap(bi, &ptr, end)) ||
+	    !(bi->blobs = read_type_bitmap(bi, &ptr, end)) ||
+	    !(bi->tags = read_type_bitmap(bi, &ptr, end))) {
+		error("corrupt type bitmaps in %s", path);
+		goto bad;
+	}
+
+	if (end - ptr < (ptrdiff_t)p->num_objects * 4) {
+		error("truncated bitmap file %s", path);
+		goto bad;
+	}
+	bi->name_hashes = ptr;
+	ptr += (size_t)p->num_objects * 4;
+
+	for (i = 0; i < nr; i++) {
+		struct stored_bitmap *st;
+		struct commit *commit;
+		size_t len;
+
+		if (end - ptr < 20 + 8) {
+			error("truncated bitmap file %s", path);
+			goto bad;
+		}
+		/* bit size, word count, words and the last RLW position */
+		len = 8 + (size_t)ntohl(*(uint32_t *)(ptr + 24)) * 8 + 4;
+		if (end - ptr - 20 < len) {
+			error("truncated bitmap file %s", path);
+			goto bad;
+		}
+		commit = lookup_commit(ptr);
+		if (!commit) {
+			error("bitmap file %s names a non-commit", path);
+			goto bad;
+		}
+		st = xcalloc(1, sizeof(*st));
+		st->map = ptr + 20;
+		st->map_len = len;
+		add_decoration(&bi->stored, &commit->object, st);
+		ptr += 20 + len;
+	}
+	if (ptr != end) {
+		error("garbage at the end of bitmap file %s", path);
+		goto bad;
+	}
+	return 0;
+
+bad:
+	for (i = 0; i < bi->stored.size; i++)
+		free(bi->stored.hash[i].decoration);
+	free(bi->stored.hash);
+	memset(&bi->stored, 0, sizeof(bi->stored));
+	bitmap_free(bi->commits);
+	bitmap_free(bi->trees);
+	bitmap_free(bi->blobs);
+	bitmap_free(bi->tags);
+	bi->commits = bi->trees = bi->blobs = bi->tags = NULL;
+	munmap(bi->map, bi->map_size);
+	bi->map = NULL;
+	return -1;
+}
+
+static int open_bitmap_index(struct bitmap_index *bi)
+{
+	struct packed_git *p;
+
+	if (bi->map)
+		return 0;
+	if (has_commit_grafts() || is_repository_shallow())
+		return -1;
+
+	prepare_packed_git();
+	for (p = packed_git; p; p = p->next)
+		if (p->pack_local && !load_bitmap_index(bi, p))
+			return 0;
+	return -1;
+}
+
+int prepare_bitmap_walk(struct rev_info *revs)
+{
+	struct bitmap_index *bi = &bitmap_git;
+	struct bitmap *wants, *haves;
+	unsigned int i;
+
+	if (open_bitmap_index(bi))
+		return -1;
+
+	/*
+	 * Objects reachable from the uninteresting tips are found first,
+	 * so that the walk from the interesting ones can stop there.  An
+	 * uninteresting tip outside the pack can simply be ignored: we
+	 * may send a bit more than needed, but nothing is missing.
+	 */
+	haves = bitmap_new();
+	for (i = 0; i < revs->pending.nr; i++) {
+		struct object *obj = revs->pending.objects[i].item;
+
+		if (!(obj->flags & UNINTERESTING))
+			continue;
+		if (find_object_pos(bi, obj->sha1) < 0)
+			continue;
+		if (add_object_to_bitmap(bi, haves, NULL, obj)) {
+			bitmap_free(haves);
+			return -1;
+		}
+	}
+
+	wants = bitmap_new();
+	for (i = 0; i < revs->pending.nr; i++) {
+		struct object *obj = revs->pending.objects[i].item;
+
+		if (obj->flags & UNINTERESTING)
+			continue;
+		if (add_object_to_bitmap(bi, wants, haves, obj)) {
+			bitmap_free(haves);
+			bitmap_free(wants);
+			return -1;
+		}
+	}
+
+	bitmap_and_not(wants, haves);
+	bitmap_free(haves);
+	bitmap_free(bi->result);
+	bi->result = wants;
+	return 0;
+}
+
+uint32_t reuse_partial_packfile_from_bitmap(struct packed_git **packfile,
+					    off_t *up_to)
+{
+	struct bitmap_index *bi = &bitmap_git;
+	struct bitmap *result = bi->result;
+	uint32_t reuse = 0;
+	size_t i;
+
+	if (!result)
+		return 0;
+	for (i = 0; i < result->word_alloc; i++) {
+		eword_t word = result->words[i];
+
+		if (word == ~(eword_t)0) {
+			reuse += BITS_IN_EWORD;
+			result->words[i] = 0;
+			continue;
+		}
+		for (; word & 1; word >>= 1) {
+			result->words[i] &= ~((eword_t)1 << (reuse % BITS_IN_EWORD));
+			reuse++;
+		}
+		break;
+	}
+	if (reuse > bi->pack->num_objects)
+		die("bitmap for %s refers to objects past the end",
+		    bi->pack->pack_name);
+
+	/*
+	 * pack-objects writes delta bases before the deltas, so the
+	 * objects in the run do not depend on anything that comes later
+	 * in the pack.
+	 */
+	*packfile = bi->pack;
+	*up_to = nth_pack_revindex(bi->pack, reuse)->offset;
+	return reuse;
+}
+
+static enum object_type bitmap_type(struct bitmap_index *bi, uint32_t pos)
+{
+	if (bitmap_get(bi->commits, pos))
+		return OBJ_COMMIT;
+	if (bitmap_get(bi->trees, pos))
+		return OBJ_TREE;
+	if (bitmap_get(bi->blobs, pos))
+		return OBJ_BLOB;
+	if (bitmap_get(bi->tags, pos))
+		return OBJ_TAG;
+	return OBJ_NONE;
+}
+
+void traverse_bitmap_commit_list(show_reachable_fn show)
+{
+	struct bitmap_index *bi = &bitmap_git;
+	struct packed_git *p = bi->pack;
+	size_t i;
+
+	if (!bi->result)
+		die("BUG: traverse_bitmap_commit_list without a prepared walk");
+
+	for (i = 0; i < bi->result->word_alloc; i++) {
+		eword_t word = bi->result->words[i];
+		uint32_t pos = i * BITS_IN_EWORD;
+
+		for (; word; word >>= 1, pos++) {
+			struct revindex_entry *entry;
+			enum object_type type;
+			const unsigned char *sha1;
+
+			if (!(word & 1))
+				continue;
+			if (pos >= p->num_objects)
+				die("bitmap for %s refers to objects past the end",
+				    p->pack_name);
+			entry = nth_pack_revindex(p, pos);
+			sha1 = nth_packed_object_sha1(p, entry->nr);
+			type = bitmap_type(bi, pos);
+			if (type == OBJ_NONE)
+				type = sha1_object_info(sha1, NULL);
+			show(sha1, type,
+			     ntohl(*(uint32_t *)(bi->name_hashes + 4 * pos)),
+			     p, entry->offset);
+		}
+	}
+
+	bitmap_free(bi->result);
+	bi->result = NULL;
+}
+
+/*
+ * Writing.
+ */
+
+struct selected_commit {
+	uint32_t pos;
+	struct commit *commit;
+	struct ewah_bitmap *bitmap;
+};
+
+struct ref_tips {
+	struct bitmap_index *bi;
+	struct bitmap *tips;
+};
+
+static int mark_ref_tip(const char *refname, const unsigned char *sha1,
+			int flags, void *data)
+{
+	struct ref_tips *rt = data;
+	struct object *obj = deref_tag(parse_object(sha1), refname, 0);
+	int pos;
+
+	if (!obj || obj->type != OBJ_COMMIT)
+		return 0;
+	pos = find_object_pos(rt->bi, obj->sha1);
+	if (pos >= 0)
+		bitmap_set(rt->tips, pos);
+	return 0;
+}
+
+static void write_type_bitmap(struct sha1file *f, struct strbuf *buf,
+			      const enum object_type *types, uint32_t nr,
+			      enum object_type type)
+{
+	struct bitmap *bitmap = bitmap_new();
+	struct ewah_bitmap *ewah;
+	uint32_t i;
+
+	for (i = 0; i < nr; i++)
+		if (types[i] == type)
+			bitmap_set(bitmap, i);
+	ewah = bitmap_to_ewah(bitmap);
+	strbuf_reset(buf);
+	ewah_serialize_strbuf(ewah, buf);
+	sha1write(f, buf->buf, buf->len);
+	ewah_free(ewah);
+	bitmap_free(bitmap);
+}
+
+int write_bitmap_index(const char *filename, struct packed_git *pack,
+		       const enum object_type *types,
+		       const uint32_t *name_hashes, int show_progress)
+{
+	static struct lock_file lock;
+	struct bitmap_index bi;
+	struct ref_tips rt;
+	struct selected_commit *selected = NULL;
+	int nr_selected = 0, alloc_selected = 0, nr_commits = 0;
+	struct progress *progress = NULL;
+	struct strbuf buf = STRBUF_INIT;
+	struct sha1file *f;
+	uint32_t i, hdr[3];
+	int fd, ret = -1;
+
+	if (has_commit_grafts() || is_repository_shallow())
+		return error("not writing bitmaps in a repository with grafts");
+
+	memset(&bi, 0, sizeof(bi));
+	bi.pack = pack;
+	if (open_pack_index(pack))
+		return error("unable to open index for %s", pack->pack_name);
+
+	/*
+	 * Pick the commits to store bitmaps for: every ref tip, and one
+	 * in BITMAP_COMMIT_INTERVAL of the others.  Commits appear in
+	 * the pack in revision walk order, newest first, so walking the
+	 * pack backwards computes ancestors first and their bitmaps can
+	 * be reused by the descendants.
+	 */
+	rt.bi = &bi;
+	rt.tips = bitmap_new();
+	for_each_ref(mark_ref_tip, &rt);
+	i = pack->num_objects;
+	while (i--) {
+		const unsigned char *sha1;
+
+		if (types[i] != OBJ_COMMIT)
+			continue;
+		if (nr_commits++ % BITMAP_COMMIT_INTERVAL &&
+		    !bitmap_get(rt.tips, i))
+			continue;
+		sha1 = nth_packed_object_sha1(pack, nth_pack_revindex(pack, i)->nr);
+		ALLOC_GROW(selected, nr_selected + 1, alloc_selected);
+		selected[nr_selected].pos = i;
+		selected[nr_selected].commit = lookup_commit(sha1);
+		selected[nr_selected].bitmap = NULL;
+		if (!selected[nr_selected].commit)
+			goto out;
+		nr_selected++;
+	}
+
+	if (show_progress)
+		progress = start_progress("Building bitmaps", nr_selected);
+	for (i = 0; i < nr_selected; i++) {
+		struct bitmap *base = bitmap_new();
+		struct stored_bitmap *st;
+
+		if (add_commit_to_bitmap(&bi, base, NULL, selected[i].commit)) {
+			bitmap_free(base);
+			error("pack %s is not closed under reachability",
+			      pack->pack_name);
+			goto out;
+		}
+		selected[i].bitmap = bitmap_to_ewah(base);
+		bitmap_free(base);
+
+		st = xcalloc(1, sizeof(*st));
+		st->bitmap = selected[i].bitmap;
+		add_decoration(&bi.stored, &selected[i].commit->object, st);
+		display_progress(progress, i + 1);
+	}
+	stop_progress(&progress);
+
+	fd = hold_lock_file_for_update(&lock, filename, LOCK_DIE_ON_ERROR);
+	f = sha1fd(fd, lock.filename);
+
+	hdr[0] = htonl(BITMAP_SIGNATURE);
+	hdr[1] = htonl(BITMAP_VERSION);
+	hdr[2] = htonl(nr_selected);
+	sha1write(f, hdr, sizeof(hdr));
+	sha1write(f, (unsigned char *)pack->index_data +
+		  pack->index_size - 40, 20);
+
+	write_type_bitmap(f, &buf, types, pack->num_objects, OBJ_COMMIT);
+	write_type_bitmap(f, &buf, types, pack->num_objects, OBJ_TREE);
+	write_type_bitmap(f, &buf, types, pack->num_objects, OBJ_BLOB);
+	write_type_bitmap(f, &buf, types, pack->num_objects, OBJ_TAG);
+
+	for (i = 0; i < pack->num_objects; i++) {
+		uint32_t hash = htonl(name_hashes[i]);
+		sha1write(f, &hash, 4);
+	}
+
+	for (i = 0; i < nr_selected; i++) {
+		sha1write(f, selected[i].commit->object.sha1, 20);
+		strbuf_reset(&buf);
+		ewah_serialize_strbuf(selected[i].bitmap, &buf);
+		sha1write(f, buf.buf, buf.len);
+	}
+
+	sha1close(f, NULL, CSUM_FSYNC);
+	lock.fd = -1; /* closed by sha1close() */
+	if (adjust_shared_perm(lock.filename))
+		die_errno("unable to make bitmap file readable");
+	if (commit_lock_file(&lock) < 0)
+		die_errno("unable to write bitmap file %s", filename);
+	ret = 0;
+
+out:
+	stop_progress(&progress);
+	for (i = 0; i < nr_selected; i++)
+		ewah_free(selected[i].bitmap);
+	free(selected);
+	for (i = 0; i < bi.stored.size; i++)
+		free(bi.stored.hash[i].decoration);
+	free(bi.stored.hash);
+	bitmap_free(rt.tips);
+	strbuf_release(&buf);
+	return ret;
+}
@@ -0,0 +1,49 @@
+#ifndef PACK_BITMAP_H
+#define PACK_BITMAP_H
+
+#define BITMAP_SIGNATURE 0x4249544d /* "BITM" */
+#define BITMAP_VERSION 1
+
+struct rev_info;
+struct packed_git;
+
+typedef void (*show_reachable_fn)(const unsigned char *sha1,
+				  enum object_type type,
+				  uint32_t name_hash,
+				  struct packed_git *found_pack,
+				  off_t found_offset);
+
+/*
+ * Try to answer the object traversal set up in "revs" (which must
+ * not have been prepared yet) from the bitmap index of a local pack.
+ * Returns 0 on success, in which case traverse_bitmap_commit_list()
+ * reports the objects that are reachable from the interesting tips
+ * but not from the uninteresting ones.  Returns -1 if there is no
+ * usable bitmap, or it does not cover all the tips; the caller then
+ * has to walk the objects itself.
+ */
+extern int prepare_bitmap_walk(struct rev_info *revs);
+extern void traverse_bitmap_commit_list(show_reachable_fn show);
+
+/*
+ * After a successful prepare_bitmap_walk(), check whether the answer
+ * starts with a run of objects at the very beginning of the bitmapped
+ * pack.  If so, take them out of the answer and return their number,
+ * the pack, and the offset where the run ends, so that the caller can
+ * copy these bytes of the pack as they are.  Returns 0 if there is no
+ * such run.
+ */
+extern uint32_t reuse_partial_packfile_from_bitmap(struct packed_git **packfile,
+						   off_t *up_to);
+
+/*
+ * Write "filename" with bitmaps for a selection of the commits in
+ * "pack", which must contain every object reachable from them.
+ * "types" and "name_hashes" give the type and the name hash of each
+ * object, in pack order.  Returns 0 on success.
+ */
+extern int write_bitmap_index(const char *filename, struct packed_git *pack,
+			      const enum object_type *types,
+			      const uint32_t *name_hashes, int show_progress);
+
+#endif
@@ -7,6 +7,13 @@ struct revindex_entry {
 };
 
 struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs);
+
+/*
+ * The position of the object at "ofs" in pack order, i.e. the index
+ * into the revindex, or -1 if no object starts there.
+ */
+int find_revindex_position(struct packed_git *p, off_t ofs);
+struct revindex_entry *nth_pack_revindex(struct packed_git *p, uint32_t n);
 void discard_revindex(void);
 
 #endif
@@ -300,8 +300,13 @@ struct rpc_state {
 	int in;
 	int out;
 	struct strbuf result;
+	git_zstream zstream;
 	unsigned gzip_request : 1;
 	unsigned initial_buffer : 1;
+	unsigned gzip_stream : 1;
+	unsigned gzip_input_end : 1;
+	unsigned gzip_stream_end : 1;
+	unsigned any_posted : 1;
 };
 
 static size_t rpc_out(void *ptr, size_t eltsize,
@@ -327,6 +332,59 @@ static size_t rpc_out(void *ptr, size_t eltsize,
 	return avail;
 }
 
+static void start_gzip_stream(struct rpc_state *rpc)
+{
+	memset(&rpc->zstream, 0, sizeof(rpc->zstream));
+	git_deflate_init_gzip(&rpc->zstream, Z_BEST_COMPRESSION);
+	rpc->gzip_stream = 1;
+	rpc->gzip_input_end = 0;
+	rpc->gzip_stream_end = 0;
+}
+
+static void end_gzip_stream(struct rpc_state *rpc)
+{
+	if (!rpc->gzip_stream)
+		return;
+	git_deflate_end_gently(&rpc->zstream);
+	rpc->gzip_stream = 0;
+}
+
+/*
+ * Like rpc_out(), but deflate the request on the way out, so that a
+ * request too large for the buffer can still be sent compressed.
+ */
+static size_t rpc_out_gzip(void *ptr, size_t eltsize,
+		size_t nmemb, void *buffer_)
+{
+	size_t max = eltsize * nmemb;
+	struct rpc_state *rpc = buffer_;
+	git_zstream *stream = &rpc->zstream;
+
+	stream->next_out = ptr;
+	stream->avail_out = max;
+	while (stream->avail_out == max && !rpc->gzip_stream_end) {
+		int ret;
+
+		if (rpc->pos == rpc->len && !rpc->gzip_input_end) {
+			rpc->initial_buffer = 0;
+			rpc->len = packet_read_line(rpc->out, rpc->buf, rpc->alloc);
+			rpc->pos = 0;
+			rpc->gzip_input_end = !rpc->len;
+		}
+
+		stream->next_in = (unsigned char *)rpc->buf + rpc->pos;
+		stream->avail_in = rpc->len - rpc->pos;
+		ret = git_deflate(stream,
+				  rpc->gzip_input_end ? Z_FINISH : Z_NO_FLUSH);
+		rpc->pos = rpc->len - stream->avail_in;
+		if (ret == Z_STREAM_END)
+			rpc->gzip_stream_end = 1;
+		else if (ret != Z_OK && ret != Z_BUF_ERROR)
+			die("cannot deflate request; zlib deflate error %d", ret);
+	}
+	return max - stream->avail_out;
+}
+
 #ifndef NO_CURL_IOCTL
 static curlioerr rpc_ioctl(CURL *handle, int cmd, void *clientp)
 {
@@ -339,6 +397,10 @@ static curlioerr rpc_ioctl(CURL *handle, int cmd, void *clientp)
 	case CURLIOCMD_RESTARTREAD:
 		if (rpc->initial_buffer) {
 			rpc->pos = 0;
+			if (rpc->gzip_stream) {
+				end_gzip_stream(rpc);
+				start_gzip_stream(rpc);
+			}
 			return CURLIOE_OK;
 		}
 		fprintf(stderr, "Unable to rewind rpc post data - try increasing http.postBuffer\n");
@@ -424,7 +486,6 @@ static int post_rpc(struct rpc_state *rpc)
 
 		if (left < LARGE_PACKET_MAX) {
 			large_request = 1;
-			use_gzip = 0;
 			break;
 		}
 
@@ -434,7 +495,15 @@ static int post_rpc(struct rpc_state *rpc)
 		rpc->len += n;
 	}
 
-	if (large_request) {
+	/*
+	 * A body streamed from the pipe cannot be sent again if the
+	 * server asks us to authenticate, so try a tiny request first.
+	 * The round trip can be saved once a request of this session
+	 * went through, unless the server has asked for credentials at
+	 * all: it may do so again on a new connection or when they
+	 * expire.
+	 */
+	if (large_request && (!rpc->any_posted || http_auth_seen)) {
 		err = probe_rpc(rpc);
 		if (err)
 			return err;
@@ -457,14 +526,20 @@ static int post_rpc(struct rpc_state *rpc)
 		 */
 		headers = curl_slist_append(headers, "Transfer-Encoding: chunked");
 		rpc->initial_buffer = 1;
-		curl_easy_setopt(slot->curl, CURLOPT_READFUNCTION, rpc_out);
+		if (use_gzip) {
+			headers = curl_slist_append(headers, "Content-Encoding: gzip");
+			start_gzip_stream(rpc);
+			curl_easy_setopt(slot->curl, CURLOPT_READFUNCTION, rpc_out_gzip);
+		} else
+			curl_easy_setopt(slot->curl, CURLOPT_READFUNCTION, rpc_out);
 		curl_easy_setopt(slot->curl, CURLOPT_INFILE, rpc);
 #ifndef NO_CURL_IOCTL
 		curl_easy_setopt(slot->curl, CURLOPT_IOCTLFUNCTION, rpc_ioctl);
 		curl_easy_setopt(slot->curl, CURLOPT_IOCTLDATA, rpc);
 #endif
 		if (options.verbosity > 1) {
-			fprintf(stderr, "POST %s (chunked)\n", rpc->service_name);
+			fprintf(stderr, "POST %s (chunked%s)\n", rpc->service_name,
+				use_gzip ? ", gzip" : "");
 			fflush(stderr);
 		}
 
@@ -525,7 +600,10 @@ static int post_rpc(struct rpc_state *rpc)
 	curl_easy_setopt(slot->curl, CURLOPT_FILE, rpc);
 
 	err = run_slot(slot);
+	if (!err)
+		rpc->any_posted = 1;
 
+	end_gzip_stream(rpc);
 	curl_slist_free_all(headers);
 	free(gzip_body);
 	return err;
@@ -13,6 +13,7 @@
 #include "decorate.h"
 #include "log-tree.h"
 #include "string-list.h"
+#include "changed-paths.h"
 
 volatile show_early_output_fn_t show_early_output;
 
@@ -159,8 +160,10 @@ void mark_parents_uninteresting(struct commit *commit)
 			 * it is popped next time around, we won't be trying
 			 * to parse it and get an error.
 			 */
-			if (!has_sha1_file(commit->object.sha1))
+			if (!has_sha1_file(commit->object.sha1)) {
 				commit->object.parsed = 1;
+				commit->generation = GENERATION_NUMBER_INFINITY;
+			}
 
 			if (commit->object.flags & UNINTERESTING)
 				break;
@@ -393,6 +396,11 @@ static int rev_compare_tree(struct rev_info *revs, struct commit *parent, struct
 			return REV_TREE_SAME;
 	}
 
+	/* the changed-paths file may know the answer against the first parent */
+	if (revs->changed_paths && commit->parents->item == parent &&
+	    !changed_paths_may_touch(revs->changed_paths, commit))
+		return REV_TREE_SAME;
+
 	tree_difference = REV_TREE_SAME;
 	DIFF_OPT_CLR(&revs->pruning, HAS_CHANGES);
 	if (diff_tree_sha1(t1->object.sha1, t2->object.sha1, "",
@@ -441,7 +449,9 @@ static void try_to_simplify_commit(struct rev_info *revs, struct commit *commit)
 		return;
 
 	if (!commit->parents) {
-		if (rev_same_tree_as_empty(revs, commit))
+		if ((revs->changed_paths &&
+		     !changed_paths_may_touch(revs->changed_paths, commit)) ||
+		    rev_same_tree_as_empty(revs, commit))
 			commit->object.flags |= TREESAME;
 		return;
 	}
@@ -2083,6 +2093,9 @@ int prepare_revision_walk(struct rev_info *revs)
 	if (!revs->leak_pending)
 		free(list);
 
+	if (revs->prune && !revs->changed_paths)
+		revs->changed_paths = changed_paths_query(&revs->prune_data);
+
 	if (revs->no_walk)
 		return 0;
 	if (revs->limited)
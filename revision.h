@@ -22,6 +22,7 @@
 
 struct rev_info;
 struct log_info;
+struct changed_paths_query;
 struct string_list;
 
 struct rev_cmdline_info {
@@ -156,6 +157,8 @@ struct rev_info {
 	/* diff info for patches and for paths limiting */
 	struct diff_options diffopt;
 	struct diff_options pruning;
+	/* set up by prepare_revision_walk() to skip some of the pruning */
+	struct changed_paths_query *changed_paths;
 
 	struct reflog_walk_info *reflog_info;
 	struct decoration children;
@@ -19,6 +19,8 @@
 #include "pack-revindex.h"
 #include "sha1-lookup.h"
 #include "bulk-checkin.h"
+#include "midx.h"
+#include "thread-utils.h"
 
 #ifndef O_NOATIME
 #if defined(__linux__) && (defined(__i386__) || defined(__PPC__))
@@ -47,6 +49,55 @@ static struct cached_object {
 } *cached_objects;
 static int cached_object_nr, cached_object_alloc;
 
+#ifndef NO_PTHREADS
+static pthread_mutex_t obj_read_mutex;
+static int obj_read_use_lock;
+
+void enable_obj_read_lock(void)
+{
+	if (obj_read_use_lock)
+		return;
+	init_recursive_mutex(&obj_read_mutex);
+	obj_read_use_lock = 1;
+}
+
+void disable_obj_read_lock(void)
+{
+	if (!obj_read_use_lock)
+		return;
+	obj_read_use_lock = 0;
+	pthread_mutex_destroy(&obj_read_mutex);
+}
+
+void obj_read_lock(void)
+{
+	if (obj_read_use_lock)
+		pthread_mutex_lock(&obj_read_mutex);
+}
+
+void obj_read_unlock(void)
+{
+	if (obj_read_use_lock)
+		pthread_mutex_unlock(&obj_read_mutex);
+}
+#else
+void enable_obj_read_lock(void)
+{
+}
+
+void disable_obj_read_lock(void)
+{
+}
+
+void obj_read_lock(void)
+{
+}
+
+void obj_read_unlock(void)
+{
+}
+#endif
+
 static struct cached_object empty_tree = {
 	EMPTY_TREE_SHA1_BIN_LITERAL,
 	OBJ_TREE,
@@ -920,7 +971,10 @@ static struct packed_git *alloc_packed_git(int extra)
 
 static void try_to_free_pack_memory(size_t size)
 {
+	/* xmalloc() may fail in a reader that dropped the lock */
+	obj_read_lock();
 	release_pack_memory(size, -1);
+	obj_read_unlock();
 }
 
 struct packed_git *add_packed_git(const char *path, int path_len, int local)
@@ -1107,6 +1161,7 @@ void prepare_packed_git(void)
 		prepare_packed_git_one(alt->base, 0);
 		alt->name[-1] = '/';
 	}
+	prepare_multi_pack_index();
 	rearrange_packed_git();
 	prepare_packed_git_run_once = 1;
 }
@@ -1114,6 +1169,7 @@ void prepare_packed_git(void)
 void reprepare_packed_git(void)
 {
 	discard_revindex();
+	close_multi_pack_index();
 	prepare_packed_git_run_once = 0;
 	prepare_packed_git();
 }
@@ -1447,7 +1503,10 @@ unsigned long get_size_from_delta(struct packed_git *p,
 	do {
 		in = use_pack(p, w_curs, curpos, &stream.avail_in);
 		stream.next_in = in;
+		/* the window stays mapped while it is in use */
+		obj_read_unlock();
 		st = git_inflate(&stream, Z_FINISH);
+		obj_read_lock();
 		curpos += stream.next_in - in;
 	} while ((st == Z_OK || st == Z_BUF_ERROR) &&
 		 stream.total_out < sizeof(delta_head));
@@ -1630,7 +1689,10 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	do {
 		in = use_pack(p, w_curs, curpos, &stream.avail_in);
 		stream.next_in = in;
+		/* the window stays mapped while it is in use */
+		obj_read_unlock();
 		st = git_inflate(&stream, Z_FINISH);
+		obj_read_lock();
 		if (!stream.avail_out)
 			break; /* the payload is larger than it should be */
 		curpos += stream.next_in - in;
@@ -1644,8 +1706,13 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	return buffer;
 }
 
-#define MAX_DELTA_CACHE (256)
-
+/*
+ * Recently used delta bases, hashed by pack and offset into chains and
+ * kept on a list in the order they were used, oldest first, so that
+ * the oldest can be evicted once delta_base_cache_limit is reached.
+ * The table grows with the number of entries.  All of it is protected
+ * by obj_read_lock().
+ */
 static size_t delta_base_cached;
 
 static struct delta_base_cache_lru_list {
@@ -1653,108 +1720,224 @@ static struct delta_base_cache_lru_list {
 	struct delta_base_cache_lru_list *next;
 } delta_base_cache_lru = { &delta_base_cache_lru, &delta_base_cache_lru };
 
-static struct delta_base_cache_entry {
-	struct delta_base_cache_lru_list lru;
+struct delta_base_cache_entry {
+	struct delta_base_cache_lru_list lru; /* must be first */
+	struct delta_base_cache_entry *next;
 	void *data;
 	struct packed_git *p;
 	off_t base_offset;
 	unsigned long size;
 	enum object_type type;
-} delta_base_cache[MAX_DELTA_CACHE];
+};
+
+static struct delta_base_cache_entry **delta_base_cache;
+static unsigned int delta_base_cache_size, delta_base_cache_nr;
+
+static struct delta_base_cache_stats {
+	unsigned long hits, misses, evictions;
+	size_t peak;
+} delta_base_cache_stats;
+
+static const char delta_base_cache_trace_key[] = "GIT_TRACE_DELTA_BASE_STATS";
+
+static unsigned int pack_entry_hash(struct packed_git *p, off_t base_offset)
+{
+	uint64_t hash = (uint64_t)(uintptr_t)p ^ (uint64_t)base_offset;
+
+	hash *= 0x9e3779b97f4a7c15ull;
+	return (unsigned int)(hash >> 32);
+}
+
+static inline struct delta_base_cache_entry **delta_base_cache_bucket(
+	struct packed_git *p, off_t base_offset)
+{
+	unsigned int hash = pack_entry_hash(p, base_offset);
+	return &delta_base_cache[hash & (delta_base_cache_size - 1)];
+}
+
+/* Where the entry for "p" and "base_offset" is, or would be, linked */
+static struct delta_base_cache_entry **delta_base_cache_link(
+	struct packed_git *p, off_t base_offset)
+{
+	struct delta_base_cache_entry **pos;
+
+	pos = delta_base_cache_bucket(p, base_offset);
+	while (*pos && ((*pos)->p != p || (*pos)->base_offset != base_offset))
+		pos = &(*pos)->next;
+	return pos;
+}
+
+static struct delta_base_cache_entry *get_delta_base_cache_entry(
+	struct packed_git *p, off_t base_offset)
+{
+	if (!delta_base_cache_nr)
+		return NULL;
+	return *delta_base_cache_link(p, base_offset);
+}
+
+static void grow_delta_base_cache(void)
+{
+	struct delta_base_cache_entry **old = delta_base_cache;
+	unsigned int i, old_size = delta_base_cache_size;
+
+	delta_base_cache_size = old_size ? old_size * 2 : 64;
+	delta_base_cache = xcalloc(delta_base_cache_size,
+				   sizeof(*delta_base_cache));
+	for (i = 0; i < old_size; i++) {
+		struct delta_base_cache_entry *ent = old[i], *next;
+		for (; ent; ent = next) {
+			struct delta_base_cache_entry **pos;
+
+			next = ent->next;
+			pos = delta_base_cache_bucket(ent->p, ent->base_offset);
+			ent->next = *pos;
+			*pos = ent;
+		}
+	}
+	free(old);
+}
+
+/* Remove "ent" from the cache; its data now belongs to the caller */
+static void detach_delta_base_cache_entry(struct delta_base_cache_entry *ent)
+{
+	struct delta_base_cache_entry **pos;
+
+	pos = delta_base_cache_link(ent->p, ent->base_offset);
+	*pos = ent->next;
+	ent->lru.next->prev = ent->lru.prev;
+	ent->lru.prev->next = ent->lru.next;
+	delta_base_cached -= ent->size;
+	delta_base_cache_nr--;
+	free(ent);
+}
 
-static unsigned long pack_entry_hash(struct packed_git *p, off_t base_offset)
+static inline void release_delta_base_cache(struct delta_base_cache_entry *ent)
+{
+	free(ent->data);
+	detach_delta_base_cache_entry(ent);
+}
+
+static void trace_delta_base_cache_stats(void)
 {
-	unsigned long hash;
+	struct strbuf sb = STRBUF_INIT;
 
-	hash = (unsigned long)p + (unsigned long)base_offset;
-	hash += (hash >> 8) + (hash >> 16);
-	return hash % MAX_DELTA_CACHE;
+	strbuf_addf(&sb, "delta base cache: %lu hits, %lu misses, "
+		    "%lu evictions, %"PRIuMAX" bytes at most (limit %"PRIuMAX")\n",
+		    delta_base_cache_stats.hits, delta_base_cache_stats.misses,
+		    delta_base_cache_stats.evictions,
+		    (uintmax_t)delta_base_cache_stats.peak,
+		    (uintmax_t)delta_base_cache_limit);
+	trace_strbuf(delta_base_cache_trace_key, &sb);
+	strbuf_release(&sb);
 }
 
 static int in_delta_base_cache(struct packed_git *p, off_t base_offset)
 {
-	unsigned long hash = pack_entry_hash(p, base_offset);
-	struct delta_base_cache_entry *ent = delta_base_cache + hash;
-	return (ent->data && ent->p == p && ent->base_offset == base_offset);
+	return !!get_delta_base_cache_entry(p, base_offset);
 }
 
 static void *cache_or_unpack_entry(struct packed_git *p, off_t base_offset,
 	unsigned long *base_size, enum object_type *type, int keep_cache)
 {
+	static int stats_registered;
+	struct delta_base_cache_entry *ent;
 	void *ret;
-	unsigned long hash = pack_entry_hash(p, base_offset);
-	struct delta_base_cache_entry *ent = delta_base_cache + hash;
 
-	ret = ent->data;
-	if (!ret || ent->p != p || ent->base_offset != base_offset)
+	if (!stats_registered) {
+		stats_registered = 1;
+		if (trace_want(delta_base_cache_trace_key))
+			atexit(trace_delta_base_cache_stats);
+	}
+
+	ent = get_delta_base_cache_entry(p, base_offset);
+	if (!ent) {
+		delta_base_cache_stats.misses++;
 		return unpack_entry(p, base_offset, type, base_size);
+	}
+	delta_base_cache_stats.hits++;
 
+	*type = ent->type;
+	*base_size = ent->size;
 	if (!keep_cache) {
-		ent->data = NULL;
-		ent->lru.next->prev = ent->lru.prev;
-		ent->lru.prev->next = ent->lru.next;
-		delta_base_cached -= ent->size;
+		ret = ent->data;
+		detach_delta_base_cache_entry(ent);
 	} else {
 		ret = xmemdupz(ent->data, ent->size);
+		/* it is the most recently used one now */
+		ent->lru.next->prev = ent->lru.prev;
+		ent->lru.prev->next = ent->lru.next;
+		ent->lru.next = &delta_base_cache_lru;
+		ent->lru.prev = delta_base_cache_lru.prev;
+		delta_base_cache_lru.prev->next = &ent->lru;
+		delta_base_cache_lru.prev = &ent->lru;
 	}
-	*type = ent->type;
-	*base_size = ent->size;
 	return ret;
 }
 
-static inline void release_delta_base_cache(struct delta_base_cache_entry *ent)
+void clear_delta_base_cache(void)
 {
-	if (ent->data) {
-		free(ent->data);
-		ent->data = NULL;
-		ent->lru.next->prev = ent->lru.prev;
-		ent->lru.prev->next = ent->lru.next;
-		delta_base_cached -= ent->size;
-	}
+	while (delta_base_cache_lru.next != &delta_base_cache_lru)
+		release_delta_base_cache((void *)delta_base_cache_lru.next);
 }
 
-void clear_delta_base_cache(void)
+/*
+ * Evict the least recently used entries until "delta_base_cached"
+ * fits the limit, blobs first, as they are less likely to be the base
+ * of another delta than trees are.
+ */
+static void prune_delta_base_cache(void)
 {
-	unsigned long p;
-	for (p = 0; p < MAX_DELTA_CACHE; p++)
-		release_delta_base_cache(&delta_base_cache[p]);
+	struct delta_base_cache_lru_list *lru, *next;
+	int blobs_only;
+
+	for (blobs_only = 1; blobs_only >= 0; blobs_only--) {
+		for (lru = delta_base_cache_lru.next;
+		     delta_base_cached > delta_base_cache_limit
+		     && lru != &delta_base_cache_lru;
+		     lru = next) {
+			struct delta_base_cache_entry *f = (void *)lru;
+
+			next = lru->next;
+			if (blobs_only && f->type != OBJ_BLOB)
+				continue;
+			release_delta_base_cache(f);
+			delta_base_cache_stats.evictions++;
+		}
+	}
 }
 
 static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 	void *base, unsigned long base_size, enum object_type type)
 {
-	unsigned long hash = pack_entry_hash(p, base_offset);
-	struct delta_base_cache_entry *ent = delta_base_cache + hash;
-	struct delta_base_cache_lru_list *lru;
+	struct delta_base_cache_entry *ent, **pos;
 
-	release_delta_base_cache(ent);
-	delta_base_cached += base_size;
+	/* another thread may have cached it while we did not hold the lock */
+	ent = get_delta_base_cache_entry(p, base_offset);
+	if (ent)
+		release_delta_base_cache(ent);
 
-	for (lru = delta_base_cache_lru.next;
-	     delta_base_cached > delta_base_cache_limit
-	     && lru != &delta_base_cache_lru;
-	     lru = lru->next) {
-		struct delta_base_cache_entry *f = (void *)lru;
-		if (f->type == OBJ_BLOB)
-			release_delta_base_cache(f);
-	}
-	for (lru = delta_base_cache_lru.next;
-	     delta_base_cached > delta_base_cache_limit
-	     && lru != &delta_base_cache_lru;
-	     lru = lru->next) {
-		struct delta_base_cache_entry *f = (void *)lru;
-		release_delta_base_cache(f);
-	}
+	delta_base_cached += base_size;
+	prune_delta_base_cache();
 
+	if (delta_base_cache_size <= delta_base_cache_nr)
+		grow_delta_base_cache();
+	ent = xmalloc(sizeof(*ent));
 	ent->p = p;
 	ent->base_offset = base_offset;
 	ent->type = type;
 	ent->data = base;
 	ent->size = base_size;
+	pos = delta_base_cache_link(p, base_offset);
+	ent->next = *pos;
+	*pos = ent;
+	delta_base_cache_nr++;
 	ent->lru.next = &delta_base_cache_lru;
 	ent->lru.prev = delta_base_cache_lru.prev;
 	delta_base_cache_lru.prev->next = &ent->lru;
 	delta_base_cache_lru.prev = &ent->lru;
+
+	if (delta_base_cache_stats.peak < delta_base_cached)
+		delta_base_cache_stats.peak = delta_base_cached;
 }
 
 static void *read_object(const unsigned char *sha1, enum object_type *type,
@@ -1812,9 +1995,12 @@ static void *unpack_delta_entry(struct packed_git *p,
 		free(base);
 		return NULL;
 	}
+	/* base and delta_data are ours, not in the delta base cache */
+	obj_read_unlock();
 	result = patch_delta(base, base_size,
 			     delta_data, delta_size,
 			     sizep);
+	obj_read_lock();
 	if (!result)
 		die("failed to apply delta");
 	free(delta_data);
@@ -2015,13 +2201,25 @@ static int find_pack_entry(const unsigned char *sha1, struct pack_entry *e)
 	static struct packed_git *last_found = (void *)1;
 	struct packed_git *p;
 	off_t offset;
+	int skip_midx_packs;
 
 	prepare_packed_git();
 	if (!packed_git)
 		return 0;
+
+	/*
+	 * The multi-pack index answers for all the packs it covers at
+	 * once; only if it cannot be trusted for this object do we have
+	 * to look at them one by one.
+	 */
+	skip_midx_packs = fill_midx_entry(sha1, e);
+	if (skip_midx_packs > 0)
+		return 1;
 	p = (last_found == (void *)1) ? packed_git : last_found;
 
 	do {
+		if (skip_midx_packs == 0 && p->multi_pack_index)
+			goto next;
 		if (p->num_bad_objects) {
 			unsigned i;
 			for (i = 0; i < p->num_bad_objects; i++)
@@ -2098,7 +2296,7 @@ static int sha1_loose_object_info(const unsigned char *sha1, unsigned long *size
 }
 
 /* returns enum object_type or negative */
-int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi)
+static int do_sha1_object_info(const unsigned char *sha1, struct object_info *oi)
 {
 	struct cached_object *co;
 	struct pack_entry e;
@@ -2129,7 +2327,7 @@ int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi)
 	status = packed_object_info(e.p, e.offset, oi->sizep, &rtype);
 	if (status < 0) {
 		mark_bad_packed_object(e.p, sha1);
-		status = sha1_object_info_extended(sha1, oi);
+		status = do_sha1_object_info(sha1, oi);
 	} else if (in_delta_base_cache(e.p, e.offset)) {
 		oi->whence = OI_DBCACHED;
 	} else {
@@ -2143,6 +2341,16 @@ int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi)
 	return status;
 }
 
+int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi)
+{
+	int status;
+
+	obj_read_lock();
+	status = do_sha1_object_info(sha1, oi);
+	obj_read_unlock();
+	return status;
+}
+
 int sha1_object_info(const unsigned char *sha1, unsigned long *sizep)
 {
 	struct object_info oi;
@@ -2217,8 +2425,10 @@ static void *read_object(const unsigned char *sha1, enum object_type *type,
 		return buf;
 	map = map_sha1_file(sha1, &mapsize);
 	if (map) {
+		obj_read_unlock();
 		buf = unpack_sha1_file(map, mapsize, type, size, sha1);
 		munmap(map, mapsize);
+		obj_read_lock();
 		return buf;
 	}
 	reprepare_packed_git();
@@ -2230,10 +2440,10 @@ static void *read_object(const unsigned char *sha1, enum object_type *type,
  * deal with them should arrange to call read_object() and give error
  * messages themselves.
  */
-void *read_sha1_file_extended(const unsigned char *sha1,
-			      enum object_type *type,
-			      unsigned long *size,
-			      unsigned flag)
+static void *do_read_sha1_file(const unsigned char *sha1,
+			       enum object_type *type,
+			       unsigned long *size,
+			       unsigned flag)
 {
 	void *data;
 	char *path;
@@ -2267,6 +2477,19 @@ void *read_sha1_file_extended(const unsigned char *sha1,
 	return NULL;
 }
 
+void *read_sha1_file_extended(const unsigned char *sha1,
+			      enum object_type *type,
+			      unsigned long *size,
+			      unsigned flag)
+{
+	void *data;
+
+	obj_read_lock();
+	data = do_read_sha1_file(sha1, type, size, flag);
+	obj_read_unlock();
+	return data;
+}
+
 void *read_object_with_reference(const unsigned char *sha1,
 				 const char *required_type_name,
 				 unsigned long *size,
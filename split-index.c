@@ -0,0 +1,346 @@
+#include "cache.h"
+#include "split-index.h"
+#include "ewah/ewok.h"
+
+struct split_index *init_split_index(struct index_state *istate)
+{
+	if (!istate->split_index) {
+		istate->split_index = xcalloc(1, sizeof(*istate->split_index));
+		istate->split_index->refcount = 1;
+	}
+	return istate->split_index;
+}
+
+static void free_link_bitmaps(struct split_index *si)
+{
+	if (si->delete_bitmap)
+		ewah_free(si->delete_bitmap);
+	if (si->replace_bitmap)
+		ewah_free(si->replace_bitmap);
+	si->delete_bitmap = NULL;
+	si->replace_bitmap = NULL;
+}
+
+void discard_split_index(struct index_state *istate)
+{
+	struct split_index *si = istate->split_index;
+
+	if (!si)
+		return;
+	istate->split_index = NULL;
+	if (--si->refcount)
+		return;
+	if (si->base) {
+		discard_index(si->base);
+		free(si->base->cache);
+		free(si->base);
+	}
+	free_link_bitmaps(si);
+	free(si);
+}
+
+int read_link_extension(struct index_state *istate,
+			const void *data_, unsigned long sz)
+{
+	const unsigned char *data = data_;
+	struct split_index *si;
+	ssize_t ret;
+
+	if (sz < 20)
+		return error("corrupt link extension (too short)");
+	si = init_split_index(istate);
+	hashcpy(si->base_sha1, data);
+	data += 20;
+	sz -= 20;
+
+	free_link_bitmaps(si);
+	si->delete_bitmap = ewah_new();
+	ret = ewah_read_mmap(si->delete_bitmap, data, sz);
+	if (ret < 0)
+		return error("corrupt delete bitmap in link extension");
+	data += ret;
+	sz -= ret;
+	si->replace_bitmap = ewah_new();
+	ret = ewah_read_mmap(si->replace_bitmap, data, sz);
+	if (ret < 0)
+		return error("corrupt replace bitmap in link extension");
+	if (ret != sz)
+		return error("garbage at the end of link extension");
+	return 0;
+}
+
+void write_link_extension(struct strbuf *sb, struct index_state *istate)
+{
+	struct split_index *si = istate->split_index;
+
+	strbuf_add(sb, si->base_sha1, 20);
+	ewah_serialize_strbuf(si->delete_bitmap, sb);
+	ewah_serialize_strbuf(si->replace_bitmap, sb);
+}
+
+static struct cache_entry *dup_cache_entry(const struct cache_entry *ce)
+{
+	struct cache_entry *dup = xmalloc(ce_size(ce));
+
+	memcpy(dup, ce, ce_size(ce));
+	dup->ce_flags &= ~(CE_HASHED | CE_UNHASHED);
+	dup->next = dup->dir_next = NULL;
+	return dup;
+}
+
+static int compare_ce_names(const struct cache_entry *a,
+			    const struct cache_entry *b)
+{
+	return cache_name_compare(a->name, a->ce_flags, b->name, b->ce_flags);
+}
+
+void merge_base_index(struct index_state *istate)
+{
+	struct split_index *si = istate->split_index;
+	struct index_state *base = si->base;
+	struct cache_entry **merged, **cache = istate->cache;
+	unsigned int cache_nr = istate->cache_nr, nr = 0, i, pos = 0, added;
+	unsigned int alloc = base->cache_nr + cache_nr;
+	struct bitmap *deleted = bitmap_new(), *replaced = bitmap_new();
+
+	if (si->delete_bitmap)
+		bitmap_or_ewah(deleted, si->delete_bitmap);
+	if (si->replace_bitmap)
+		bitmap_or_ewah(replaced, si->replace_bitmap);
+	free_link_bitmaps(si);
+
+	/* the shared entries, some of them replaced by ours */
+	merged = xmalloc((alloc ? alloc : 1) * sizeof(*merged));
+	for (i = 0; i < base->cache_nr; i++) {
+		struct cache_entry *ce = base->cache[i];
+
+		if (bitmap_get(deleted, i))
+			continue;
+		if (bitmap_get(replaced, i)) {
+			if (pos >= cache_nr || compare_ce_names(cache[pos], ce))
+				die("corrupt link extension: bad replacement for %s",
+				    ce->name);
+			merged[nr++] = cache[pos++];
+		} else
+			merged[nr++] = dup_cache_entry(ce);
+	}
+	bitmap_free(deleted);
+	bitmap_free(replaced);
+
+	/* and the entries that are not shared, merged in by name */
+	added = cache_nr - pos;
+	if (added) {
+		struct cache_entry **shared = merged;
+		unsigned int shared_nr = nr, j = 0;
+
+		alloc = shared_nr + added;
+		merged = xmalloc(alloc * sizeof(*merged));
+		nr = 0;
+		while (j < shared_nr || pos < cache_nr) {
+			if (pos >= cache_nr ||
+			    (j < shared_nr &&
+			     compare_ce_names(shared[j], cache[pos]) < 0))
+				merged[nr++] = shared[j++];
+			else
+				merged[nr++] = cache[pos++];
+		}
+		free(shared);
+	}
+
+	free(istate->cache);
+	istate->cache = merged;
+	istate->cache_nr = nr;
+	istate->cache_alloc = alloc;
+}
+
+static int same_ondisk_entry(const struct cache_entry *a,
+			     const struct cache_entry *b)
+{
+	const unsigned int ondisk_flags =
+		CE_NAMEMASK | CE_STAGEMASK | CE_VALID | CE_EXTENDED_FLAGS;
+
+	return a->ce_ctime.sec == b->ce_ctime.sec &&
+		a->ce_ctime.nsec == b->ce_ctime.nsec &&
+		a->ce_mtime.sec == b->ce_mtime.sec &&
+		a->ce_mtime.nsec == b->ce_mtime.nsec &&
+		a->ce_dev == b->ce_dev &&
+		a->ce_ino == b->ce_ino &&
+		a->ce_mode == b->ce_mode &&
+		a->ce_uid == b->ce_uid &&
+		a->ce_gid == b->ce_gid &&
+		a->ce_size == b->ce_size &&
+		!((a->ce_flags ^ b->ce_flags) & ondisk_flags) &&
+		!hashcmp(a->sha1, b->sha1);
+}
+
+/*
+ * Walk the (sorted) entries of the index and of the shared index side
+ * by side, and call "fn" for each entry of the index that is not in
+ * the shared index (shared == NULL, pos == -1), each shared entry
+ * that is not in the index (ce == NULL) and each entry that differs
+ * from its shared counterpart.
+ */
+typedef void (*split_diff_fn)(struct cache_entry *ce, int pos, void *cb_data);
+
+static void diff_against_base(struct index_state *istate,
+			      split_diff_fn fn, void *cb_data)
+{
+	struct index_state *base = istate->split_index->base;
+	unsigned int i = 0, j = 0;
+
+	while (i < istate->cache_nr || j < base->cache_nr) {
+		struct cache_entry *ce = NULL, *shared = NULL;
+		int cmp;
+
+		if (i < istate->cache_nr) {
+			ce = istate->cache[i];
+			if (ce->ce_flags & CE_REMOVE) {
+				i++;
+				continue;
+			}
+		}
+		if (j < base->cache_nr)
+			shared = base->cache[j];
+
+		if (!shared)
+			cmp = -1;
+		else if (!ce)
+			cmp = 1;
+		else
+			cmp = compare_ce_names(ce, shared);
+
+		if (cmp < 0) {
+			fn(ce, -1, cb_data);
+			i++;
+		} else if (cmp > 0) {
+			fn(NULL, j, cb_data);
+			j++;
+		} else {
+			if (!same_ondisk_entry(ce, shared))
+				fn(ce, j, cb_data);
+			i++;
+			j++;
+		}
+	}
+}
+
+static void count_not_shared(struct cache_entry *ce, int pos, void *cb_data)
+{
+	unsigned int *count = cb_data;
+	(*count)++;
+}
+
+int too_many_not_shared_entries(struct index_state *istate)
+{
+	struct index_state *base = istate->split_index->base;
+	unsigned int not_shared = 0;
+
+	if (!base)
+		return 1;
+	diff_against_base(istate, count_not_shared, &not_shared);
+	/* rewrite the shared index once a fifth of it is out of date */
+	return not_shared * 5 > base->cache_nr;
+}
+
+struct split_write_data {
+	struct bitmap *deleted, *replaced;
+	struct cache_entry **replacements, **additions;
+	unsigned int nr_replacements, alloc_replacements;
+	unsigned int nr_additions, alloc_additions;
+};
+
+static void collect_not_shared(struct cache_entry *ce, int pos, void *cb_data)
+{
+	struct split_write_data *d = cb_data;
+
+	if (!ce) {
+		bitmap_set(d->deleted, pos);
+	} else if (pos < 0) {
+		ALLOC_GROW(d->additions, d->nr_additions + 1, d->alloc_additions);
+		d->additions[d->nr_additions++] = ce;
+	} else {
+		bitmap_set(d->replaced, pos);
+		ALLOC_GROW(d->replacements, d->nr_replacements + 1,
+			   d->alloc_replacements);
+		d->replacements[d->nr_replacements++] = ce;
+	}
+}
+
+void prepare_to_write_split_index(struct index_state *istate)
+{
+	struct split_index *si = istate->split_index;
+	struct split_write_data d;
+	struct cache_entry **cache;
+	unsigned int nr;
+
+	memset(&d, 0, sizeof(d));
+	d.deleted = bitmap_new();
+	d.replaced = bitmap_new();
+	diff_against_base(istate, collect_not_shared, &d);
+
+	free_link_bitmaps(si);
+	si->delete_bitmap = bitmap_to_ewah(d.deleted);
+	si->replace_bitmap = bitmap_to_ewah(d.replaced);
+	bitmap_free(d.deleted);
+	bitmap_free(d.replaced);
+
+	/* the replacements, in the order of the shared entries, go first */
+	nr = d.nr_replacements + d.nr_additions;
+	cache = xmalloc((nr ? nr : 1) * sizeof(*cache));
+	if (d.nr_replacements)
+		memcpy(cache, d.replacements,
+		       d.nr_replacements * sizeof(*cache));
+	if (d.nr_additions)
+		memcpy(cache + d.nr_replacements, d.additions,
+		       d.nr_additions * sizeof(*cache));
+	free(d.replacements);
+	free(d.additions);
+
+	si->saved_cache = istate->cache;
+	si->saved_cache_nr = istate->cache_nr;
+	si->saved_cache_alloc = istate->cache_alloc;
+	istate->cache = cache;
+	istate->cache_nr = nr;
+	istate->cache_alloc = nr;
+}
+
+void finish_writing_split_index(struct index_state *istate)
+{
+	struct split_index *si = istate->split_index;
+
+	free(istate->cache);
+	istate->cache = si->saved_cache;
+	istate->cache_nr = si->saved_cache_nr;
+	istate->cache_alloc = si->saved_cache_alloc;
+	si->saved_cache = NULL;
+	free_link_bitmaps(si);
+}
+
+void set_split_index_base(struct index_state *istate,
+			  const unsigned char *sha1)
+{
+	struct split_index *si = istate->split_index;
+	struct index_state *base;
+	unsigned int i;
+
+	if (si->base) {
+		discard_index(si->base);
+		free(si->base->cache);
+	} else
+		si->base = xcalloc(1, sizeof(*si->base));
+	base = si->base;
+	base->cache = xmalloc((istate->cache_nr ? istate->cache_nr : 1) *
+			      sizeof(*base->cache));
+	base->cache_alloc = istate->cache_nr;
+	base->cache_nr = 0;
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+		if (ce->ce_flags & CE_REMOVE)
+			continue;
+		base->cache[base->cache_nr++] = dup_cache_entry(ce);
+	}
+	base->version = istate->version;
+	base->initialized = 1;
+	hashcpy(base->sha1, sha1);
+	hashcpy(si->base_sha1, sha1);
+}
@@ -0,0 +1,61 @@
+#ifndef SPLIT_INDEX_H
+#define SPLIT_INDEX_H
+
+struct index_state;
+struct strbuf;
+struct ewah_bitmap;
+
+/*
+ * In split-index mode, most of the entries live in a shared index,
+ * $GIT_DIR/sharedindex.<sha1>, which is rarely rewritten.  The index
+ * file proper only records how the entries differ from it, in the
+ * "link" extension: which shared entries are deleted, which are
+ * replaced by entries of the index file, and which entries of the
+ * index file are new.
+ */
+struct split_index {
+	unsigned char base_sha1[20];
+	struct index_state *base;
+	struct ewah_bitmap *delete_bitmap;
+	struct ewah_bitmap *replace_bitmap;
+	struct cache_entry **saved_cache;
+	unsigned int saved_cache_nr;
+	unsigned int saved_cache_alloc;
+	int refcount;
+};
+
+struct split_index *init_split_index(struct index_state *istate);
+void discard_split_index(struct index_state *istate);
+
+int read_link_extension(struct index_state *istate,
+			const void *data, unsigned long sz);
+void write_link_extension(struct strbuf *sb, struct index_state *istate);
+
+/*
+ * After the index file has been read into "istate" and the shared
+ * index into istate->split_index->base, combine them.
+ */
+void merge_base_index(struct index_state *istate);
+
+/*
+ * Returns true if so many entries differ from the shared index that
+ * a new one should be written.
+ */
+int too_many_not_shared_entries(struct index_state *istate);
+
+/*
+ * Replace istate->cache by the entries that differ from the shared
+ * index, and compute the bitmaps of the link extension; undone by
+ * finish_writing_split_index().
+ */
+void prepare_to_write_split_index(struct index_state *istate);
+void finish_writing_split_index(struct index_state *istate);
+
+/*
+ * Make a copy of the entries of "istate" the shared index, which has
+ * just been written out with checksum "sha1".
+ */
+void set_split_index_base(struct index_state *istate,
+			  const unsigned char *sha1);
+
+#endif
@@ -0,0 +1,123 @@
+#!/bin/sh
+
+test_description='split index mode tests'
+
+. ./test-lib.sh
+
+shared_indexes () {
+	ls .git/sharedindex.* 2>/dev/null
+}
+
+numbers () {
+	i=1
+	while test $i -le $1
+	do
+		echo $i
+		i=$(($i + 1))
+	done
+}
+
+test_expect_success 'setup' '
+	for i in $(numbers 50)
+	do
+		mkdir -p dir$(($i % 3)) &&
+		echo $i >dir$(($i % 3))/file$i || return 1
+	done &&
+	cat >.git/info/exclude <<-\EOF &&
+	*.expect
+	*.actual
+	shared*
+	unmerged
+	EOF
+	git add . &&
+	git commit -q -m initial &&
+	git ls-files --stage >ls-files.expect
+'
+
+test_expect_success 'enable split index' '
+	git update-index --split-index &&
+	shared_indexes >shared &&
+	test_line_count = 1 shared &&
+	git ls-files --stage >ls-files.actual &&
+	test_cmp ls-files.expect ls-files.actual
+'
+
+test_expect_success 'small changes do not rewrite the shared index' '
+	shared_indexes >shared.before &&
+	echo changed >dir1/file1 &&
+	echo new >dir2/new &&
+	git add dir1/file1 dir2/new &&
+	git rm -q --cached dir0/file3 &&
+	shared_indexes >shared.after &&
+	test_cmp shared.before shared.after &&
+	cat >status.expect <<-\EOF &&
+	D  dir0/file3
+	M  dir1/file1
+	A  dir2/new
+	?? dir0/file3
+	EOF
+	git status --porcelain >status.actual &&
+	test_cmp status.expect status.actual &&
+	git ls-files --stage >ls-files.actual &&
+	grep dir2/new ls-files.actual &&
+	! grep "	dir0/file3$" ls-files.actual
+'
+
+test_expect_success 'commit and checkout in split index mode' '
+	rm dir0/file3 &&
+	git commit -q -m second &&
+	git diff --cached --exit-code &&
+	git checkout -q HEAD^ &&
+	git ls-files --stage >ls-files.actual &&
+	test_cmp ls-files.expect ls-files.actual &&
+	git checkout -q master &&
+	git diff --exit-code &&
+	git diff --cached --exit-code
+'
+
+test_expect_success 'many changes rewrite the shared index' '
+	shared_indexes >shared.before &&
+	for i in $(numbers 20)
+	do
+		echo again >dir$(($i % 3))/more$i || return 1
+	done &&
+	git add . &&
+	shared_indexes >shared.after &&
+	! test_cmp shared.before shared.after &&
+	git status --porcelain >status.actual &&
+	grep "^A  dir1/more1" status.actual &&
+	test_line_count = 20 status.actual
+'
+
+test_expect_success 'conflicted entries in split index mode' '
+	git commit -q -m third &&
+	git checkout -q -b side HEAD~2 &&
+	echo side >dir1/file1 &&
+	git commit -q -a -m side &&
+	test_must_fail git merge master &&
+	git ls-files -u >unmerged &&
+	test_line_count = 3 unmerged &&
+	echo resolved >dir1/file1 &&
+	git add dir1/file1 &&
+	git ls-files -u >unmerged &&
+	test_line_count = 0 unmerged &&
+	git commit -q -m merged
+'
+
+test_expect_success 'disable split index' '
+	git ls-files --stage >ls-files.expect &&
+	git update-index --no-split-index &&
+	git ls-files --stage >ls-files.actual &&
+	test_cmp ls-files.expect ls-files.actual &&
+	rm -f .git/sharedindex.* &&
+	git ls-files --stage >ls-files.actual &&
+	test_cmp ls-files.expect ls-files.actual
+'
+
+test_expect_success 'missing shared index is an error' '
+	git update-index --split-index &&
+	rm -f .git/sharedindex.* &&
+	test_must_fail git ls-files
+'
+
+test_done
@@ -29,4 +29,57 @@ test_expect_success 'update-index -h with corrupt index' '
 	grep "[Uu]sage: git update-index" broken/usage
 '
 
+test_expect_success '--index-version out of range' '
+	test_must_fail git update-index --index-version 1 &&
+	test_must_fail git update-index --index-version 5
+'
+
+test_expect_success 'setup for --index-version' '
+	mkdir -p dir/sub other &&
+	for f in a dir/b dir/sub/c dir/sub/cc dir/sub/d other/e zzz
+	do
+		echo $f >$f || return 1
+	done &&
+	git add . &&
+	git ls-files --stage >expect
+'
+
+test_expect_success '--index-version 4' '
+	git update-index --index-version 4 &&
+	test "$(test-index-version <.git/index)" = 4 &&
+	git ls-files --stage >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'version 4 index stays version 4 when updated' '
+	echo more >dir/sub/d &&
+	git add dir/sub/d &&
+	git rm -q --cached dir/sub/c &&
+	git update-index --skip-worktree other/e &&
+	test "$(test-index-version <.git/index)" = 4 &&
+	git ls-files -v >actual &&
+	grep "^S other/e" actual &&
+	git update-index --no-skip-worktree other/e &&
+	git add dir/sub/c &&
+	git ls-files --stage >actual &&
+	grep -v dir/sub/d expect >expect.rest &&
+	grep -v dir/sub/d actual >actual.rest &&
+	test_cmp expect.rest actual.rest
+'
+
+test_expect_success 'version 4 index survives checkout' '
+	git commit -q -m initial &&
+	git checkout -q -b other &&
+	git checkout -q master &&
+	test "$(test-index-version <.git/index)" = 4
+'
+
+test_expect_success '--index-version 2 converts back' '
+	git ls-files --stage >expect &&
+	git update-index --index-version 2 &&
+	test "$(test-index-version <.git/index)" = 2 &&
+	git ls-files --stage >actual &&
+	test_cmp expect actual
+'
+
 test_done
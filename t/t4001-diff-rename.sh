@@ -102,4 +102,120 @@ test_expect_success 'setup for many rename source candidates' '
 	grep warning actual.err
 '
 
+test_expect_success 'setup for many inexact renames' '
+	git reset --hard &&
+	mkdir moved &&
+	for i in 0 1 2 3 4 5 6 7 8 9
+	do
+		for j in 0 1 2 3 4 5 6 7 8 9
+		do
+			printf "line %s\n" 1 2 3 4 5 6 7 8 "$i" "$j" >"path$i$j" ||
+			return 1
+		done
+	done &&
+	git commit -q -a -m "longer" &&
+	for i in 0 1 2 3 4 5 6 7 8 9
+	do
+		for j in 0 1 2 3 4 5 6 7 8 9
+		do
+			sed -e "s/line 1\$/edited/" "path$i$j" >"moved/path$i$j" &&
+			git rm -q "path$i$j" ||
+			return 1
+		done
+	done &&
+	cp moved/path17 moved/copy &&
+	echo more >>moved/copy &&
+	git add moved &&
+	test_tick &&
+	git commit -q -m "move with edits"
+'
+
+test_expect_success 'threaded rename detection gives the same result' '
+	git -c diff.renameThreads=1 diff -C -C --stat HEAD^ HEAD >expect &&
+	git -c diff.renameThreads=4 diff -C -C --stat HEAD^ HEAD >actual &&
+	test_cmp expect actual &&
+	git -c diff.renameThreads=1 log -M --name-status -1 >expect &&
+	git -c diff.renameThreads=3 log -M --name-status -1 >actual &&
+	test_cmp expect actual &&
+	grep "^R0[0-9]*	path17	moved/path17" actual
+'
+
+test_expect_success 'setup for renames guided by names' '
+	git reset --hard &&
+	git rm -q -r . &&
+	mkdir one two &&
+	for f in one/Makefile one/alpha two/Makefile two/beta
+	do
+		printf "%s line %s\n" $f 1 2 3 4 5 6 7 8 9 >$f ||
+		return 1
+	done &&
+	git add one two &&
+	test_tick &&
+	git commit -q -m "two directories" &&
+	mkdir uno dos &&
+	for f in one/Makefile one/alpha two/Makefile two/beta
+	do
+		new=$(echo $f | sed -e "s/^one/uno/" -e "s/^two/dos/") &&
+		sed -e "s/line 1\$/changed/" $f >$new &&
+		git rm -q $f ||
+		return 1
+	done &&
+	git add uno dos &&
+	test_tick &&
+	git commit -q -m "rename directories"
+'
+
+test_expect_success 'renames of unique basenames escape the rename limit' '
+	git diff -M -l1 --name-status HEAD^ HEAD >actual &&
+	grep "^R0[0-9]*	one/alpha	uno/alpha" actual &&
+	grep "^R0[0-9]*	two/beta	dos/beta" actual
+'
+
+test_expect_success 'renamed directories pair up files of the same name' '
+	git diff -M -l1 --name-status HEAD^ HEAD >actual &&
+	sed -e "s/^R[0-9]*/R/" actual >actual.munged &&
+	cat >expect <<-\EOF &&
+	R	one/Makefile	uno/Makefile
+	R	one/alpha	uno/alpha
+	R	two/Makefile	dos/Makefile
+	R	two/beta	dos/beta
+	EOF
+	sort actual.munged >actual.sorted &&
+	test_cmp expect actual.sorted
+'
+
+test_expect_success 'rename cache is not written by default' '
+	git diff -M --name-status HEAD^ HEAD >expect &&
+	test_must_fail git rev-parse -q --verify refs/notes/similarity
+'
+
+test_expect_success 'rename cache remembers the compared blobs' '
+	git -c diff.renameCache=true diff -M --name-status HEAD^ HEAD >actual &&
+	test_cmp expect actual &&
+	git rev-parse -q --verify refs/notes/similarity &&
+	git notes --ref=similarity list >notes &&
+	git rev-parse HEAD:uno/alpha >blob &&
+	grep "^[0-9a-f]* $(cat blob)\$" notes
+'
+
+test_expect_success 'renames found from the rename cache are the same' '
+	git -c diff.renameCache=true diff -M --name-status HEAD^ HEAD >actual &&
+	test_cmp expect actual &&
+	git -c diff.renameCache=true diff -M -l1 --name-status HEAD^ HEAD >actual &&
+	git diff -M -l1 --name-status HEAD^ HEAD >expect.limited &&
+	test_cmp expect.limited actual
+'
+
+test_expect_success 'rename cache is dropped when its notes are edited' '
+	test_when_finished "git update-ref -d refs/notes/similarity" &&
+	git notes --ref=similarity list |
+	while read note blob
+	do
+		git notes --ref=similarity add -f -m garbage $blob ||
+		return 1
+	done &&
+	git -c diff.renameCache=true diff -M --name-status HEAD^ HEAD >actual &&
+	test_cmp expect actual
+'
+
 test_done
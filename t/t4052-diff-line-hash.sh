@@ -0,0 +1,74 @@
+#!/bin/sh
+
+test_description='splitting files into lines for diff'
+. ./test-lib.sh
+
+# Show the length of each line of the file, counting its newline
+line_lengths () {
+	perl -ne 'print length($_), "\n"' "$1"
+}
+
+test_expect_success 'setup' '
+	for i in 0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20
+	do
+		printf "%${i}s\n" "" | tr " " x >>ascending &&
+		printf "%${i}s" "" | tr " " y >nonl-$i ||
+		return 1
+	done &&
+	printf "\n\n\nabc\n\n" >empty-lines
+'
+
+test_expect_success 'lines of every length' '
+	line_lengths ascending >expect &&
+	test-xdl-hash ascending >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'incomplete lines of every length' '
+	for i in 0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19 20
+	do
+		cat ascending nonl-$i >file &&
+		line_lengths file >expect &&
+		test-xdl-hash file >actual &&
+		test_cmp expect actual ||
+		return 1
+	done
+'
+
+test_expect_success 'empty lines' '
+	line_lengths empty-lines >expect &&
+	test-xdl-hash empty-lines >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'diff of files with long lines' '
+	for i in 1 2 3 4 5 6 7 8 9
+	do
+		echo "$i $i $i $i $i $i $i $i $i $i $i $i $i $i $i $i $i" ||
+		return 1
+	done >old &&
+	sed -e "s/^5 .*/changed/" -e "\$s/\$/ 9/" old >new &&
+	printf "last line without newline" >>new &&
+	test_must_fail git diff --no-index old new >output &&
+	sed -e 1,2d output >actual &&
+	cat >expect <<-\EOF &&
+	--- a/old
+	+++ b/new
+	@@ -2,8 +2,9 @@
+	 2 2 2 2 2 2 2 2 2 2 2 2 2 2 2 2 2
+	 3 3 3 3 3 3 3 3 3 3 3 3 3 3 3 3 3
+	 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4 4
+	-5 5 5 5 5 5 5 5 5 5 5 5 5 5 5 5 5
+	+changed
+	 6 6 6 6 6 6 6 6 6 6 6 6 6 6 6 6 6
+	 7 7 7 7 7 7 7 7 7 7 7 7 7 7 7 7 7
+	 8 8 8 8 8 8 8 8 8 8 8 8 8 8 8 8 8
+	-9 9 9 9 9 9 9 9 9 9 9 9 9 9 9 9 9
+	+9 9 9 9 9 9 9 9 9 9 9 9 9 9 9 9 9 9
+	+last line without newline
+	\ No newline at end of file
+	EOF
+	test_cmp expect actual
+'
+
+test_done
@@ -0,0 +1,132 @@
+#!/bin/sh
+
+test_description='history simplification with the changed-paths file'
+. ./test-lib.sh
+
+cpth=.git/objects/info/changed-paths
+
+test_expect_success 'setup' '
+	mkdir -p a/b/c d &&
+	echo one >a/b/c/file &&
+	echo one >a/file &&
+	echo one >d/file &&
+	echo one >top &&
+	git add . &&
+	test_commit initial &&
+	echo two >a/b/c/file &&
+	test_commit deep a/b/c/file &&
+	test_commit sibling a/b/other &&
+	git checkout -b side initial &&
+	echo side >d/file &&
+	test_commit side-d d/file &&
+	echo side >a/file &&
+	test_commit side-a a/file &&
+	git checkout master &&
+	git merge -m merge side &&
+	git mv d/file d/moved &&
+	test_commit rename &&
+	git rm -q top &&
+	mkdir top &&
+	echo dir >top/file &&
+	git add top &&
+	test_commit file-to-dir &&
+	git commit --allow-empty -m empty &&
+	i=0 &&
+	while test $i -lt 600
+	do
+		i=$(($i + 1)) &&
+		echo $i >many.$i || return 1
+	done &&
+	git add . &&
+	test_commit many-paths &&
+	git checkout --orphan other &&
+	git rm -q -r -f . &&
+	mkdir -p a/b &&
+	echo other >a/b/unrelated &&
+	git add a/b/unrelated &&
+	test_commit other-root &&
+	git checkout master &&
+	git merge -m "merge other" other
+'
+
+test_expect_success 'write changed-paths file' '
+	git commit-graph write --changed-paths &&
+	test -f $cpth &&
+	git commit-graph verify
+'
+
+log_two_modes () {
+	git -c core.commitGraph=false log --format="%H %P" "$@" >expect &&
+	git log --format="%H %P" "$@" >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'log agrees with and without the file' '
+	for path in a a/ a/b a/b/c a/b/c/file a/file d d/file d/moved \
+		top top/file many.1 many.600 missing "a/*" .
+	do
+		log_two_modes -- "$path" &&
+		log_two_modes --full-history -- "$path" &&
+		log_two_modes --simplify-merges -- "$path" &&
+		log_two_modes --first-parent -- "$path" &&
+		log_two_modes --all --parents -- "$path" || return 1
+	done
+'
+
+test_expect_success 'log with several paths agrees with and without the file' '
+	log_two_modes -- a/b d &&
+	log_two_modes --full-history -- top many.5 &&
+	log_two_modes -- "a/*" d
+'
+
+test_expect_success 'rev-list agrees with and without the file' '
+	git -c core.commitGraph=false rev-list --count --all -- a/b >expect &&
+	git rev-list --count --all -- a/b >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'commits not in the file are diffed' '
+	echo three >a/b/c/file &&
+	test_commit after-file a/b/c/file &&
+	log_two_modes -- a/b/c &&
+	git commit-graph write --changed-paths &&
+	git commit-graph verify &&
+	log_two_modes -- a/b/c
+'
+
+test_expect_success 'log trusts the filters' '
+	test_when_finished "git commit-graph write --changed-paths" &&
+	git commit-graph write --changed-paths &&
+	chmod u+w $cpth &&
+	nr=$(git rev-list --count --all) &&
+	start=$((16 + 1024 + $nr * 24)) &&
+	size=$(wc -c <$cpth) &&
+	dd if=/dev/zero of=$cpth bs=1 seek=$start \
+		count=$(($size - 20 - $start)) conv=notrunc 2>/dev/null &&
+	git log --format=%H -- a/b/c >actual &&
+	! test -s actual &&
+	git -c core.commitGraph=false log --format=%H -- a/b/c >expect &&
+	test -s expect &&
+	test_must_fail git commit-graph verify
+'
+
+test_expect_success 'grafts disable the filters' '
+	test_when_finished "rm -f .git/info/grafts" &&
+	echo "$(git rev-parse rename) $(git rev-parse initial)" >.git/info/grafts &&
+	log_two_modes -- a/b &&
+	test_must_fail git commit-graph write --changed-paths
+'
+
+test_expect_success 'verify notices a corrupt changed-paths file' '
+	git commit-graph write --changed-paths &&
+	cp $cpth cpth.bak &&
+	chmod u+w $cpth &&
+	size=$(wc -c <$cpth) &&
+	printf "\377" |
+	dd of=$cpth bs=1 seek=$(($size - 21)) conv=notrunc 2>/dev/null &&
+	test_must_fail git commit-graph verify &&
+	mv cpth.bak $cpth &&
+	git commit-graph verify
+'
+
+test_done
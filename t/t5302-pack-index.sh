@@ -65,6 +65,24 @@ test_expect_success \
     'cmp "test-1-${pack1}.idx" "1.idx" &&
      cmp "test-2-${pack2}.idx" "2.idx"'
 
+test_expect_success 'index-pack with multiple threads' '
+	git index-pack --threads=4 --index-version=2 -o 2-mt.idx \
+		"test-1-${pack1}.pack" &&
+	cmp "test-2-${pack2}.idx" 2-mt.idx
+'
+
+test_expect_success 'index-pack honors pack.threads' '
+	git -c pack.threads=3 index-pack --index-version=2 -o 2-cfg.idx \
+		"test-1-${pack1}.pack" &&
+	cmp "test-2-${pack2}.idx" 2-cfg.idx
+'
+
+test_expect_success 'index-pack with multiple threads and a small base cache' '
+	git -c core.deltabasecachelimit=1k index-pack --threads=4 \
+		--index-version=2 -o 2-small.idx "test-1-${pack1}.pack" &&
+	cmp "test-2-${pack2}.idx" 2-small.idx
+'
+
 test_expect_success 'index-pack --verify on index version 1' '
 	git index-pack --verify "test-1-${pack1}.pack"
 '
@@ -0,0 +1,143 @@
+#!/bin/sh
+
+test_description='pack-objects with reachability bitmaps'
+. ./test-lib.sh
+
+packdir=.git/objects/pack
+
+# List the objects in the pack produced by pack-objects --revs from
+# the revision arguments on stdin.
+pack_objects () {
+	git pack-objects --revs --stdout "$@" >tmp.pack &&
+	git index-pack -o tmp.idx tmp.pack >/dev/null &&
+	git show-index <tmp.idx | cut -d" " -f2 | sort
+}
+
+test_expect_success 'setup' '
+	for i in 1 2 3 4 5 6 7 8 9 10
+	do
+		mkdir -p dir$(($i % 3)) &&
+		echo $i >dir$(($i % 3))/file$(($i % 4)) &&
+		git add . &&
+		test_tick &&
+		git commit -m "commit $i" || return 1
+	done &&
+	git tag -a -m "annotated" annotated HEAD~3 &&
+	git tag lightweight HEAD~6 &&
+	git checkout -b side HEAD~5 &&
+	test_commit side-one &&
+	test_commit side-two &&
+	git checkout master &&
+	git merge side &&
+	test_commit after-merge
+'
+
+test_expect_success 'repack -b needs -a' '
+	test_must_fail git repack -b &&
+	! ls $packdir/*.bitmap
+'
+
+test_expect_success 'repack -adb writes a bitmap' '
+	git repack -adb &&
+	ls $packdir/*.bitmap >bitmaps &&
+	test_line_count = 1 bitmaps
+'
+
+test_expect_success 'full pack from bitmaps has all objects' '
+	git rev-list --objects --all | cut -c1-40 | sort >expect &&
+	echo | pack_objects --all >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'partial pack from bitmaps' '
+	git rev-list --objects master --not side~1 annotated |
+		cut -c1-40 | sort >expect &&
+	printf "master\n--not\nside~1\nannotated\n\n" | pack_objects >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'pack.useBitmaps=false gives the same pack' '
+	printf "master\n--not\nside~1\nannotated\n\n" | pack_objects >expect &&
+	test_config pack.useBitmaps false &&
+	printf "master\n--not\nside~1\nannotated\n\n" | pack_objects >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'objects outside the bitmapped pack' '
+	test_commit loose &&
+	git rev-list --objects --all | cut -c1-40 | sort >expect &&
+	echo | pack_objects --all >actual &&
+	test_cmp expect actual &&
+	git rev-list --objects loose --not master~1 |
+		cut -c1-40 | sort >expect &&
+	printf "loose\n--not\nmaster~1\n\n" | pack_objects >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'clone from a bitmapped repository' '
+	git repack -adb &&
+	git clone --no-local --bare . clone.git &&
+	git --git-dir=clone.git fsck &&
+	git rev-list --objects --all | cut -c1-40 | sort >expect &&
+	git --git-dir=clone.git rev-list --objects --all |
+		cut -c1-40 | sort >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'fetch from a bitmapped repository' '
+	test_commit more &&
+	git repack -adb &&
+	git --git-dir=clone.git fetch "$(pwd)/.git" master:master &&
+	git --git-dir=clone.git fsck &&
+	test "$(git rev-parse master)" = \
+		"$(git --git-dir=clone.git rev-parse master)"
+'
+
+test_expect_success 'full pack is the bitmapped pack verbatim' '
+	echo | git pack-objects --revs --all --stdout --delta-base-offset >full.pack &&
+	test_cmp $packdir/pack-*.pack full.pack
+'
+
+test_expect_success 'reused objects at the start of the pack' '
+	git rev-list --objects master --not master~2 |
+		cut -c1-40 | sort >expect &&
+	printf "master\n--not\nmaster~2\n\n" |
+		pack_objects --delta-base-offset >actual &&
+	git index-pack --strict -o tmp.idx tmp.pack &&
+	test_cmp expect actual
+'
+
+test_expect_success 'reused objects with --include-tag' '
+	git tag -a -m "tip" tip-tag master &&
+	git repack -adb &&
+	{
+		git rev-list --objects master --not master~2 | cut -c1-40 &&
+		git rev-parse tip-tag
+	} | sort >expect &&
+	printf "master\n--not\nmaster~2\n\n" |
+		pack_objects --delta-base-offset --include-tag >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'corrupt bitmap is ignored' '
+	bitmap=$(ls $packdir/*.bitmap) &&
+	chmod +w $bitmap &&
+	echo garbage >$bitmap &&
+	git rev-list --objects --all | cut -c1-40 | sort >expect &&
+	echo | pack_objects --all >actual 2>/dev/null &&
+	test_cmp expect actual
+'
+
+test_expect_success 'repack -ad without -b drops the bitmap' '
+	test_commit last &&
+	git repack -ad &&
+	! ls $packdir/*.bitmap
+'
+
+test_expect_success 'repack.writeBitmaps' '
+	git -c repack.writeBitmaps=true repack -ad &&
+	ls $packdir/*.bitmap >bitmaps &&
+	test_line_count = 1 bitmaps
+'
+
+test_done
@@ -0,0 +1,122 @@
+#!/bin/sh
+
+test_description='commit-graph file'
+. ./test-lib.sh
+
+graph=.git/objects/info/commit-graph
+
+test_expect_success 'setup' '
+	test_commit one &&
+	test_commit two &&
+	git checkout -b side one &&
+	test_commit three &&
+	test_commit four &&
+	git checkout -b other one &&
+	test_commit five &&
+	git checkout master &&
+	git merge side &&
+	T=$(git write-tree) &&
+	OCTO=$(echo octopus |
+		git commit-tree $T -p HEAD -p other -p four) &&
+	git update-ref refs/heads/octopus $OCTO &&
+	test_commit six
+'
+
+test_expect_success 'verify without a commit-graph succeeds' '
+	git commit-graph verify
+'
+
+test_expect_success 'write commit-graph' '
+	git commit-graph write &&
+	test -f $graph &&
+	git commit-graph verify
+'
+
+graph_git_two_modes () {
+	git -c core.commitGraph=false "$@" >expect &&
+	git "$@" >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'rev-list agrees with and without the graph' '
+	graph_git_two_modes rev-list --all --parents &&
+	graph_git_two_modes rev-list --count --all &&
+	graph_git_two_modes rev-list --topo-order --all &&
+	graph_git_two_modes rev-list --format=%ct --all
+'
+
+test_expect_success 'merge-base agrees with and without the graph' '
+	graph_git_two_modes merge-base --all six five &&
+	graph_git_two_modes merge-base --octopus octopus side other
+'
+
+test_expect_success '--contains agrees with and without the graph' '
+	git tag -m annotated annotated five &&
+	for c in one two three four five six octopus
+	do
+		graph_git_two_modes tag --contains $c &&
+		graph_git_two_modes branch --contains $c || return 1
+	done
+'
+
+test_expect_success 'show-branch --independent agrees with and without the graph' '
+	graph_git_two_modes show-branch --independent master side other octopus one
+'
+
+test_expect_success 'commits not in the graph are read from the objects' '
+	test_commit seven &&
+	graph_git_two_modes rev-list --parents --all &&
+	git commit-graph write &&
+	git commit-graph verify
+'
+
+test_expect_success 'write from commits on stdin' '
+	git rev-parse side >tips &&
+	git commit-graph write --stdin-commits <tips &&
+	git commit-graph verify &&
+	graph_git_two_modes rev-list --parents --all
+'
+
+test_expect_success 'grafts override the commit-graph' '
+	git commit-graph write &&
+	echo "$(git rev-parse six) $(git rev-parse one)" >.git/info/grafts &&
+	git rev-list --parents -1 six >actual &&
+	echo "$(git rev-parse six) $(git rev-parse one)" >expect &&
+	test_cmp expect actual &&
+	git commit-graph write &&
+	rm .git/info/grafts &&
+	git commit-graph verify
+'
+
+test_expect_success 'grafts disable generation numbers' '
+	git commit-graph write &&
+	echo "$(git rev-parse five) $(git rev-parse six)" >.git/info/grafts &&
+	git tag --contains six >actual &&
+	printf "%s\n" annotated five seven six >expect &&
+	test_cmp expect actual &&
+	rm .git/info/grafts
+'
+
+test_expect_success 'verify notices a corrupt commit-graph' '
+	git commit-graph write &&
+	cp $graph graph.bak &&
+	chmod u+w $graph &&
+	size=$(wc -c <$graph) &&
+	printf "\377" |
+	dd of=$graph bs=1 seek=$(($size - 30)) conv=notrunc 2>/dev/null &&
+	test_must_fail git commit-graph verify &&
+	mv graph.bak $graph
+'
+
+test_expect_success 'a truncated commit-graph is ignored' '
+	cp $graph graph.bak &&
+	chmod u+w $graph &&
+	head -c 100 graph.bak >$graph &&
+	git rev-list --count --all >actual 2>err &&
+	git -c core.commitGraph=false rev-list --count --all >expect &&
+	test_cmp expect actual &&
+	grep "too small" err &&
+	mv graph.bak $graph
+'
+
+test_done
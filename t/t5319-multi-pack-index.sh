@@ -0,0 +1,83 @@
+#!/bin/sh
+
+test_description='multi-pack index'
+. ./test-lib.sh
+
+packdir=.git/objects/pack
+
+test_expect_success 'setup' '
+	for i in 1 2 3 4 5
+	do
+		test_commit $i &&
+		git repack -d || return 1
+	done &&
+	ls $packdir/*.pack >packs &&
+	test_line_count = 5 packs &&
+	git rev-list --objects --all | cut -c1-40 | sort >objects
+'
+
+test_expect_success 'verify without a multi-pack index' '
+	git multi-pack-index verify
+'
+
+test_expect_success 'write multi-pack index' '
+	git multi-pack-index write &&
+	test -f $packdir/multi-pack-index &&
+	git multi-pack-index verify
+'
+
+test_expect_success 'objects are found through the index' '
+	git fsck &&
+	git cat-file --batch-check <objects >actual &&
+	! grep missing actual &&
+	git log --oneline >log &&
+	test_line_count = 5 log
+'
+
+test_expect_success 'core.multiPackIndex=false' '
+	git -c core.multiPackIndex=false cat-file --batch-check <objects >actual &&
+	! grep missing actual
+'
+
+test_expect_success 'new pack outside the index' '
+	test_commit 6 &&
+	git repack -d &&
+	git rev-parse 6:6.t >blob &&
+	git cat-file --batch-check <blob >actual &&
+	! grep missing actual &&
+	git multi-pack-index verify
+'
+
+test_expect_success 'stale index is ignored' '
+	old=$(ls $packdir/*.pack | head -n 1) &&
+	git pack-objects --all --revs $packdir/pack </dev/null >new &&
+	rm -f $old ${old%.pack}.idx &&
+	git cat-file --batch-check <objects >actual &&
+	! grep missing actual &&
+	test_must_fail git multi-pack-index verify &&
+	git multi-pack-index write &&
+	git multi-pack-index verify
+'
+
+test_expect_success 'corrupt index is detected' '
+	cp $packdir/multi-pack-index backup &&
+	chmod +w $packdir/multi-pack-index &&
+	size=$(wc -c <$packdir/multi-pack-index) &&
+	printf "\377" | dd of=$packdir/multi-pack-index bs=1 \
+		seek=$(($size - 30)) conv=notrunc 2>/dev/null &&
+	test_must_fail git multi-pack-index verify &&
+	mv backup $packdir/multi-pack-index
+'
+
+test_expect_success 'expire drops packs whose objects are all elsewhere' '
+	touch -m -t 200001010000 $packdir/pack-*.pack &&
+	touch -m $packdir/pack-$(cat new).pack &&
+	git multi-pack-index expire &&
+	echo $packdir/pack-$(cat new).pack >expect &&
+	ls $packdir/*.pack >actual &&
+	test_cmp expect actual &&
+	git multi-pack-index verify &&
+	git fsck
+'
+
+test_done
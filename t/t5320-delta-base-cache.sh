@@ -0,0 +1,74 @@
+#!/bin/sh
+
+test_description='delta base cache'
+. ./test-lib.sh
+
+test_expect_success 'setup delta chains' '
+	i=0 &&
+	while test $i -lt 40
+	do
+		i=$(($i + 1)) &&
+		for f in one two three
+		do
+			{
+				cat $f 2>/dev/null
+				echo "$f line $i"
+			} >$f.new &&
+			mv $f.new $f || return 1
+		done &&
+		git add one two three &&
+		test_tick &&
+		git commit -q -m "commit $i" || return 1
+	done &&
+	git repack -a -d -f --depth=50 --window=50 &&
+	git verify-pack -v .git/objects/pack/*.pack >verify &&
+	grep "chain length = [2-9]" verify
+'
+
+test_expect_success 'objects read the same with any cache size' '
+	git log -p >expect &&
+	git -c core.deltaBaseCacheLimit=1 log -p >actual &&
+	test_cmp expect actual &&
+	git -c core.deltaBaseCacheLimit=1k log -p >actual &&
+	test_cmp expect actual &&
+	git rev-list --objects --all | cut -d" " -f1 >objects &&
+	git cat-file --batch <objects >expect &&
+	git -c core.deltaBaseCacheLimit=1k cat-file --batch <objects >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'cache statistics are traced' '
+	GIT_TRACE_DELTA_BASE_STATS="$(pwd)/trace" git log -p >/dev/null &&
+	grep "^delta base cache: [1-9][0-9]* hits, [0-9]* misses, 0 evictions" trace
+'
+
+test_expect_success 'a small cache evicts bases' '
+	rm -f trace &&
+	GIT_TRACE_DELTA_BASE_STATS="$(pwd)/trace" \
+		git -c core.deltaBaseCacheLimit=1k log -p >/dev/null &&
+	grep "^delta base cache: .* [1-9][0-9]* evictions" trace &&
+	grep "(limit 1024)" trace
+'
+
+test_expect_success 'no statistics without the trace variable' '
+	git log -p >/dev/null 2>err &&
+	! grep "delta base cache" err
+'
+
+test_expect_success 'packed objects can be read from several threads' '
+	git rev-list --objects --all | cut -d" " -f1 >objects &&
+	test-read-objects 8 <objects &&
+	test_config core.deltaBaseCacheLimit 1k &&
+	test-read-objects 8 <objects
+'
+
+test_expect_success 'threaded grep reads packed trees the same' '
+	git grep --threads=1 -n line HEAD HEAD~10 HEAD~30 >expect &&
+	git grep --threads=8 -n line HEAD HEAD~10 HEAD~30 >actual &&
+	test_cmp expect actual &&
+	git -c core.deltaBaseCacheLimit=1k grep --threads=8 -n line \
+		HEAD HEAD~10 HEAD~30 >actual &&
+	test_cmp expect actual
+'
+
+test_done
@@ -326,4 +326,54 @@ EOF
 	test_cmp count7.expected count7.actual
 '
 
+test_expect_success 'setup for skipping negotiation' '
+	git init skip-server &&
+	(cd skip-server &&
+	 test_commit base &&
+	 git clone . ../skip-client &&
+	 i=0 &&
+	 while test $i -lt 20
+	 do
+		test_commit server$i ||
+		return 1
+		i=$(($i + 1))
+	 done
+	) &&
+	(cd skip-client &&
+	 i=0 &&
+	 while test $i -lt 100
+	 do
+		test_commit local$i ||
+		return 1
+		i=$(($i + 1))
+	 done
+	)
+'
+
+test_expect_success 'skipping negotiation sends fewer haves' '
+	cp -R skip-client skip-default &&
+	(cd skip-default &&
+	 GIT_TRACE_PACKET="$(pwd)/trace" git fetch origin &&
+	 grep "fetch> have" trace >haves
+	) &&
+	cp -R skip-client skip-skipping &&
+	(cd skip-skipping &&
+	 GIT_TRACE_PACKET="$(pwd)/trace" \
+		git -c fetch.negotiationAlgorithm=skipping fetch origin &&
+	 grep "fetch> have" trace >haves &&
+	 grep "fetch> have $(git rev-parse base)" trace &&
+	 git rev-parse origin/master >actual &&
+	 (cd ../skip-server && git rev-parse master) >expect &&
+	 test_cmp expect actual &&
+	 git fsck
+	) &&
+	test $(wc -l <skip-skipping/haves) -lt $(wc -l <skip-default/haves)
+'
+
+test_expect_success 'unknown negotiation algorithm is rejected' '
+	(cd skip-client &&
+	 test_must_fail git -c fetch.negotiationAlgorithm=bogus fetch origin
+	)
+'
+
 test_done
@@ -0,0 +1,119 @@
+#!/bin/sh
+
+test_description='upload-pack serves repeated requests from its pack cache'
+. ./test-lib.sh
+
+cache=server/.git/upload-pack-cache
+
+test_expect_success 'setup' '
+	git init server &&
+	(
+		cd server &&
+		test_commit one &&
+		test_commit two &&
+		git tag -m annotated annotated one
+	)
+'
+
+test_expect_success 'no cache unless enabled' '
+	git clone -q "file://$(pwd)/server" plain &&
+	! test -d $cache
+'
+
+test_expect_success 'a clone fills the cache' '
+	git --git-dir=server/.git config uploadpack.packCache true &&
+	git clone -q "file://$(pwd)/server" first &&
+	test $(ls $cache/*.pack | wc -l) = 1 &&
+	! ls $cache/*.lock
+'
+
+test_expect_success 'the same clone is sent from the cache' '
+	GIT_TRACE="$(pwd)/trace" git clone -q "file://$(pwd)/server" second &&
+	grep "sending cached pack" trace &&
+	(
+		cd second &&
+		git fsck &&
+		git for-each-ref >../second.refs
+	) &&
+	(cd first && git for-each-ref) >first.refs &&
+	test_cmp first.refs second.refs
+'
+
+test_expect_success 'clones with other capabilities use another entry' '
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git clone -q --no-checkout --depth=1 \
+		"file://$(pwd)/server" shallow &&
+	! grep "sending cached pack" trace &&
+	test $(ls $cache/*.pack | wc -l) = 1
+'
+
+test_expect_success 'fetches with the same haves share an entry' '
+	(
+		cd server &&
+		test_commit three
+	) &&
+	(
+		cd first &&
+		git fetch -q origin
+	) &&
+	test $(ls $cache/*.pack | wc -l) = 2 &&
+	rm -f trace &&
+	(
+		cd second &&
+		GIT_TRACE="$(pwd)/../trace" git fetch -q origin &&
+		git fsck &&
+		git rev-parse origin/master >../actual
+	) &&
+	grep "sending cached pack" trace &&
+	git --git-dir=server/.git rev-parse master >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'changed refs do not use the old entry' '
+	(
+		cd server &&
+		git tag new-tag one
+	) &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git clone -q "file://$(pwd)/server" third &&
+	! grep "sending cached pack" trace &&
+	(
+		cd third &&
+		git rev-parse new-tag
+	)
+'
+
+test_expect_success 'old entries are neither used nor kept' '
+	git --git-dir=server/.git config uploadpack.packCacheMaxAge 60 &&
+	for f in $cache/*.pack
+	do
+		test-chmtime -600 $f || return 1
+	done &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git clone -q "file://$(pwd)/server" fourth &&
+	! grep "sending cached pack" trace &&
+	test $(ls $cache/*.pack | wc -l) = 1
+'
+
+test_expect_success 'packs larger than the limit are not cached' '
+	rm -rf $cache &&
+	git --git-dir=server/.git config uploadpack.packCacheLimit 100 &&
+	git clone -q "file://$(pwd)/server" fifth &&
+	! ls $cache/*.pack &&
+	! ls $cache/*.lock
+'
+
+test_expect_success 'a lock left by a dead upload-pack is taken over' '
+	git --git-dir=server/.git config --unset uploadpack.packCacheLimit &&
+	git clone -q "file://$(pwd)/server" sixth &&
+	pack=$(ls $cache/*.pack) &&
+	mv "$pack" "$pack.lock" &&
+	test-chmtime -60 "$pack.lock" &&
+	rm -f trace &&
+	GIT_TRACE="$(pwd)/trace" git clone -q "file://$(pwd)/server" seventh &&
+	grep "removing stale" trace &&
+	test -f "$pack" &&
+	! test -f "$pack.lock"
+'
+
+test_done
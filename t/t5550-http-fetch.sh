@@ -197,6 +197,44 @@ test_expect_success 'fetch notices corrupt idx' '
 	)
 '
 
+test_expect_success 'fetch objects spread over several packs' '
+	cp -R "$HTTPD_DOCUMENT_ROOT_PATH"/repo.git "$HTTPD_DOCUMENT_ROOT_PATH"/repo_packs.git &&
+	(cd "$HTTPD_DOCUMENT_ROOT_PATH"/repo_packs.git &&
+	 for i in 1 2 3 4 5
+	 do
+		blob=$(echo "pack $i" | git hash-object -w --stdin) &&
+		tree=$(printf "100644 blob %s\tfile\n" $blob | git mktree) &&
+		commit=$(echo "pack $i" | git commit-tree $tree -p HEAD) &&
+		git update-ref HEAD $commit &&
+		git repack -d ||
+		return 1
+	 done &&
+	 git update-server-info &&
+	 test 5 -le $(ls objects/pack/pack-*.idx | wc -l)
+	) &&
+	git clone $HTTPD_URL/dumb/repo_packs.git packs &&
+	(cd packs &&
+	 echo "pack 5" >expect &&
+	 test_cmp expect file &&
+	 git fsck --full
+	)
+'
+
+test_expect_success 'fetch notices corrupt idx among several packs' '
+	cp -R "$HTTPD_DOCUMENT_ROOT_PATH"/repo_packs.git "$HTTPD_DOCUMENT_ROOT_PATH"/repo_bad3.git &&
+	(cd "$HTTPD_DOCUMENT_ROOT_PATH"/repo_bad3.git &&
+	 p=`ls objects/pack/pack-*.idx | sed -n 2p` &&
+	 chmod u+w $p &&
+	 printf %0256d 0 | dd of=$p bs=256 count=1 seek=1 conv=notrunc
+	) &&
+	mkdir repo_bad3.git &&
+	(cd repo_bad3.git &&
+	 git --bare init &&
+	 test_must_fail git --bare fetch $HTTPD_URL/dumb/repo_bad3.git &&
+	 ! ls objects/pack/*.temp
+	)
+'
+
 test_expect_success 'did not use upload-pack service' '
 	grep '/git-upload-pack' <"$HTTPD_ROOT_PATH"/access.log >act
 	: >exp
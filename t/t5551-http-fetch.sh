@@ -109,5 +109,42 @@ test_expect_success 'follow redirects (302)' '
 	git clone $HTTPD_URL/smart-redir-temp/repo.git --quiet repo-t
 '
 
+test_expect_success 'large negotiation is streamed compressed' '
+	(cd clone &&
+	 i=0 &&
+	 commit=$(git rev-parse HEAD) &&
+	 while test $i -lt 300
+	 do
+		commit=$(echo "local $i" | git commit-tree HEAD^{tree} -p $commit) ||
+		return 1
+		i=$(($i + 1))
+	 done &&
+	 git update-ref refs/heads/local $commit
+	) &&
+	echo content >>file &&
+	git commit -a -m three &&
+	git push public &&
+	(cd clone &&
+	 git -c http.postbuffer=4 fetch -v -v origin 2>err &&
+	 grep "POST git-upload-pack (chunked, gzip)" err &&
+	 test $(git rev-parse origin/master) = $(cd .. && git rev-parse HEAD)
+	)
+'
+
+test_expect_success 'chunked requests are always probed when authenticating' '
+	echo content >>file &&
+	git commit -a -m four &&
+	git push public &&
+	(cd clone &&
+	 GIT_CURL_VERBOSE=1 git -c http.postbuffer=4 \
+		fetch "$HTTPD_URL_USER_PASS/auth/smart/repo.git" master 2>err &&
+	 tr -d "\015" <err >headers &&
+	 chunked=$(grep -c "^Transfer-Encoding: chunked" headers) &&
+	 probes=$(grep -c "^Content-Length: 4\$" headers) &&
+	 test $chunked -gt 1 &&
+	 test $probes = $chunked
+	)
+'
+
 stop_httpd
 test_done
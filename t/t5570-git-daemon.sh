@@ -144,5 +144,50 @@ test_expect_success 'push disabled'      "test_remote_error    push  repo.git
 test_expect_success 'read access denied' "test_remote_error -x fetch repo.git    'no such repository'"
 test_expect_success 'not exported'       "test_remote_error -n fetch repo.git    'repository not exported'"
 
+stop_git_daemon
+start_git_daemon --max-connections=1 --max-queued=8
+
+test_expect_success 'connections over the limit wait in the queue' '
+	: >"$GIT_DAEMON_DOCUMENT_ROOT_PATH/repo.git/git-daemon-export-ok" &&
+	pids= &&
+	for i in 1 2 3 4 5
+	do
+		git clone -q "$GIT_DAEMON_URL/repo.git" queued$i &
+		pids="$pids $!"
+	done &&
+	for pid in $pids
+	do
+		wait $pid ||
+		return 1
+	done &&
+	for i in 1 2 3 4 5
+	do
+		test_cmp file queued$i/file ||
+		return 1
+	done
+'
+
+stop_git_daemon
+start_git_daemon --max-connections-per-ip=1 --max-queued=8
+
+test_expect_success 'connections from one address are limited' '
+	pids= &&
+	for i in 1 2 3 4 5
+	do
+		git clone -q "$GIT_DAEMON_URL/repo.git" per-ip$i &
+		pids="$pids $!"
+	done &&
+	for pid in $pids
+	do
+		wait $pid ||
+		return 1
+	done &&
+	for i in 1 2 3 4 5
+	do
+		test_cmp file per-ip$i/file ||
+		return 1
+	done
+'
+
 stop_git_daemon
 test_done
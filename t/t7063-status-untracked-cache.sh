@@ -0,0 +1,210 @@
+#!/bin/sh
+
+test_description='git status with the untracked cache'
+
+. ./test-lib.sh
+
+# The cache does not trust directories modified in the current
+# second, so give it a chance before looking.
+backdate () {
+	sleep 1
+}
+
+# The output files are truncated, not created, not to change the
+# top-level directory.
+status () {
+	: >trace &&
+	GIT_TRACE_UNTRACKED_STATS="$TRASH_DIRECTORY/trace" \
+		git status --porcelain >actual
+}
+
+test_expect_success 'setup' '
+	mkdir -p tracked/sub untracked/sub empty &&
+	echo "*.o" >.gitignore &&
+	: >tracked/one &&
+	: >tracked/sub/one &&
+	git add .gitignore tracked &&
+	git commit -q -m initial &&
+	cat >.git/info/exclude <<-\EOF &&
+	actual
+	expect
+	trace
+	EOF
+	: >actual &&
+	: >expect &&
+	: >trace &&
+	: >top &&
+	: >tracked/two &&
+	: >tracked/two.o &&
+	: >untracked/sub/file &&
+	git update-index --untracked-cache
+'
+
+test_expect_success 'status fills the untracked cache' '
+	backdate &&
+	status &&
+	cat >expect <<-\EOF &&
+	?? top
+	?? tracked/two
+	?? untracked/
+	EOF
+	test_cmp expect actual &&
+	echo "untracked cache: 6 directories read, 0 cached" >expect &&
+	test_cmp expect trace
+'
+
+test_expect_success 'unchanged directories are not read again' '
+	status &&
+	cat >expect <<-\EOF &&
+	?? top
+	?? tracked/two
+	?? untracked/
+	EOF
+	test_cmp expect actual &&
+	echo "untracked cache: 0 directories read, 3 cached" >expect &&
+	test_cmp expect trace
+'
+
+test_expect_success 'new file in a subdirectory' '
+	: >tracked/sub/two &&
+	backdate &&
+	status &&
+	cat >expect <<-\EOF &&
+	?? top
+	?? tracked/sub/two
+	?? tracked/two
+	?? untracked/
+	EOF
+	test_cmp expect actual &&
+	echo "untracked cache: 1 directories read, 2 cached" >expect &&
+	test_cmp expect trace
+'
+
+test_expect_success 'file removed from the index and back' '
+	git rm -q --cached tracked/one &&
+	status &&
+	cat >expect <<-\EOF &&
+	D  tracked/one
+	?? top
+	?? tracked/one
+	?? tracked/sub/two
+	?? tracked/two
+	?? untracked/
+	EOF
+	test_cmp expect actual &&
+	git reset -q &&
+	status &&
+	cat >expect <<-\EOF &&
+	?? top
+	?? tracked/sub/two
+	?? tracked/two
+	?? untracked/
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'untracked directory added to the index and back' '
+	git add untracked/sub/file &&
+	status &&
+	cat >expect <<-\EOF &&
+	A  untracked/sub/file
+	?? top
+	?? tracked/sub/two
+	?? tracked/two
+	EOF
+	test_cmp expect actual &&
+	git rm -q --cached untracked/sub/file &&
+	status &&
+	cat >expect <<-\EOF &&
+	?? top
+	?? tracked/sub/two
+	?? tracked/two
+	?? untracked/
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'changed .gitignore' '
+	echo "two" >tracked/.gitignore &&
+	backdate &&
+	status &&
+	cat >expect <<-\EOF &&
+	?? top
+	?? tracked/.gitignore
+	?? untracked/
+	EOF
+	test_cmp expect actual &&
+	rm tracked/.gitignore &&
+	backdate &&
+	status &&
+	cat >expect <<-\EOF &&
+	?? top
+	?? tracked/sub/two
+	?? tracked/two
+	?? untracked/
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'changed info/exclude' '
+	echo top >>.git/info/exclude &&
+	backdate &&
+	status &&
+	cat >expect <<-\EOF &&
+	?? tracked/sub/two
+	?? tracked/two
+	?? untracked/
+	EOF
+	test_cmp expect actual &&
+	echo "untracked cache: 6 directories read, 0 cached" >expect &&
+	test_cmp expect trace
+'
+
+test_expect_success 'file in an empty directory' '
+	mkdir empty/sub &&
+	backdate &&
+	status &&
+	test_must_fail grep empty actual &&
+	: >empty/sub/file &&
+	backdate &&
+	status &&
+	cat >expect <<-\EOF &&
+	?? empty/
+	?? tracked/sub/two
+	?? tracked/two
+	?? untracked/
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'read-tree starts the untracked cache over' '
+	git read-tree HEAD &&
+	status &&
+	cat >expect <<-\EOF &&
+	?? empty/
+	?? tracked/sub/two
+	?? tracked/two
+	?? untracked/
+	EOF
+	test_cmp expect actual &&
+	echo "untracked cache: 7 directories read, 0 cached" >expect &&
+	test_cmp expect trace &&
+	status &&
+	echo "untracked cache: 0 directories read, 3 cached" >expect &&
+	test_cmp expect trace
+'
+
+test_expect_success 'status without the untracked cache' '
+	git update-index --no-untracked-cache &&
+	status &&
+	cat >expect <<-\EOF &&
+	?? empty/
+	?? tracked/sub/two
+	?? tracked/two
+	?? untracked/
+	EOF
+	test_cmp expect actual &&
+	! test -s trace
+'
+
+test_done
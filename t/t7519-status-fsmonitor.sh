@@ -0,0 +1,143 @@
+#!/bin/sh
+
+test_description='git status with a core.fsmonitor hook'
+
+. ./test-lib.sh
+
+# The hook reports the paths listed in .git/changed, one per line,
+# and records the tokens it is asked about in .git/tokens.
+test_expect_success 'setup' '
+	cat >fsmonitor-hook <<-\EOF &&
+	#!/bin/sh
+	test "$1" = 1 || exit 1
+	test -f .git/fail && exit 1
+	echo "[$2]" >>.git/tokens
+	printf "token-%s\0" $(wc -l <.git/tokens)
+	test -f .git/changed && tr "\n" "\0" <.git/changed
+	exit 0
+	EOF
+	chmod +x fsmonitor-hook &&
+	mkdir dir &&
+	echo one >one &&
+	echo two >dir/two &&
+	echo three >dir/three &&
+	git add . &&
+	git commit -q -m initial &&
+	cat >.git/info/exclude <<-\EOF &&
+	actual
+	expect
+	fsmonitor-hook
+	tokens
+	EOF
+	git config core.fsmonitor "$(pwd)/fsmonitor-hook"
+'
+
+test_expect_success 'first run checks everything' '
+	echo changed >one &&
+	git status --porcelain >actual &&
+	echo " M one" >expect &&
+	test_cmp expect actual &&
+	echo "[]" >expect &&
+	test_cmp expect .git/tokens
+'
+
+test_expect_success 'the token is passed back to the hook' '
+	git status --porcelain >actual &&
+	tail -n 1 .git/tokens >tokens &&
+	echo "[token-1]" >expect &&
+	test_cmp expect tokens
+'
+
+test_expect_success 'changes the hook does not report are not looked at' '
+	git add one &&
+	git status --porcelain >actual &&
+	echo "M  one" >expect &&
+	test_cmp expect actual &&
+	echo changed >dir/two &&
+	git status --porcelain >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'reported paths are looked at' '
+	echo dir/two >.git/changed &&
+	git status --porcelain >actual &&
+	cat >expect <<-\EOF &&
+	 M dir/two
+	M  one
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'reported directories cover the paths below' '
+	echo changed >dir/three &&
+	rm .git/changed &&
+	git status --porcelain >actual &&
+	cat >expect <<-\EOF &&
+	 M dir/two
+	M  one
+	EOF
+	test_cmp expect actual &&
+	echo dir >.git/changed &&
+	git status --porcelain >actual &&
+	cat >expect <<-\EOF &&
+	 M dir/three
+	 M dir/two
+	M  one
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'a failing hook makes everything be checked' '
+	git reset -q --hard &&
+	rm -f .git/changed &&
+	git status --porcelain >actual &&
+	test_must_fail test -s actual &&
+	echo changed >dir/two &&
+	>.git/fail &&
+	git status --porcelain >actual &&
+	echo " M dir/two" >expect &&
+	test_cmp expect actual &&
+	rm .git/fail
+'
+
+test_expect_success 'update-index --really-refresh ignores the hook' '
+	git status --porcelain >actual &&
+	echo changed-again >dir/three &&
+	git status --porcelain >actual &&
+	echo " M dir/two" >expect &&
+	test_cmp expect actual &&
+	test_must_fail git update-index --really-refresh >actual &&
+	cat >expect <<-\EOF &&
+	dir/three: needs update
+	dir/two: needs update
+	EOF
+	test_cmp expect actual
+'
+
+test_expect_success 'status asks the hook once' '
+	before=$(wc -l <.git/tokens) &&
+	git status --porcelain >actual &&
+	test $(wc -l <.git/tokens) = $(($before + 1))
+'
+
+test_expect_success 'commands that do not refresh the index do not run the hook' '
+	before=$(wc -l <.git/tokens) &&
+	git ls-files >actual &&
+	git diff --cached >actual &&
+	GIT_INDEX_FILE=.git/tmp-index git read-tree HEAD &&
+	GIT_INDEX_FILE=.git/tmp-index git ls-files >actual &&
+	git read-tree HEAD &&
+	test $(wc -l <.git/tokens) = $before
+'
+
+test_expect_success 'status without core.fsmonitor' '
+	git config core.fsmonitor "" &&
+	git status --porcelain >actual &&
+	cat >expect <<-\EOF &&
+	 M dir/three
+	 M dir/two
+	EOF
+	test_cmp expect actual
+'
+
+test_done
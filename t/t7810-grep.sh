@@ -302,6 +302,30 @@ test_expect_success 'grep should ignore GREP_OPTIONS' '
 	test_cmp expected actual
 '
 
+cat >expected <<EOF
+file:1:foo mmap bar
+file:3:foo_mmap bar mmap
+file:4:foo mmap bar_mmap
+file:5:foo_mmap bar mmap baz
+EOF
+
+test_expect_success 'grep -e A -e B -e C with hits far apart' '
+	git grep -n -e baz -e "foo mmap" -e "bar mmap" file >actual &&
+	test_cmp expected actual
+'
+
+cat >expected <<EOF
+file:1:foo mmap bar
+file:4:foo mmap bar_mmap
+file:5:foo_mmap bar mmap baz
+EOF
+
+test_expect_success 'grep --all-match -e A --or -e B' '
+	git grep -n --all-match -e baz --or -e "foo mmap" >actual &&
+	test_cmp expected actual &&
+	test_must_fail git grep --all-match -e baz --or -e nonexistent
+'
+
 test_expect_success 'grep -f, non-existent file' '
 	test_must_fail git grep -f patterns
 '
@@ -893,4 +917,23 @@ test_expect_success 'mimic ack-grep --group' '
 	test_cmp expected actual
 '
 
+test_expect_success 'grep --threads gives the same output' '
+	git grep -n -C1 -e mmap -e vvv --threads=1 >expected &&
+	git grep -n -C1 -e mmap -e vvv --threads=3 >actual &&
+	test_cmp expected actual &&
+	git -c grep.threads=5 grep -n -C1 -e mmap -e vvv >actual &&
+	test_cmp expected actual &&
+	git grep -n -C1 -e mmap -e vvv --threads=1 HEAD >expected &&
+	git grep -n -C1 -e mmap -e vvv --threads=4 HEAD >actual &&
+	test_cmp expected actual &&
+	git grep -n -C1 -e mmap -e vvv --threads=4 --cached >actual &&
+	sed -e "s/^HEAD://" expected >expected.cached &&
+	test_cmp expected.cached actual
+'
+
+test_expect_success 'grep with a negative number of threads' '
+	test_must_fail git grep --threads=-1 mmap &&
+	test_must_fail git -c grep.threads=-1 grep mmap
+'
+
 test_done
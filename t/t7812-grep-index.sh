@@ -0,0 +1,114 @@
+#!/bin/sh
+
+test_description='git grep with the grep-index file'
+. ./test-lib.sh
+
+gidx=.git/objects/info/grep-index
+
+test_expect_success 'setup' '
+	printf "int main(void)\n{\n\treturn foo_bar();\n}\n" >main.c &&
+	printf "static int Helper(int x)\n{\n\treturn x * 2;\n}\n" >helper.c &&
+	printf "all: main\n\tcc -o main main.c\n" >Makefile &&
+	printf "bin\0ary data\n" >blob.bin &&
+	git add . &&
+	test_tick &&
+	git commit -m initial
+'
+
+test_expect_success 'verify without a grep-index succeeds' '
+	git grep-index verify
+'
+
+test_expect_success 'write grep-index' '
+	git grep-index write &&
+	test -f $gidx &&
+	git grep-index verify
+'
+
+grep_two_modes () {
+	test_might_fail git -c core.grepIndex=false grep "$@" >expect &&
+	test_might_fail git grep "$@" >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'literal patterns give the same result' '
+	grep_two_modes -e foo_bar HEAD &&
+	grep_two_modes --cached -e foo_bar &&
+	grep_two_modes -i -e HELPER HEAD &&
+	grep_two_modes -F -e "x * 2" HEAD &&
+	grep_two_modes -F -i -e "X * 2" HEAD &&
+	grep_two_modes -e nothing_at_all HEAD
+'
+
+test_expect_success 'regular expressions give the same result' '
+	grep_two_modes -e "x.*2" HEAD &&
+	grep_two_modes -e "ret[u]rn" HEAD &&
+	grep_two_modes -e ".ai" HEAD &&
+	grep_two_modes -e "mai*n" HEAD &&
+	grep_two_modes -e "ma\\{0,1\\}in" HEAD &&
+	grep_two_modes -E -e "ma?in" HEAD &&
+	grep_two_modes -E -e "ma{0,2}in" HEAD &&
+	grep_two_modes -E -e "foo_(bar|baz)" HEAD &&
+	grep_two_modes -E -e "h(e)lper" -i HEAD
+'
+
+test_expect_success 'pattern expressions give the same result' '
+	grep_two_modes -e foo -e nothing HEAD &&
+	grep_two_modes -e helper --or -e cc -i HEAD &&
+	grep_two_modes -e return --and -e foo HEAD &&
+	grep_two_modes --all-match -e return -e foo HEAD &&
+	grep_two_modes -e return --and --not -e foo HEAD &&
+	grep_two_modes -l -e return HEAD &&
+	grep_two_modes -c -e int HEAD &&
+	grep_two_modes -v -e return HEAD &&
+	grep_two_modes -L -e main HEAD
+'
+
+test_expect_success 'blobs that cannot match are not read' '
+	blob=$(git rev-parse HEAD:helper.c) &&
+	file=.git/objects/$(echo $blob | sed "s|^..|&/|") &&
+	mv $file ../saved-blob &&
+	test_when_finished "mv ../saved-blob $file" &&
+	echo "HEAD:main.c:	return foo_bar();" >expect &&
+	git grep -e foo_bar HEAD >actual 2>err &&
+	test_cmp expect actual &&
+	! test -s err &&
+	test_might_fail git -c core.grepIndex=false grep -e foo_bar HEAD 2>err &&
+	grep "unable to read" err
+'
+
+test_expect_success 'binary blobs are always read' '
+	echo "Binary file HEAD:blob.bin matches" >expect &&
+	git grep -e ary HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'blobs added after the grep-index are found' '
+	echo "foo_bar again" >new.c &&
+	git add new.c &&
+	test_tick &&
+	git commit -m new &&
+	cat >expect <<-\EOF &&
+	HEAD:main.c:	return foo_bar();
+	HEAD:new.c:foo_bar again
+	EOF
+	git grep -e foo_bar HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'rewriting the grep-index adds the new blobs' '
+	git grep-index write &&
+	git grep-index verify &&
+	grep_two_modes -e foo_bar HEAD &&
+	grep_two_modes -e again HEAD HEAD^
+'
+
+test_expect_success 'verify notices a corrupt grep-index' '
+	cp $gidx ../saved-gidx &&
+	test_when_finished "mv ../saved-gidx $gidx" &&
+	chmod +w $gidx &&
+	printf "\377" | dd of=$gidx bs=1 seek=1200 conv=notrunc &&
+	test_must_fail git grep-index verify
+'
+
+test_done
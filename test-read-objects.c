@@ -0,0 +1,102 @@
+/*
+ * test-read-objects.c: read the objects named on stdin from several
+ * threads at once and check that each comes back with the right name.
+ */
+
+#include "cache.h"
+#include "object.h"
+#include "sha1-array.h"
+#include "thread-utils.h"
+
+static struct sha1_array objects = SHA1_ARRAY_INIT;
+
+struct reader {
+	int start;
+	int bad;
+};
+
+static void *read_objects(void *data)
+{
+	struct reader *reader = data;
+	int i;
+
+	/* start at different places so that threads read different objects */
+	for (i = 0; i < objects.nr; i++) {
+		const unsigned char *sha1 =
+			objects.sha1[(reader->start + i) % objects.nr];
+		unsigned char real_sha1[20];
+		enum object_type type;
+		unsigned long size;
+		void *buf;
+
+		buf = read_sha1_file(sha1, &type, &size);
+		if (!buf) {
+			error("unable to read %s", sha1_to_hex(sha1));
+			reader->bad++;
+			continue;
+		}
+		hash_sha1_file(buf, size, typename(type), real_sha1);
+		if (hashcmp(sha1, real_sha1)) {
+			error("%s read back as %s", sha1_to_hex(sha1),
+			      sha1_to_hex(real_sha1));
+			reader->bad++;
+		}
+		free(buf);
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	struct strbuf line = STRBUF_INIT;
+	struct reader *readers;
+	int i, nr_threads = 4, bad = 0;
+
+	if (argc > 2)
+		usage("test-read-objects [<threads>] <objects");
+	if (argc == 2)
+		nr_threads = atoi(argv[1]);
+	if (nr_threads < 1)
+		nr_threads = 1;
+
+	setup_git_directory();
+	git_config(git_default_config, NULL);
+	while (strbuf_getline(&line, stdin, '\n') != EOF) {
+		unsigned char sha1[20];
+
+		if (get_sha1_hex(line.buf, sha1))
+			die("not an object name: %s", line.buf);
+		sha1_array_append(&objects, sha1);
+	}
+	strbuf_release(&line);
+	if (!objects.nr)
+		return 0;
+
+	readers = xcalloc(nr_threads, sizeof(*readers));
+	for (i = 0; i < nr_threads; i++)
+		readers[i].start = i * objects.nr / nr_threads;
+
+#ifndef NO_PTHREADS
+	{
+		pthread_t *threads = xcalloc(nr_threads, sizeof(*threads));
+
+		enable_obj_read_lock();
+		for (i = 0; i < nr_threads; i++)
+			if (pthread_create(&threads[i], NULL, read_objects,
+					   &readers[i]))
+				die("unable to create thread");
+		for (i = 0; i < nr_threads; i++)
+			pthread_join(threads[i], NULL);
+		disable_obj_read_lock();
+		free(threads);
+	}
+#else
+	for (i = 0; i < nr_threads; i++)
+		read_objects(&readers[i]);
+#endif
+
+	for (i = 0; i < nr_threads; i++)
+		bad += readers[i].bad;
+	free(readers);
+	return !!bad;
+}
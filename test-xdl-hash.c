@@ -0,0 +1,44 @@
+/*
+ * Split a file into records the way the diff machinery does, and show
+ * their lengths; with -n <count>, hash the whole file <count> times
+ * instead, to time xdl_hash_record() on its own.
+ */
+#include "cache.h"
+#include "xdiff-interface.h"
+#include "xdiff/xtypes.h"
+#include "xdiff/xutils.h"
+
+static const char usage_str[] = "test-xdl-hash [-n <count>] <file>";
+
+int main(int argc, char **argv)
+{
+	struct strbuf buf = STRBUF_INIT;
+	unsigned long count = 0, nrec = 0, sum = 0;
+	const char *cur, *top;
+
+	if (argc == 4 && !strcmp(argv[1], "-n")) {
+		count = strtoul(argv[2], NULL, 10);
+		argv += 2;
+		argc -= 2;
+	}
+	if (argc != 2)
+		usage(usage_str);
+	if (strbuf_read_file(&buf, argv[1], 0) < 0)
+		die_errno("unable to read '%s'", argv[1]);
+	top = buf.buf + buf.len;
+
+	if (!count) {
+		for (cur = buf.buf; cur < top; ) {
+			const char *prev = cur;
+			xdl_hash_record(&cur, top, 0);
+			printf("%ld\n", (long)(cur - prev));
+		}
+		return 0;
+	}
+
+	while (count--)
+		for (cur = buf.buf; cur < top; nrec++)
+			sum += xdl_hash_record(&cur, top, 0);
+	printf("%lu records (hash sum %08lx)\n", nrec, sum & 0xffffffff);
+	return 0;
+}
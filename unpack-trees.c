@@ -7,6 +7,8 @@
 #include "unpack-trees.h"
 #include "progress.h"
 #include "refs.h"
+#include "split-index.h"
+#include "fsmonitor.h"
 #include "attr.h"
 
 /*
@@ -997,6 +999,7 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 	int i, ret;
 	static struct cache_entry *dfc;
 	struct exclude_list el;
+	struct index_state *src_index = o->src_index;
 
 	if (len > MAX_UNPACK_TREES)
 		die("unpack_trees takes at most %d trees", MAX_UNPACK_TREES);
@@ -1018,6 +1021,10 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 
 	memset(&o->result, 0, sizeof(o->result));
 	o->result.initialized = 1;
+	o->result.version = o->src_index->version;
+	o->result.split_index = o->src_index->split_index;
+	if (o->result.split_index)
+		o->result.split_index->refcount++;
 	o->result.timestamp.sec = o->src_index->timestamp.sec;
 	o->result.timestamp.nsec = o->src_index->timestamp.nsec;
 	o->merge_size = len;
@@ -1135,8 +1142,29 @@ int unpack_trees(unsigned len, struct tree_desc *t, struct unpack_trees_options
 
 	o->src_index = NULL;
 	ret = check_updates(o) ? (-2) : 0;
-	if (o->dst_index)
+	if (o->dst_index) {
+		discard_split_index(o->dst_index);
+		/*
+		 * The untracked cache stays valid for the paths that
+		 * were not invalidated only if the result was merged
+		 * from the index it was kept for.
+		 */
+		if (o->merge && o->dst_index == src_index)
+			o->result.untracked = o->dst_index->untracked;
+		else if (o->dst_index->untracked) {
+			/* keep it enabled, but start it over */
+			free_untracked_cache(o->dst_index->untracked);
+			o->result.untracked = new_untracked_cache();
+		}
+		/* the entries kept their CE_FSMONITOR_VALID bits */
+		if (src_index->fsmonitor_last_update)
+			o->result.fsmonitor_last_update =
+				xstrdup(src_index->fsmonitor_last_update);
+		o->result.fsmonitor_has_run_once =
+			src_index->fsmonitor_has_run_once;
+		discard_fsmonitor(o->dst_index);
 		*o->dst_index = o->result;
+	}
 
 done:
 	free_excludes(&el);
@@ -1233,8 +1261,10 @@ static int verify_uptodate_sparse(struct cache_entry *ce,
 
 static void invalidate_ce_path(struct cache_entry *ce, struct unpack_trees_options *o)
 {
-	if (ce)
-		cache_tree_invalidate_path(o->src_index->cache_tree, ce->name);
+	if (!ce)
+		return;
+	cache_tree_invalidate_path(o->src_index->cache_tree, ce->name);
+	untracked_cache_invalidate_path(o->src_index, ce->name);
 }
 
 /*
@@ -11,6 +11,8 @@
 #include "list-objects.h"
 #include "run-command.h"
 #include "sigchain.h"
+#include "sha1-array.h"
+#include "dir.h"
 
 static const char upload_pack_usage[] = "git upload-pack [--strict] [--timeout=<n>] <dir>";
 
@@ -44,6 +46,26 @@ static int debug_fd;
 static int advertise_refs;
 static int stateless_rpc;
 
+/*
+ * Packs sent to clients can be kept in $GIT_DIR/upload-pack-cache and
+ * sent again as they are to clients that make the same request while
+ * the refs have not changed.
+ */
+static int pack_cache;
+static unsigned long pack_cache_limit = 1024 * 1024 * 1024;
+static unsigned long pack_cache_max_age = 3600;
+/* how long to wait for another upload-pack filling the same entry */
+#define PACK_CACHE_WAIT 120
+/*
+ * The upload-pack filling an entry touches its lock every second, so
+ * a lock left alone for this long was left behind by one that died.
+ */
+#define PACK_CACHE_STALE 5
+static struct lock_file pack_cache_lock;
+static int pack_cache_fd = -1;
+static unsigned long pack_cache_written;
+static time_t pack_cache_touched;
+
 static void reset_timeout(void)
 {
 	alarm(timeout);
@@ -134,6 +156,286 @@ static int do_rev_list(int in, int out, void *user_data)
 	return 0;
 }
 
+static const char *pack_cache_dir(void)
+{
+	static char *dir;
+
+	if (!dir)
+		dir = xstrdup(git_path("upload-pack-cache"));
+	return dir;
+}
+
+static void hash_sha1_line(const unsigned char sha1[20], void *data)
+{
+	git_SHA_CTX *ctx = data;
+	char line[46];
+
+	/* "want " and "have " lines are told apart by the section header */
+	sprintf(line, "%s\n", sha1_to_hex(sha1));
+	git_SHA1_Update(ctx, line, strlen(line));
+}
+
+static int hash_ref(const char *refname, const unsigned char *sha1,
+		    int flag, void *cb_data)
+{
+	git_SHA_CTX *ctx = cb_data;
+	struct strbuf line = STRBUF_INIT;
+
+	strbuf_addf(&line, "%s %s\n", sha1_to_hex(sha1), refname);
+	git_SHA1_Update(ctx, line.buf, line.len);
+	strbuf_release(&line);
+	return 0;
+}
+
+/*
+ * The pack depends on what the client wants and has, on the
+ * capabilities that change what pack-objects does, and, as "--all"
+ * and "--include-tag" look at them, on the refs.
+ */
+static void pack_cache_key(unsigned char *key, int create_full_pack)
+{
+	struct sha1_array wants = SHA1_ARRAY_INIT, haves = SHA1_ARRAY_INIT;
+	struct strbuf buf = STRBUF_INIT;
+	git_SHA_CTX ctx;
+	int i;
+
+	for (i = 0; i < want_obj.nr; i++)
+		sha1_array_append(&wants, want_obj.objects[i].item->sha1);
+	for (i = 0; i < have_obj.nr; i++)
+		sha1_array_append(&haves, have_obj.objects[i].item->sha1);
+
+	git_SHA1_Init(&ctx);
+	strbuf_addf(&buf, "upload-pack-cache 1\nfull %d thin %d ofs %d tag %d\n",
+		    create_full_pack, use_thin_pack, use_ofs_delta,
+		    use_include_tag);
+	git_SHA1_Update(&ctx, buf.buf, buf.len);
+	git_SHA1_Update(&ctx, "wants\n", 6);
+	sha1_array_for_each_unique(&wants, hash_sha1_line, &ctx);
+	git_SHA1_Update(&ctx, "haves\n", 6);
+	sha1_array_for_each_unique(&haves, hash_sha1_line, &ctx);
+	git_SHA1_Update(&ctx, "refs\n", 5);
+	head_ref(hash_ref, &ctx);
+	for_each_ref(hash_ref, &ctx);
+	git_SHA1_Final(key, &ctx);
+
+	strbuf_release(&buf);
+	sha1_array_clear(&wants);
+	sha1_array_clear(&haves);
+}
+
+static void send_cached_pack(int fd, const char *path)
+{
+	char data[8192];
+	ssize_t sz;
+
+	trace_printf("upload-pack: sending cached pack %s\n", path);
+	/* the cache is pruned by the time of last use */
+	utime(path, NULL);
+	for (;;) {
+		reset_timeout();
+		sz = xread(fd, data, sizeof(data));
+		if (sz < 0)
+			die_errno("git upload-pack: unable to read %s", path);
+		if (!sz)
+			break;
+		if (send_client_data(1, data, sz) < 0)
+			die("git upload-pack: unable to send the pack");
+	}
+	close(fd);
+	if (use_sideband)
+		packet_flush(1);
+}
+
+/*
+ * Send the cached pack for the request if there is one and return 1.
+ * Otherwise return 0, having taken the lock to fill the entry unless
+ * another upload-pack holds it for too long.
+ */
+static int use_pack_cache(int create_full_pack)
+{
+	unsigned char key[20];
+	struct strbuf path = STRBUF_INIT, lock = STRBUF_INIT;
+	int waited, ret = 0;
+
+	pack_cache_key(key, create_full_pack);
+	strbuf_addf(&path, "%s/%s.pack", pack_cache_dir(), sha1_to_hex(key));
+	strbuf_addf(&lock, "%s.lock", path.buf);
+	if (safe_create_leading_directories(path.buf))
+		goto out;
+
+	for (waited = 0; ; waited++) {
+		struct stat st;
+		int fd = open(path.buf, O_RDONLY);
+
+		if (0 <= fd) {
+			if (!fstat(fd, &st) &&
+			    st.st_mtime + pack_cache_max_age >= time(NULL)) {
+				send_cached_pack(fd, path.buf);
+				ret = 1;
+				goto out;
+			}
+			close(fd);
+		}
+
+		pack_cache_fd = hold_lock_file_for_update(&pack_cache_lock,
+							  path.buf, 0);
+		if (0 <= pack_cache_fd || errno != EEXIST ||
+		    PACK_CACHE_WAIT <= waited)
+			break;
+		if (!lstat(lock.buf, &st) &&
+		    st.st_mtime + PACK_CACHE_STALE < time(NULL)) {
+			/* its writer died; take the entry over */
+			trace_printf("upload-pack: removing stale %s\n",
+				     lock.buf);
+			if (unlink_or_warn(lock.buf))
+				break;
+			continue;
+		}
+		/* somebody else is writing the same pack; wait for it */
+		reset_timeout();
+		sleep(1);
+	}
+	pack_cache_written = 0;
+	pack_cache_touched = time(NULL);
+out:
+	strbuf_release(&path);
+	strbuf_release(&lock);
+	return ret;
+}
+
+/*
+ * Whether the lock we took is still the one at the path of the entry,
+ * or somebody took the entry over while we were stuck.
+ */
+static int own_pack_cache_lock(void)
+{
+	struct stat ours, st;
+
+	return !fstat(pack_cache_fd, &ours) &&
+		!lstat(pack_cache_lock.filename, &st) &&
+		ours.st_dev == st.st_dev && ours.st_ino == st.st_ino;
+}
+
+static void drop_pack_cache(void)
+{
+	if (own_pack_cache_lock())
+		rollback_lock_file(&pack_cache_lock);
+	else {
+		/* leave the lock of whoever took over alone */
+		close_lock_file(&pack_cache_lock);
+		pack_cache_lock.filename[0] = 0;
+	}
+	pack_cache_fd = -1;
+}
+
+/* Show the upload-packs waiting for the entry that we are alive. */
+static void touch_pack_cache(void)
+{
+	time_t now;
+
+	if (pack_cache_fd < 0)
+		return;
+	now = time(NULL);
+	if (now == pack_cache_touched)
+		return;
+	pack_cache_touched = now;
+	utime(pack_cache_lock.filename, NULL);
+}
+
+static void write_pack_cache(const char *data, ssize_t sz)
+{
+	if (pack_cache_fd < 0)
+		return;
+	pack_cache_written += sz;
+	if (pack_cache_limit < pack_cache_written ||
+	    write_in_full(pack_cache_fd, data, sz) < 0)
+		drop_pack_cache();
+}
+
+struct pack_cache_entry {
+	char *path;
+	time_t mtime;
+	off_t size;
+};
+
+static int pack_cache_entry_cmp(const void *a_, const void *b_)
+{
+	const struct pack_cache_entry *a = a_, *b = b_;
+	return a->mtime < b->mtime ? -1 : a->mtime > b->mtime;
+}
+
+/*
+ * Remove entries (and locks left behind) older than the maximum age,
+ * then the least recently used ones until the rest fits the limit.
+ */
+static void prune_pack_cache(void)
+{
+	struct pack_cache_entry *entries = NULL;
+	int nr = 0, alloc = 0, i;
+	uintmax_t total = 0;
+	time_t now = time(NULL);
+	DIR *dir = opendir(pack_cache_dir());
+	struct dirent *de;
+
+	if (!dir)
+		return;
+	while ((de = readdir(dir)) != NULL) {
+		struct stat st;
+		char *path;
+
+		if (is_dot_or_dotdot(de->d_name))
+			continue;
+		path = xstrdup(mkpath("%s/%s", pack_cache_dir(), de->d_name));
+		if (lstat(path, &st)) {
+			free(path);
+			continue;
+		}
+		if (st.st_mtime + pack_cache_max_age < now) {
+			unlink(path);
+			free(path);
+			continue;
+		}
+		if (suffixcmp(de->d_name, ".pack")) {
+			free(path);
+			continue;
+		}
+		ALLOC_GROW(entries, nr + 1, alloc);
+		entries[nr].path = path;
+		entries[nr].mtime = st.st_mtime;
+		entries[nr].size = st.st_size;
+		total += st.st_size;
+		nr++;
+	}
+	closedir(dir);
+
+	qsort(entries, nr, sizeof(*entries), pack_cache_entry_cmp);
+	for (i = 0; i < nr; i++) {
+		if (pack_cache_limit < total) {
+			unlink(entries[i].path);
+			total -= entries[i].size;
+		}
+		free(entries[i].path);
+	}
+	free(entries);
+}
+
+static void finish_pack_cache(void)
+{
+	if (pack_cache_fd < 0)
+		return;
+	if (!own_pack_cache_lock()) {
+		drop_pack_cache();
+		return;
+	}
+	pack_cache_fd = -1;
+	if (commit_lock_file(&pack_cache_lock)) {
+		error("unable to write the pack cache: %s", strerror(errno));
+		rollback_lock_file(&pack_cache_lock);
+		return;
+	}
+	prune_pack_cache();
+}
+
 static void create_pack_file(void)
 {
 	struct async rev_list;
@@ -147,6 +449,10 @@ static void create_pack_file(void)
 	const char *argv[10];
 	int arg = 0;
 
+	/* shallow clients get a pack that depends on their shallow list */
+	if (pack_cache && !shallow_nr && use_pack_cache(create_full_pack))
+		return;
+
 	argv[arg++] = "pack-objects";
 	if (!shallow_nr) {
 		argv[arg++] = "--revs";
@@ -208,6 +514,7 @@ static void create_pack_file(void)
 		int pe, pu, pollsize;
 
 		reset_timeout();
+		touch_pack_cache();
 
 		pollsize = 0;
 		pe = pu = -1;
@@ -228,7 +535,8 @@ static void create_pack_file(void)
 		if (!pollsize)
 			break;
 
-		if (poll(pfd, pollsize, -1) < 0) {
+		/* wake up to touch the lock while pack-objects is quiet */
+		if (poll(pfd, pollsize, 0 <= pack_cache_fd ? 1000 : -1) < 0) {
 			if (errno != EINTR) {
 				error("poll failed, resuming: %s",
 				      strerror(errno));
@@ -286,6 +594,7 @@ static void create_pack_file(void)
 			}
 			else
 				buffered = -1;
+			write_pack_cache(data, sz);
 			sz = send_client_data(1, data, sz);
 			if (sz < 0)
 				goto fail;
@@ -302,16 +611,20 @@ static void create_pack_file(void)
 	/* flush the data */
 	if (0 <= buffered) {
 		data[0] = buffered;
+		write_pack_cache(data, 1);
 		sz = send_client_data(1, data, 1);
 		if (sz < 0)
 			goto fail;
 		fprintf(stderr, "flushed.\n");
 	}
+	finish_pack_cache();
 	if (use_sideband)
 		packet_flush(1);
 	return;
 
  fail:
+	if (0 <= pack_cache_fd)
+		drop_pack_cache();
 	send_client_data(3, abort_msg, sizeof(abort_msg));
 	die("git upload-pack: %s", abort_msg);
 }
@@ -764,6 +1077,23 @@ static int mark_our_ref(const char *refname, const unsigned char *sha1, int flag
 	return 0;
 }
 
+static int upload_pack_config(const char *var, const char *value, void *cb)
+{
+	if (!strcmp(var, "uploadpack.packcache")) {
+		pack_cache = git_config_bool(var, value);
+		return 0;
+	}
+	if (!strcmp(var, "uploadpack.packcachelimit")) {
+		pack_cache_limit = git_config_ulong(var, value);
+		return 0;
+	}
+	if (!strcmp(var, "uploadpack.packcachemaxage")) {
+		pack_cache_max_age = git_config_ulong(var, value);
+		return 0;
+	}
+	return 0;
+}
+
 static void upload_pack(void)
 {
 	if (advertise_refs || !stateless_rpc) {
@@ -836,6 +1166,7 @@ int main(int argc, char **argv)
 		die("'%s' does not appear to be a git repository", dir);
 	if (is_repository_shallow())
 		die("attempt to fetch/clone from a shallow repository");
+	git_config(upload_pack_config, NULL);
 	if (getenv("GIT_DEBUG_SEND_PACK"))
 		debug_fd = atoi(getenv("GIT_DEBUG_SEND_PACK"));
 	upload_pack();
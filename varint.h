@@ -0,0 +1,15 @@
+#ifndef VARINT_H
+#define VARINT_H
+
+#include "git-compat-util.h"
+
+/*
+ * The offset encoding of OFS_DELTA in packs: seven bits per byte, most
+ * significant group first, with the high bit set on all but the last
+ * byte, and each continuation adding one so that every value has a
+ * single encoding.
+ */
+extern int encode_varint(uintmax_t, unsigned char *);
+extern uintmax_t decode_varint(const unsigned char **);
+
+#endif /* VARINT_H */
@@ -20,6 +20,7 @@
  *
  */
 
+#include <assert.h>
 #include "xinclude.h"
 
 
@@ -277,6 +278,112 @@ static unsigned long xdl_hash_record_with_whitespace(char const **data,
 }
 
 
+#ifdef XDL_FAST_HASH
+
+#define REPEAT_BYTE(x)  ((~0ul / 0xff) * (x))
+
+#define ONEBYTES	REPEAT_BYTE(0x01)
+#define NEWLINEBYTES	REPEAT_BYTE(0x0a)
+#define HIGHBITS	REPEAT_BYTE(0x80)
+
+/*
+ * Return a word with the high bit set in each zero byte of "a".  Bytes
+ * above the first zero byte may get flagged spuriously, but on a
+ * little-endian machine the lowest bit set is always the right one.
+ */
+static inline unsigned long has_zero(unsigned long a)
+{
+	return ((a - ONEBYTES) & ~a) & HIGHBITS;
+}
+
+/*
+ * Count the bytes of a mask made of 0xff bytes from the least
+ * significant one up, e.g. 3 for 0x00ffffff.
+ */
+static inline long count_masked_bytes(unsigned long mask)
+{
+	if (sizeof(long) == 8) {
+		/*
+		 * Multiplying by 0x0001020304050608 sums up the byte
+		 * counts in the top byte; written this way to avoid
+		 * warnings about the constant on 32-bit machines.
+		 */
+		long a = (REPEAT_BYTE(0x01) / 0xff + 1);
+		return mask * a >> (sizeof(long) * 7);
+	} else {
+		/* (000000 0000ff 00ffff ffffff) -> ( 0 1 2 3 ) */
+		long a = (0x0ff0001 + mask) >> 23;
+		/* fix the 1 for the 00 case */
+		return a & mask;
+	}
+}
+
+/*
+ * Find the end of the line and hash it a word at a time, instead of
+ * one byte at a time.  This needs fast unaligned loads and assumes a
+ * little-endian machine.
+ */
+unsigned long xdl_hash_record(char const **data, char const *top, long flags)
+{
+	unsigned long hash = 5381;
+	unsigned long a = 0, mask = 0;
+	char const *ptr = *data;
+	char const *end = top - sizeof(unsigned long) + 1;
+
+	if (flags & XDF_WHITESPACE_FLAGS)
+		return xdl_hash_record_with_whitespace(data, top, flags);
+
+	ptr -= sizeof(unsigned long);
+	do {
+		hash += hash << 7;
+		hash ^= a;
+		ptr += sizeof(unsigned long);
+		if (ptr >= end)
+			break;
+		a = *(unsigned long *)ptr;
+		/* Do we have any '\n' bytes in this word? */
+		mask = has_zero(a ^ NEWLINEBYTES);
+	} while (!mask);
+
+	if (ptr >= end) {
+		/*
+		 * There is only a partial word left at the end of the
+		 * buffer.  As it may be the end of a memory mapping, we
+		 * have to read the rest byte by byte.
+		 */
+		const char *p;
+		for (a = 0, p = top - 1; p >= ptr; p--)
+			a = (a << 8) + *((const unsigned char *)p);
+		mask = has_zero(a ^ NEWLINEBYTES);
+		if (!mask)
+			/*
+			 * No '\n' in the partial word; make a mask that
+			 * covers the bytes we read.
+			 */
+			mask = 1UL << (8 * (top - ptr) + 7);
+	}
+
+	/* the mask *below* the first high bit set */
+	mask = (mask - 1) & ~mask;
+	mask >>= 7;
+	hash += hash << 7;
+	hash ^= a & mask;
+
+	/* advance past the last (possibly partial) word */
+	ptr += count_masked_bytes(mask);
+
+	if (ptr < top) {
+		assert(*ptr == '\n');
+		ptr++;
+	}
+
+	*data = ptr;
+
+	return hash;
+}
+
+#else /* XDL_FAST_HASH */
+
 unsigned long xdl_hash_record(char const **data, char const *top, long flags) {
 	unsigned long ha = 5381;
 	char const *ptr = *data;
@@ -293,6 +400,8 @@ unsigned long xdl_hash_record(char const **data, char const *top, long flags) {
 	return ha;
 }
 
+#endif /* XDL_FAST_HASH */
+
 
 unsigned int xdl_hashbits(unsigned int size) {
 	unsigned int val = 1, bits = 0;